@@ -0,0 +1,345 @@
+#include "AsyncLogBackend.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+    void appendBytes(std::vector<unsigned char> *out, const void *data, size_t length)
+    {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        out->insert(out->end(), bytes, bytes + length);
+    }
+
+    void appendSiteRecord(std::vector<unsigned char> *out, uint32_t id)
+    {
+        Logger::LogSite site = Logger::site(id);
+        std::string text = std::string(site.function) + ":" + std::to_string(site.line) + " " + site.file;
+        AsyncLogRecordHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.site = id;
+        header.level = ASYNC_LOG_SITE_RECORD;
+        header.length = static_cast<uint16_t>(std::min<size_t>(text.size(), UINT16_MAX));
+        appendBytes(out, &header, sizeof(header));
+        appendBytes(out, text.data(), header.length);
+    }
+
+    bool writeAll(int fd, const unsigned char *data, size_t length)
+    {
+        while (length > 0)
+        {
+            ssize_t written = ::write(fd, data, length);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+        return true;
+    }
+}
+
+AsyncLogBackend &AsyncLogBackend::instance()
+{
+    // Never destroyed, producer threads keep pointers to their rings until they exit
+    static AsyncLogBackend *backend = new AsyncLogBackend();
+    return *backend;
+}
+
+AsyncLogBackend::AsyncLogBackend()
+    : mFileBytes(ASYNC_LOG_FILE_BYTES), mBackups(ASYNC_LOG_BACKUPS), keepRunning(false), mUrgent(false), mDrainWanted(false), mFd(-1), mFileOffset(0),
+      mSitesDefined(0), mRecords(0), mWrites(0), mBytes(0)
+{
+    mBlock.reserve(ASYNC_LOG_BLOCK_BYTES);
+}
+
+bool AsyncLogBackend::start(const std::string &path, size_t fileBytes, int backups)
+{
+    if (mWriterThread.joinable())
+    {
+        return true;
+    }
+    mPath = path;
+    mFileBytes = fileBytes;
+    mBackups = backups;
+    // Every run starts a new file, the previous ones move down the backups
+    rollFiles();
+    if (mFd < 0)
+    {
+        return false;
+    }
+    keepRunning = true;
+    mWriterThread = std::thread(&AsyncLogBackend::run, this);
+    return true;
+}
+
+void AsyncLogBackend::stop()
+{
+    if (!mWriterThread.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mWriterMutex);
+        keepRunning = false;
+    }
+    mWriterCV.notify_all();
+    mWriterThread.join();
+    if (mFd >= 0)
+    {
+        ::close(mFd);
+        mFd = -1;
+    }
+}
+
+AsyncLogBackend::ThreadRing *AsyncLogBackend::threadRing()
+{
+    thread_local ThreadRing *ring = nullptr;
+    if (!ring)
+    {
+        std::unique_ptr<ThreadRing> newRing(new ThreadRing());
+        newRing->threadId = static_cast<uint32_t>(syscall(SYS_gettid));
+        std::lock_guard<std::mutex> lock(mRingsMutex);
+        ring = newRing.get();
+        mRings.push_back(std::move(newRing));
+    }
+    return ring;
+}
+
+void AsyncLogBackend::append(int level, uint32_t site, const std::string &message)
+{
+    ThreadRing *ring = threadRing();
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    uint64_t used = head - ring->tail.load(std::memory_order_acquire);
+    if (used >= ASYNC_LOG_RING_SLOTS)
+    {
+        // Only an ERROR or FATAL waits, for at most one drain period; anything else is dropped
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(ASYNC_LOG_DRAIN_MS);
+        while (level >= Logger::ERROR && used >= ASYNC_LOG_RING_SLOTS && std::chrono::steady_clock::now() < deadline)
+        {
+            mUrgent.store(true, std::memory_order_relaxed);
+            mWriterCV.notify_one();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            used = head - ring->tail.load(std::memory_order_acquire);
+        }
+        if (used >= ASYNC_LOG_RING_SLOTS)
+        {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    AsyncLogRecordHeader header;
+    header.timestampNs = static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+    header.site = site;
+    header.threadId = ring->threadId;
+    header.level = static_cast<uint16_t>(level);
+    header.length = static_cast<uint16_t>(std::min(message.size(), ASYNC_LOG_TEXT_BYTES));
+    header.reserved = 0;
+    if (header.length < message.size())
+    {
+        ring->truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+    unsigned char *slot = ring->slots[head % ASYNC_LOG_RING_SLOTS];
+    std::memcpy(slot, &header, sizeof(header));
+    std::memcpy(slot + sizeof(header), message.data(), header.length);
+    ring->head.store(head + 1, std::memory_order_release);
+    if (level >= Logger::ERROR)
+    {
+        mUrgent.store(true, std::memory_order_relaxed);
+        mWriterCV.notify_one();
+    }
+    else if (used + 1 == ASYNC_LOG_RING_SLOTS / 2)
+    {
+        // A burst: drain now rather than at the next period, the block is still written in one piece
+        mDrainWanted.store(true, std::memory_order_relaxed);
+        mWriterCV.notify_one();
+    }
+}
+
+AsyncLogStats AsyncLogBackend::stats()
+{
+    AsyncLogStats stats;
+    stats.records = mRecords.load(std::memory_order_relaxed);
+    stats.dropped = 0;
+    stats.truncated = 0;
+    stats.writes = mWrites.load(std::memory_order_relaxed);
+    stats.bytes = mBytes.load(std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mRingsMutex);
+    for (const auto &ring : mRings)
+    {
+        stats.dropped += ring->dropped.load(std::memory_order_relaxed);
+        stats.truncated += ring->truncated.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
+
+/**
+ * Writer thread: drains every ring each ASYNC_LOG_DRAIN_MS, or at once after an ERROR or FATAL, and
+ * writes the block when it is full, has waited ASYNC_LOG_FLUSH_MS, holds an ERROR or FATAL, or on stop.
+ */
+void AsyncLogBackend::run()
+{
+    std::vector<ThreadRing *> rings;
+    auto lastWrite = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mWriterMutex);
+    while (true)
+    {
+        mWriterCV.wait_for(lock, std::chrono::milliseconds(ASYNC_LOG_DRAIN_MS), [this]
+                           { return !keepRunning || mUrgent.load(std::memory_order_relaxed) || mDrainWanted.load(std::memory_order_relaxed); });
+        bool stopping = !keepRunning;
+        lock.unlock();
+
+        mDrainWanted.store(false, std::memory_order_relaxed);
+        bool urgent = mUrgent.exchange(false, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> ringsLock(mRingsMutex);
+            rings.clear();
+            for (const auto &ring : mRings)
+            {
+                rings.push_back(ring.get());
+            }
+        }
+        for (ThreadRing *ring : rings)
+        {
+            drain(ring);
+        }
+        auto now = std::chrono::steady_clock::now();
+        if (!mBlock.empty() && (urgent || stopping || now - lastWrite >= std::chrono::milliseconds(ASYNC_LOG_FLUSH_MS)))
+        {
+            writeBlock();
+        }
+        if (mBlock.empty())
+        {
+            lastWrite = now;
+        }
+
+        lock.lock();
+        if (stopping)
+        {
+            break;
+        }
+    }
+}
+
+void AsyncLogBackend::drain(ThreadRing *ring)
+{
+    uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+    uint64_t head = ring->head.load(std::memory_order_acquire);
+    for (; tail != head; ++tail)
+    {
+        const unsigned char *slot = ring->slots[tail % ASYNC_LOG_RING_SLOTS];
+        AsyncLogRecordHeader header;
+        std::memcpy(&header, slot, sizeof(header));
+        addRecord(header, slot + sizeof(header));
+        // Hand the slot back right away, a block write below must not hold up the producer
+        ring->tail.store(tail + 1, std::memory_order_release);
+    }
+}
+
+void AsyncLogBackend::addRecord(const AsyncLogRecordHeader &header, const void *text)
+{
+    if (header.site >= mSitesDefined)
+    {
+        defineSites(Logger::siteCount());
+    }
+    if (mBlock.size() + sizeof(header) + header.length > ASYNC_LOG_BLOCK_BYTES)
+    {
+        writeBlock();
+    }
+    appendBytes(&mBlock, &header, sizeof(header));
+    appendBytes(&mBlock, text, header.length);
+    mRecords.fetch_add(1, std::memory_order_relaxed);
+}
+
+void AsyncLogBackend::defineSites(uint32_t siteCount)
+{
+    for (uint32_t id = mSitesDefined; id < siteCount; ++id)
+    {
+        if (mBlock.size() + ASYNC_LOG_SLOT_BYTES > ASYNC_LOG_BLOCK_BYTES)
+        {
+            writeBlock();
+        }
+        appendSiteRecord(&mBlock, id);
+    }
+    mSitesDefined = std::max(mSitesDefined, siteCount);
+}
+
+void AsyncLogBackend::writeBlock()
+{
+    if (mBlock.empty())
+    {
+        return;
+    }
+    // Sites used by the block are defined again at the top of the new file
+    if (mFileOffset > sizeof(AsyncLogFileHeader) && mFileOffset + mBlock.size() > mFileBytes)
+    {
+        rollFiles();
+    }
+    if (mFd >= 0 && writeAll(mFd, mBlock.data(), mBlock.size()))
+    {
+        mFileOffset += mBlock.size();
+        mWrites.fetch_add(1, std::memory_order_relaxed);
+        mBytes.fetch_add(mBlock.size(), std::memory_order_relaxed);
+    }
+    mBlock.clear();
+}
+
+void AsyncLogBackend::rollFiles()
+{
+    if (mFd >= 0)
+    {
+        ::close(mFd);
+        mFd = -1;
+    }
+    for (int i = mBackups; i > 0; --i)
+    {
+        std::string from = (i == 1) ? mPath : mPath + "." + std::to_string(i - 1);
+        std::rename(from.c_str(), (mPath + "." + std::to_string(i)).c_str());
+    }
+    openFile();
+}
+
+bool AsyncLogBackend::openFile()
+{
+    mFd = ::open(mPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mFd < 0)
+    {
+        std::fprintf(stderr, "AsyncLogBackend: open(%s) failed: %s\n", mPath.c_str(), strerror(errno));
+        return false;
+    }
+    // File header and the sites known so far, so the file decodes without its predecessors
+    std::vector<unsigned char> prologue;
+    AsyncLogFileHeader fileHeader;
+    fileHeader.magic = ASYNC_LOG_MAGIC;
+    fileHeader.version = ASYNC_LOG_VERSION;
+    fileHeader.reserved = 0;
+    appendBytes(&prologue, &fileHeader, sizeof(fileHeader));
+    uint32_t siteCount = Logger::siteCount();
+    for (uint32_t id = 0; id < siteCount; ++id)
+    {
+        appendSiteRecord(&prologue, id);
+    }
+    mSitesDefined = siteCount;
+    mFileOffset = 0;
+    if (writeAll(mFd, prologue.data(), prologue.size()))
+    {
+        mFileOffset = prologue.size();
+        mWrites.fetch_add(1, std::memory_order_relaxed);
+        mBytes.fetch_add(prologue.size(), std::memory_order_relaxed);
+    }
+    return true;
+}
@@ -0,0 +1,129 @@
+#ifndef ASYNC_LOG_BACKEND_HPP
+#define ASYNC_LOG_BACKEND_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * Binary log file layout, shared with the logDecoder tool:
+ * an AsyncLogFileHeader, then records of an AsyncLogRecordHeader followed by `length` bytes of text.
+ * A record whose level is ASYNC_LOG_SITE_RECORD defines call site `site` as "function:line file";
+ * every file defines the sites it uses before their first record, so each file decodes on its own.
+ */
+constexpr uint32_t ASYNC_LOG_MAGIC = 0x474F4C53; // "SLOG"
+constexpr uint16_t ASYNC_LOG_VERSION = 1;
+constexpr uint16_t ASYNC_LOG_SITE_RECORD = 0xFFFF;
+// Records each producer thread can hold until the writer drains them; further records are dropped
+constexpr size_t ASYNC_LOG_RING_SLOTS = 64;
+constexpr size_t ASYNC_LOG_SLOT_BYTES = 512;
+// Bytes collected before a write; a partial block is written after ASYNC_LOG_FLUSH_MS or on ERROR/FATAL
+constexpr size_t ASYNC_LOG_BLOCK_BYTES = 64 * 1024;
+constexpr int ASYNC_LOG_DRAIN_MS = 50;
+constexpr int ASYNC_LOG_FLUSH_MS = 5000;
+constexpr size_t ASYNC_LOG_FILE_BYTES = 256 * 1024;
+constexpr int ASYNC_LOG_BACKUPS = 3;
+
+struct AsyncLogFileHeader
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+};
+
+struct AsyncLogRecordHeader
+{
+    uint64_t timestampNs; // CLOCK_REALTIME
+    uint32_t site;
+    uint32_t threadId;
+    uint16_t level;       // Logger::LogLevel, or ASYNC_LOG_SITE_RECORD
+    uint16_t length;      // Text bytes following the header
+    uint32_t reserved;
+};
+
+constexpr size_t ASYNC_LOG_TEXT_BYTES = ASYNC_LOG_SLOT_BYTES - sizeof(AsyncLogRecordHeader);
+
+/**
+ * @struct AsyncLogStats
+ * @brief Counters of the asynchronous backend.
+ */
+struct AsyncLogStats
+{
+    uint64_t records;
+    uint64_t dropped;   // Producer ring full
+    uint64_t truncated; // Message longer than ASYNC_LOG_TEXT_BYTES
+    uint64_t writes;
+    uint64_t bytes;
+};
+
+/**
+ * @brief Asynchronous binary backend of Logger.
+ *
+ * Each producer thread appends fixed-size records to its own single-producer ring and never
+ * blocks or takes a lock after its first record; a full ring drops the record. One writer thread
+ * drains the rings into a block buffer and writes it with a single write() when it is full, after
+ * ASYNC_LOG_FLUSH_MS, or when an ERROR or FATAL record arrives, rolling over ASYNC_LOG_BACKUPS
+ * files like the log4cplus RollingFileAppender. Records are stored binary and turned into text
+ * offline by the logDecoder tool.
+ */
+class AsyncLogBackend
+{
+public:
+    static AsyncLogBackend &instance();
+
+    bool start(const std::string &path, size_t fileBytes = ASYNC_LOG_FILE_BYTES, int backups = ASYNC_LOG_BACKUPS);
+    // Drains and writes everything logged so far
+    void stop();
+    // Called by Logger::log on the logging thread
+    void append(int level, uint32_t site, const std::string &message);
+    AsyncLogStats stats();
+
+private:
+    struct alignas(64) ThreadRing
+    {
+        std::atomic<uint64_t> head{0}; // Written by the producer
+        alignas(64) std::atomic<uint64_t> tail{0}; // Written by the writer
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> truncated{0};
+        uint32_t threadId = 0;
+        unsigned char slots[ASYNC_LOG_RING_SLOTS][ASYNC_LOG_SLOT_BYTES];
+    };
+
+    AsyncLogBackend();
+    ThreadRing *threadRing();
+    void run();
+    void drain(ThreadRing *ring);
+    void addRecord(const AsyncLogRecordHeader &header, const void *text);
+    void defineSites(uint32_t siteCount);
+    void writeBlock();
+    bool openFile();
+    void rollFiles();
+
+    std::string mPath;
+    size_t mFileBytes;
+    int mBackups;
+    std::thread mWriterThread;
+    std::mutex mWriterMutex;
+    std::condition_variable mWriterCV;
+    bool keepRunning;
+    std::atomic<bool> mUrgent;      // Drain and write now
+    std::atomic<bool> mDrainWanted; // Drain now, a producer ring is half full
+    std::mutex mRingsMutex; // Guards mRings
+    std::vector<std::unique_ptr<ThreadRing>> mRings;
+    // Writer thread only
+    int mFd;
+    size_t mFileOffset;
+    uint32_t mSitesDefined; // Sites already defined in the current file
+    std::vector<unsigned char> mBlock;
+    std::atomic<uint64_t> mRecords;
+    std::atomic<uint64_t> mWrites;
+    std::atomic<uint64_t> mBytes;
+};
+
+#endif // ASYNC_LOG_BACKEND_HPP
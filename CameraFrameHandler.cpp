@@ -1,4 +1,5 @@
 #include "CameraFrameHandler.hpp"
+#include <fstream>
 #define GET_MIN(a, b) ((a) < (b) ? (a) : (b))
 #define GET_MAX(a, b) ((a > b) ? a : b)
 using namespace ::camera;
@@ -8,6 +9,7 @@ CameraFrameHandler::CameraFrameHandler(u16 bufferId)
 {
     mFrameReader = std::make_unique<FrameReader>(bufferId);
     mFrameConverter = std::make_unique<FrameConverter>();
+    mThumbnailEncoder = std::make_unique<ThumbnailEncoder>();
 }
 frameInfoYUV *CameraFrameHandler::CaptureFrameFromCamera()
 {
@@ -39,40 +41,91 @@ std::shared_ptr<uint8_t[]> CameraFrameHandler::convertAndResize(uint8_t *raw, in
  *
  * @exception std::bad_alloc If memory allocation for the output array fails.
  */
-std::shared_ptr<uint8_t[]> CameraFrameHandler::normalizeAndResize(uint8_t *raw, int width, int height, NormalizationParams params, BoundingBox *unionBox)
+std::shared_ptr<uint8_t[]> CameraFrameHandler::normalizeAndResize(uint8_t *raw, int width, int height, const NormalizationParams &params, BoundingBox *unionBox)
 {
     return mFrameConverter->normalizeAndResize(raw, width, height, params, unionBox);
 }
 
-std::shared_ptr<uint8_t[]> CameraFrameHandler::resizeNormalizeQuantize(uint8_t *raw, int width, int height, NormalizationParams params, BoundingBox *unionBox)
+/**
+ * @brief Crops, converts and quantizes an NV12 frame into the input layout of a quantized model.
+ *
+ * The crop is converted straight to RGB at the model resolution and then mapped through the
+ * 256-entry quantization table of the model (see SurveillanceSystem::getNormalizationParams),
+ * so no float intermediate is created.
+ */
+std::shared_ptr<uint8_t[]> CameraFrameHandler::resizeNormalizeQuantize(uint8_t *raw, int width, int height, const NormalizationParams &params, BoundingBox *unionBox)
 {
     return mFrameConverter->resizeNormalizeQuantize(raw, width, height, params, unionBox);
 }
 
-ScalingParams CameraFrameHandler::convertAndStore(uint8_t *raw, int width, int height, int newWidth, int newHeight, const std::string &filePath, BoundingBox *unionBox)
+/**
+ * @brief Same as above, but writes into a caller owned buffer such as the input tensor of the model.
+ *
+ * @return false if the arguments are invalid or the buffer is smaller than the model input.
+ */
+bool CameraFrameHandler::resizeNormalizeQuantize(uint8_t *raw, int width, int height, const NormalizationParams &params, uint8_t *output, size_t outputSize, BoundingBox *unionBox)
 {
-    return mFrameConverter->convertAndStore(raw, width, height, newWidth, newHeight, filePath, unionBox);
+    return mFrameConverter->resizeNormalizeQuantize(raw, width, height, params, output, outputSize, unionBox);
 }
 
-void CameraFrameHandler::saveBufferAsJpeg(uint8_t *buffer, int width, int height, const std::string &filePath)
+SourceRect CameraFrameHandler::getSourceRect(int width, int height, int newWidth, int newHeight, const BoundingBox *unionBox)
 {
-    std::cerr << "saveBufferAsJpeg OK1" << " width=" << width << "height " << height << std::endl;
+    SourceRect sourceRect{0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height)};
+    getCropGeometry(width, height, newWidth, newHeight, unionBox, &sourceRect);
+    return sourceRect;
+}
 
-    cv::Mat yuvImage(height + height / 2, width, CV_8UC1, buffer); // Assuming YUV420p
-    cv::Mat convertedImage = cv::Mat(width, height, CV_8UC4);
-    cv::cvtColor(yuvImage, convertedImage, cv::COLOR_YUV2BGR_NV12); // Proper YUV to BGR conversion
+static bool writeJpegFile(const std::string &filePath, const std::vector<uint8_t> &jpeg)
+{
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file.write(reinterpret_cast<const char *>(jpeg.data()), static_cast<std::streamsize>(jpeg.size())))
+    {
+        LOG_ERROR("Failed to save image to " << filePath);
+        return false;
+    }
+    return true;
+}
 
-    // Write the image to a file
-    std::vector<int> compression_params;
-    compression_params.push_back(cv::IMWRITE_JPEG_QUALITY);
-    compression_params.push_back(95); // Adjust the quality as needed
-    if (!cv::imwrite(filePath, convertedImage, compression_params))
+/**
+ * @brief Encodes the thumbnail crop of an NV12 frame to JPEG in memory.
+ *
+ * The crop is the one convertAndResize and convertAndStore use, so the returned ScalingParams map the
+ * metadata boxes onto the encoded image the same way. The frame is never converted to RGB: the Y and UV
+ * planes are resampled into planar YUV 4:2:0 and compressed as is.
+ *
+ * @param jpeg Receives the JPEG stream. Its capacity is reused across calls.
+ * @return ScalingParams The scale factor, crop size and aligned center of the crop.
+ */
+ScalingParams CameraFrameHandler::encodeThumbnail(const uint8_t *raw, int width, int height, int newWidth, int newHeight, int quality, std::vector<uint8_t> *jpeg, const BoundingBox *unionBox)
+{
+    SourceRect sourceRect{0.0f, 0.0f, static_cast<float>(width), static_cast<float>(height)};
+    ScalingParams params = getCropGeometry(width, height, newWidth, newHeight, unionBox, &sourceRect);
+    if (!mThumbnailEncoder->encode(raw, width, height, sourceRect, newWidth, newHeight, quality, jpeg))
     {
-        std::cerr << "Failed to write image to " << filePath << std::endl;
+        jpeg->clear();
     }
-    else
+    return params;
+}
+
+ScalingParams CameraFrameHandler::convertAndStore(uint8_t *raw, int width, int height, int newWidth, int newHeight, const std::string &filePath, BoundingBox *unionBox)
+{
+    thread_local std::vector<uint8_t> jpeg;
+    ScalingParams params = encodeThumbnail(raw, width, height, newWidth, newHeight, THUMBNAIL_JPEG_QUALITY, &jpeg, unionBox);
+    if (!jpeg.empty() && writeJpegFile(filePath, jpeg))
     {
-        std::cout << "Image saved successfully to " << filePath << std::endl;
+        LOG_INFO("Image saved with quality " << THUMBNAIL_JPEG_QUALITY << " to " << filePath);
+    }
+    return params;
+}
+
+void CameraFrameHandler::saveBufferAsJpeg(uint8_t *buffer, int width, int height, const std::string &filePath)
+{
+    // The whole frame at its own size, sampled 1:1
+    thread_local std::vector<uint8_t> jpeg;
+    encodeThumbnail(buffer, width, height, width, height, THUMBNAIL_JPEG_QUALITY, &jpeg, nullptr);
+    if (!jpeg.empty() && writeJpegFile(filePath, jpeg))
+    {
+        LOG_INFO("Image saved successfully to " << filePath);
     }
 }
 
@@ -119,23 +172,23 @@ cv::Point2f CameraFrameHandler::getActualCentroid(cv::Rect boundRect)
  * within the frame dimensions while accounting for the specified crop size.
  *
  * @param orgCenter The original center point (centroid) to be aligned.
- * @param origFrame The original frame from which the crop is taken.
+ * @param frameSize The size of the frame from which the crop is taken.
  * @param cropSize The size of the crop area.
  * @return cv::Point2f The adjusted centroid point after alignment.
  *
  * @note The method uses `GET_MAX` and `GET_MIN` macros to ensure the centroid remains within the valid range.
  */
-cv::Point2f CameraFrameHandler::alignCentroid(cv::Point2f orgCenter, cv::Mat origFrame, cv::Size cropSize)
+cv::Point2f CameraFrameHandler::alignCentroid(cv::Point2f orgCenter, cv::Size frameSize, cv::Size cropSize)
 {
     cv::Point2f pts;
 
     // Calculate the necessary shifts to align the centroid
-    float shiftX = (orgCenter.x + cropSize.width / 2) - origFrame.cols;
+    float shiftX = (orgCenter.x + cropSize.width / 2) - frameSize.width;
     float adjustedX = orgCenter.x - std::max(0.0f, shiftX);
     float shiftXleft = adjustedX - cropSize.width / 2;
     float adjustedXfinal = adjustedX - std::min(0.0f, shiftXleft);
 
-    float shiftY = (orgCenter.y + cropSize.height / 2) - origFrame.rows;
+    float shiftY = (orgCenter.y + cropSize.height / 2) - frameSize.height;
     float adjustedY = orgCenter.y - std::max(0.0f, shiftY);
     float shiftYdown = adjustedY - cropSize.height / 2;
     float adjustedYfinal = adjustedY - std::min(0.0f, shiftYdown);
@@ -148,7 +201,7 @@ cv::Point2f CameraFrameHandler::alignCentroid(cv::Point2f orgCenter, cv::Mat ori
     std::cout << "\n\n Original Center { " << orgCenter.x << ", " << orgCenter.y << " } " 
               << "Aligned Center: { " << adjustedXfinal << ", " << adjustedYfinal << " } \n";
     std::cout << " Cropping Resolution {W, H}: { " << cropSize.width << ", " << cropSize.height << " } " 
-              << "Original frame Resolution {W, H}: { " << origFrame.cols << ", " << origFrame.rows << " } \n";
+              << "Original frame Resolution {W, H}: { " << frameSize.width << ", " << frameSize.height << " } \n";
     std::cout << " Intermediate Adjustments {shiftX, adjustedX, shiftXleft}: { " << shiftX << ", " << adjustedX << ", " << shiftXleft << " } \n";
     std::cout << " Intermediate Adjustments {shiftY, adjustedY, shiftYdown}: { " << shiftY << ", " << adjustedY << ", " << shiftYdown << " } \n\n";
 #endif
@@ -227,4 +280,59 @@ cv::Size CameraFrameHandler::getResizedCropSize(cv::Rect currentBox, int newWidt
         *scaleFactor = std::max(static_cast<double>(currentBox.width) / newWidth, static_cast<double>(currentBox.height) / newHeight);
     }
     return cv::Size(newWidth, newHeight);
-}
\ No newline at end of file
+}
+/**
+ * @brief Works out which part of the source frame ends up in a newWidth x newHeight output.
+ *
+ * Mirrors the thumbnail cropping rules: with a union box the frame is conceptually downscaled by
+ * the factor from getResizedCropSize() and a newWidth x newHeight window is cut around the aligned
+ * centroid of the box. Without a union box the whole frame is resized. The window is returned in
+ * source frame pixels so that the caller can sample it directly without building the scaled frame.
+ *
+ * @param width Width of the source frame.
+ * @param height Height of the source frame.
+ * @param newWidth Width of the output image.
+ * @param newHeight Height of the output image.
+ * @param unionBox Optional union box to center the crop on.
+ * @param sourceRect Receives the region of the source frame to sample.
+ * @return ScalingParams The scale factor, crop size and aligned center (in scaled frame coordinates).
+ */
+ScalingParams CameraFrameHandler::getCropGeometry(int width, int height, int newWidth, int newHeight, const BoundingBox *unionBox, SourceRect *sourceRect)
+{
+    ScalingParams params;
+    if (unionBox && !unionBox->isEmpty())
+    {
+        double scaleFactor = 1.0;
+        cv::Rect currentBox(unionBox->boundingBoxXOrd, unionBox->boundingBoxYOrd, unionBox->boundingBoxWidth, unionBox->boundingBoxHeight);
+        cv::Size cropSize = getResizedCropSize(currentBox, newWidth, newHeight, &scaleFactor);
+        cv::Size scaledFrame(width, height);
+        if (scaleFactor != 1.0)
+        {
+            scaledFrame = cv::Size(static_cast<int>(width / scaleFactor), static_cast<int>(height / scaleFactor));
+            // Resize the union blob with scaleFactor
+            currentBox.x = static_cast<int>(unionBox->boundingBoxXOrd / scaleFactor);
+            currentBox.y = static_cast<int>(unionBox->boundingBoxYOrd / scaleFactor);
+            currentBox.width = static_cast<int>(unionBox->boundingBoxWidth / scaleFactor);
+            currentBox.height = static_cast<int>(unionBox->boundingBoxHeight / scaleFactor);
+        }
+        cv::Point2f orgCenter = getActualCentroid(currentBox);
+        cv::Point2f alignedCenter = alignCentroid(orgCenter, scaledFrame, cropSize);
+
+        sourceRect->x = static_cast<float>((alignedCenter.x - cropSize.width / 2.0f) * scaleFactor);
+        sourceRect->y = static_cast<float>((alignedCenter.y - cropSize.height / 2.0f) * scaleFactor);
+        sourceRect->width = static_cast<float>(cropSize.width * scaleFactor);
+        sourceRect->height = static_cast<float>(cropSize.height * scaleFactor);
+
+        params.scaleFactor = scaleFactor;
+        params.size = CropSize(cropSize.width, cropSize.height);
+        params.point2f = Point(alignedCenter.x, alignedCenter.y);
+    }
+    else
+    {
+        sourceRect->x = 0.0f;
+        sourceRect->y = 0.0f;
+        sourceRect->width = static_cast<float>(width);
+        sourceRect->height = static_cast<float>(height);
+    }
+    return params;
+}
@@ -9,7 +9,10 @@
 #include <opencv2/opencv.hpp>
 #include "xStreamerConsumer.h"
 #include "MotionEventMetadata.hpp"
+#include "FrameKernels.hpp"
+#include "ThumbnailEncoder.hpp"
 #include "Logger.hpp"
+#include "PerfCounters.hpp"
 
 namespace camera
 {
@@ -24,6 +27,9 @@ namespace camera
             int inputWidth;
             int inputHeight;
             int noOfChannels;
+            // uint8 pixel -> quantized model input, built once per model from the values above
+            uint8_t quantTable[256];
+            bool isQuantTableIdentity;
             void print() const
             {
                 std::cout << "Scale: " << scale << std::endl;
@@ -42,11 +48,15 @@ namespace camera
             CameraFrameHandler(u16 bufferId);
             frameInfoYUV *CaptureFrameFromCamera();
             std::shared_ptr<uint8_t[]> convertAndResize(uint8_t *raw, int width, int height, int newWidth, int newHeight, BoundingBox *unionBox = nullptr);
-            std::shared_ptr<uint8_t[]> normalizeAndResize(uint8_t *raw, int width, int height, NormalizationParams params, BoundingBox *unionBox = nullptr);
-            std::shared_ptr<uint8_t[]> resizeNormalizeQuantize(uint8_t *raw, int width, int height, NormalizationParams params, BoundingBox *unionBox = nullptr);
+            std::shared_ptr<uint8_t[]> normalizeAndResize(uint8_t *raw, int width, int height, const NormalizationParams &params, BoundingBox *unionBox = nullptr);
+            std::shared_ptr<uint8_t[]> resizeNormalizeQuantize(uint8_t *raw, int width, int height, const NormalizationParams &params, BoundingBox *unionBox = nullptr);
+            bool resizeNormalizeQuantize(uint8_t *raw, int width, int height, const NormalizationParams &params, uint8_t *output, size_t outputSize, BoundingBox *unionBox = nullptr);
             ScalingParams convertAndStore(uint8_t *raw, int width, int height, int newWidth, int newHeight, const std::string &filePath, BoundingBox *unionBox = nullptr);
+            ScalingParams encodeThumbnail(const uint8_t *raw, int width, int height, int newWidth, int newHeight, int quality, std::vector<uint8_t> *jpeg, const BoundingBox *unionBox = nullptr);
             void saveBufferAsJpeg(uint8_t *buffer, int width, int height, const std::string &filePath);
             void saveRGBBufferAsJPEG(const uint8_t *buffer, int width, int height, const std::string &filename);
+            // Region of the source frame that the crop functions above map onto a newWidth x newHeight output
+            static SourceRect getSourceRect(int width, int height, int newWidth, int newHeight, const BoundingBox *unionBox);
 
         private:
             class FrameConverter
@@ -61,179 +71,82 @@ namespace camera
                         LOG_ERROR("Invalid input dimensions or raw data.");
                         return nullptr;
                     }
-                    cv::Mat rgbFrame = convertYUVToRGB(raw, width, height);
-                    if (rgbFrame.empty())
-                    {
-                        LOG_ERROR("Failed to convert YUV to RGB.");
-                        return nullptr;
-                    }
-                    cv::Mat resizedFrame;
-                    resizeFrame(rgbFrame, resizedFrame, newWidth, newHeight, unionBox);
-                    if (resizedFrame.empty())
+                    size_t numBytes = static_cast<size_t>(newWidth) * newHeight * 3;
+                    std::shared_ptr<uint8_t[]> output(new (std::nothrow) uint8_t[numBytes], std::default_delete<uint8_t[]>());
+                    if (!output)
                     {
-                        LOG_ERROR("Failed to resize the frame.");
+                        LOG_ERROR("Error: Memory allocation failed for output buffer.");
                         return nullptr;
                     }
-                    return allocateAndCopy(resizedFrame);
+                    cropAndConvert(raw, width, height, newWidth, newHeight, unionBox, output.get(), false);
+                    return output;
                 }
-                std::shared_ptr<uint8_t[]> normalizeAndResize(uint8_t *raw, int width, int height, NormalizationParams params, BoundingBox *unionBox)
+                std::shared_ptr<uint8_t[]> normalizeAndResize(uint8_t *raw, int width, int height, const NormalizationParams &params, BoundingBox *unionBox)
                 {
                     if (!raw || width <= 0 || height <= 0 || params.inputWidth <= 0 || params.inputHeight <= 0)
                     {
                         LOG_ERROR("Invalid input dimensions or raw data.");
                         return nullptr;
                     }
-                    cv::Mat rgbFrame = convertYUVToRGB(raw, width, height);
-                    if (rgbFrame.empty())
-                    {
-                        LOG_ERROR("Failed to convert YUV to RGB.");
-                        return nullptr;
-                    }
-                    cv::Mat resizedFrame;
-                    resizeFrame(rgbFrame, resizedFrame, params.inputWidth, params.inputHeight, unionBox);
-                    if (resizedFrame.empty())
-                    {
-                        LOG_ERROR("Failed to resize the frame.");
-                        return nullptr;
-                    }
+                    cv::Mat resizedFrame(params.inputHeight, params.inputWidth, CV_8UC3);
+                    cropAndConvert(raw, width, height, params.inputWidth, params.inputHeight, unionBox, resizedFrame.data, false);
                     cv::Mat normalizedFrame;
                     normalizeFrame(resizedFrame, normalizedFrame);
 
                     return allocateAndCopy(normalizedFrame);
                 }
 
-                std::shared_ptr<uint8_t[]> resizeNormalizeQuantize(uint8_t *raw, int width, int height, NormalizationParams params, BoundingBox *unionBox)
+                std::shared_ptr<uint8_t[]> resizeNormalizeQuantize(uint8_t *raw, int width, int height, const NormalizationParams &params, BoundingBox *unionBox)
                 {
                     if (!raw || width <= 0 || height <= 0 || params.inputWidth <= 0 || params.inputHeight <= 0)
                     {
                         LOG_ERROR("Invalid input dimensions or raw data.");
                         return nullptr;
                     }
-                    cv::Mat rgbFrame = convertYUVToRGB(raw, width, height);
-                    if (rgbFrame.empty())
+                    size_t numBytes = static_cast<size_t>(params.inputWidth) * params.inputHeight * 3;
+                    std::shared_ptr<uint8_t[]> output(new (std::nothrow) uint8_t[numBytes], std::default_delete<uint8_t[]>());
+                    if (!output)
                     {
-                        LOG_ERROR("Failed to convert YUV to RGB.");
+                        LOG_ERROR("Error: Memory allocation failed for output buffer.");
                         return nullptr;
                     }
-                    cv::Mat resizedFrame;
-                    resizeFrame(rgbFrame, resizedFrame, params.inputWidth, params.inputHeight, unionBox);
-                    if (resizedFrame.empty())
+                    if (!resizeNormalizeQuantize(raw, width, height, params, output.get(), numBytes, unionBox))
                     {
-                        LOG_ERROR("Failed to resize the frame.");
                         return nullptr;
                     }
-                    cv::Mat normalizedFrame;
-                    normalizeFrame(resizedFrame, normalizedFrame);
-
-                    cv::Mat quantizedFrame;
-                    quantizeFrame(normalizedFrame, quantizedFrame, params);
-
-                    return allocateAndCopy(quantizedFrame);
+                    return output;
                 }
-                ScalingParams convertAndStore(uint8_t *raw, int width, int height, int newWidth, int newHeight, const std::string &filePath, BoundingBox *unionBox)
+
+                bool resizeNormalizeQuantize(uint8_t *raw, int width, int height, const NormalizationParams &params, uint8_t *output, size_t outputSize, BoundingBox *unionBox)
                 {
-                    ScalingParams params;
-                    if (!raw || width <= 0 || height <= 0 || newWidth <= 0 || newHeight <= 0)
+                    if (!raw || !output || width <= 0 || height <= 0 || params.inputWidth <= 0 || params.inputHeight <= 0)
                     {
                         LOG_ERROR("Invalid input dimensions or raw data.");
-                        return;
+                        return false;
                     }
-                    // cv::Mat rgbFrame = convertYUVToRGB(raw, width, height);
-                    cv::Mat yuv(height + height / 2, width, CV_8UC1, raw);
-                    cv::Mat rgbFrame(height, width, CV_8UC4);
-                    cv::cvtColor(yuv, rgbFrame, cv::COLOR_YUV2BGR_NV12);
-
-                    if (rgbFrame.empty())
+                    size_t numBytes = static_cast<size_t>(params.inputWidth) * params.inputHeight * 3;
+                    if (outputSize < numBytes)
                     {
-                        LOG_ERROR("Failed to convert YUV to RGB.");
-                        return;
-                    }
-                    cv::Mat resizedFrame;
-                    params = resizeFrame(rgbFrame, resizedFrame, newWidth, newHeight, unionBox);
-                    if (resizedFrame.empty())
-                    {
-                        LOG_ERROR("Failed to resize the frame.");
-                        return;
-                    }
-                    std::vector<int> compression_params;
-                    compression_params.push_back(cv::IMWRITE_JPEG_QUALITY);
-                    compression_params.push_back(95); // Adjust the quality as needed
-                    if (!cv::imwrite(filePath, resizedFrame, compression_params))
-                    {
-                        LOG_ERROR("Failed to save image to " << filePath);
+                        LOG_ERROR("Output buffer of " << outputSize << " bytes is too small, " << numBytes << " bytes needed.");
+                        return false;
                     }
-                    else
-                    {
-                        LOG_INFO("Image saved with quality 95 to " << filePath);
-                    }
-                    yuv.release();
-                    resizedFrame.release();
-                    rgbFrame.release();
-                    return params;
+                    cropAndConvert(raw, width, height, params.inputWidth, params.inputHeight, unionBox, output, false);
+                    quantizeFrame(output, numBytes, params);
+                    return true;
                 }
-
             private:
-                cv::Mat convertYUVToRGB(uint8_t *raw, int width, int height)
-                {
-                    cv::Mat yuv(height + height / 2, width, CV_8UC1, raw);
-                    cv::Mat rgb(height, width, CV_8UC3);
-                    cv::cvtColor(yuv, rgb, cv::COLOR_YUV2RGB_NV12);
-                    yuv.release();
-                    return rgb;
-                }
-
-                ScalingParams resizeFrame(cv::Mat &inputFrame, cv::Mat &outputFrame, int newWidth, int newHeight, BoundingBox *unionBox)
+                /**
+                 * Crops the union box region (or the whole frame) out of the NV12 frame and writes it,
+                 * converted and resized to newWidth x newHeight, into output. Only the source rows and
+                 * columns that the crop covers are read.
+                 */
+                ScalingParams cropAndConvert(uint8_t *raw, int width, int height, int newWidth, int newHeight, BoundingBox *unionBox, uint8_t *output, bool bgrOrder)
                 {
-                    try
-                    {
-                        ScalingParams params;
-                        if (unionBox && !unionBox->isEmpty())
-                        {
-                            double scaleFactor = 1.0;
-                            cv::Rect currentBox(unionBox->boundingBoxXOrd, unionBox->boundingBoxYOrd, unionBox->boundingBoxWidth, unionBox->boundingBoxHeight);
-
-                            cv::Size cropSize = CameraFrameHandler::getResizedCropSize(currentBox, newWidth, newHeight, &scaleFactor);
-                            LOG_INFO("Resizing scale for the thumbnail is ");
-                            if (scaleFactor != 1.0)
-                            {
-                                cv::Size rescaleSize(static_cast<int>(inputFrame.cols / scaleFactor), static_cast<int>(inputFrame.rows / scaleFactor));
-                                cv::resize(inputFrame, inputFrame, rescaleSize);
-
-                                // Resize the union blob with scaleFactor
-                                currentBox.width = static_cast<int>(unionBox->boundingBoxWidth / scaleFactor);
-                                currentBox.height = static_cast<int>(unionBox->boundingBoxHeight / scaleFactor);
-                                unionBox.x = static_cast<int>(unionBox->boundingBoxXOrd / scaleFactor);
-                                unionBox.y = static_cast<int>(unionBox->boundingBoxYOrd / scaleFactor);
-                            }
-                            cv::Point2f orgCenter = CameraFrameHandler::getActualCentroid(currentBox);
-                            cv::Point2f alignedCenter = CameraFrameHandler::alignCentroid(orgCenter, inputFrame, cropSize);
-                            cv::getRectSubPix(inputFrame, cropSize, alignedCenter, outputFrame);
-                            CropSize size(cropSize.width, cropSize.height);
-                            Point center(alignedCenter.x, alignedCenter.y);
-                            params.scaleFactor = scaleFactor;
-                            params.size = size;
-                            params.point2f = center;
-                        }
-                        else
-                        {
-                            cv::resize(inputFrame, outputFrame, cv::Size(newWidth, newHeight));
-                        }
-                    }
-                    catch (const cv::Exception &e)
-                    {
-                        LOG_ERROR("OpenCV error: " << e.what());
-                        outputFrame = cv::Mat(); // Return an empty matrix in case of an error
-                    }
-                    catch (const std::exception &e)
-                    {
-                        LOG_ERROR("Standard error: " << e.what());
-                        outputFrame = cv::Mat(); // Return an empty matrix in case of an error
-                    }
-                    catch (...)
-                    {
-                        LOG_ERROR("Unknown error occurred");
-                        outputFrame = cv::Mat(); // Return an empty matrix in case of an error
-                    }
+                    SourceRect sourceRect;
+                    ScalingParams params = CameraFrameHandler::getCropGeometry(width, height, newWidth, newHeight, unionBox, &sourceRect);
+                    // YUV to RGB conversion and resize are one pass here
+                    PERF_SCOPE("crop_convert");
+                    nv12CropResizeToRGB(raw, raw + static_cast<size_t>(width) * height, width, height, sourceRect, output, newWidth, newHeight, bgrOrder);
                     return params;
                 }
 
@@ -242,22 +155,13 @@ namespace camera
                     inputFrame.convertTo(outputFrame, CV_32FC3, 1.0 / 255);
                 }
 
-                void quantizeFrame(cv::Mat &inputFrame, cv::Mat &outputFrame, NormalizationParams params)
+                // Maps uint8 pixels to the quantized model input in place, straight from the per-model table
+                void quantizeFrame(uint8_t *frame, size_t numBytes, const NormalizationParams &params)
                 {
-
-                    outputFrame.create(inputFrame.size(), CV_8UC3);
-                    for (int i = 0; i < inputFrame.rows; ++i)
+                    if (!params.isQuantTableIdentity)
                     {
-                        for (int j = 0; j < inputFrame.cols; ++j)
-                        {
-                            for (int c = 0; c < 3; ++c)
-                            {
-                                float pixel = inputFrame.at<cv::Vec3f>(i, j)[c];
-                                float transformed = pixel * 1.9921875 - 1.0;
-                                uint8_t quantized = static_cast<uint8_t>(std::max(0.0f, std::min(255.0f, static_cast<float>(128.0 + transformed / 0.0078125))));
-                                outputFrame.at<cv::Vec3b>(i, j)[c] = quantized;
-                            }
-                        }
+                        PERF_SCOPE("quantize");
+                        applyLookupTable(frame, numBytes, params.quantTable);
                     }
                 }
 
@@ -320,11 +224,13 @@ namespace camera
             u16 mBufferId;
             std::mutex mResourceMutex;
             std::unique_ptr<FrameConverter> mFrameConverter;
+            std::unique_ptr<ThumbnailEncoder> mThumbnailEncoder;
             std::unique_ptr<FrameReader> mFrameReader;
             static cv::Point2f getActualCentroid(cv::Rect boundRect);
-            static cv::Point2f alignCentroid(cv::Point2f orgCenter, cv::Mat origFrame, cv::Size cropSize);
+            static cv::Point2f alignCentroid(cv::Point2f orgCenter, cv::Size frameSize, cv::Size cropSize);
             static cv::Rect getRelativeBoundingBox(cv::Rect boundRect, cv::Size cropSize, cv::Point2f allignedCenter);
             static cv::Size getResizedCropSize(cv::Rect boundRect, int w, int h, double *resizeScale);
+            static ScalingParams getCropGeometry(int width, int height, int newWidth, int newHeight, const BoundingBox *unionBox, SourceRect *sourceRect);
         };
     }
 }
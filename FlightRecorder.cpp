@@ -0,0 +1,171 @@
+#include "FlightRecorder.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            const char *kEventNames[FLIGHT_EVENT_TYPES] = {"METADATA_ACCEPTED", "METADATA_DISCARDED", "METADATA_MISSED", "FRAME_CACHED",
+                                                           "PREDICTION", "CLIP_START", "CLIP_END"};
+
+            uint64_t ticksPerSecond()
+            {
+#if defined(__aarch64__)
+                uint64_t frequency;
+                asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+                return frequency;
+#else
+                return 1000000000ULL;
+#endif
+            }
+
+            std::string discardReasons(int reasons)
+            {
+                std::string text;
+                if (reasons & FLIGHT_DISCARD_NOT_CAPTURING)
+                {
+                    text += " not-capturing";
+                }
+                if (reasons & FLIGHT_DISCARD_MOTION_FILTERED)
+                {
+                    text += " motion-filtered";
+                }
+                if (reasons & FLIGHT_DISCARD_SMALLER_BOX)
+                {
+                    text += " smaller-box";
+                }
+                return text;
+            }
+        }
+
+        std::atomic<bool> FlightRecorder::sDumpRequested(false);
+
+        FlightRecorder &FlightRecorder::instance()
+        {
+            static FlightRecorder recorder;
+            return recorder;
+        }
+
+        FlightRecorder::FlightRecorder() : mHead(0)
+        {
+            for (Slot &slot : mSlots)
+            {
+                for (auto &word : slot.words)
+                {
+                    word.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        void FlightRecorder::record(FLIGHT_EVENT_TYPE type, int64_t pts, int32_t arg, float value, const char *text)
+        {
+            FlightEvent event = {};
+            event.ticks = ticksNow();
+            event.pts = pts;
+            event.type = static_cast<uint16_t>(type);
+            event.arg = arg;
+            event.value = value;
+            if (text)
+            {
+                std::strncpy(event.text, text, sizeof(event.text) - 1);
+            }
+            uint64_t words[WORDS];
+            std::memcpy(words, &event, sizeof(event));
+
+            uint64_t ticket = mHead.fetch_add(1, std::memory_order_relaxed);
+            Slot &slot = mSlots[ticket & (FLIGHT_RECORDER_EVENTS - 1)];
+            slot.sequence.store(2 * ticket + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < WORDS; ++i)
+            {
+                slot.words[i].store(words[i], std::memory_order_relaxed);
+            }
+            slot.sequence.store(2 * ticket + 2, std::memory_order_release);
+        }
+
+        bool FlightRecorder::read(uint64_t ticket, FlightEvent *event) const
+        {
+            const Slot &slot = mSlots[ticket & (FLIGHT_RECORDER_EVENTS - 1)];
+            uint64_t expected = 2 * ticket + 2;
+            if (slot.sequence.load(std::memory_order_acquire) != expected)
+            {
+                return false; // Still being written, or already overwritten by a newer event
+            }
+            uint64_t words[WORDS];
+            for (size_t i = 0; i < WORDS; ++i)
+            {
+                words[i] = slot.words[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.sequence.load(std::memory_order_relaxed) != expected)
+            {
+                return false;
+            }
+            std::memcpy(event, words, sizeof(*event));
+            return true;
+        }
+
+        /**
+         * Written to a temporary file and renamed, so a reader never sees half a dump. Times are
+         * printed on the wall clock, converted from the ticks at the time of the dump.
+         */
+        int FlightRecorder::dump(const std::string &path)
+        {
+            std::string tmpPath = path + ".tmp";
+            FILE *file = std::fopen(tmpPath.c_str(), "w");
+            if (!file)
+            {
+                LOG_ERROR("Failed to open " << tmpPath << ": " << strerror(errno));
+                return -1;
+            }
+            struct timespec wallNow;
+            clock_gettime(CLOCK_REALTIME, &wallNow);
+            uint64_t ticksAtDump = ticksNow();
+            double nsPerTick = 1e9 / static_cast<double>(ticksPerSecond());
+            int64_t wallNowNs = static_cast<int64_t>(wallNow.tv_sec) * 1000000000LL + wallNow.tv_nsec;
+            uint64_t head = mHead.load(std::memory_order_acquire);
+            uint64_t first = head > FLIGHT_RECORDER_EVENTS ? head - FLIGHT_RECORDER_EVENTS : 0;
+            size_t written = 0;
+            size_t skipped = 0;
+            std::fprintf(file, "# %llu events recorded, showing up to the last %zu\n", static_cast<unsigned long long>(head), FLIGHT_RECORDER_EVENTS);
+            for (uint64_t ticket = first; ticket < head; ++ticket)
+            {
+                FlightEvent event;
+                if (!read(ticket, &event) || event.type >= FLIGHT_EVENT_TYPES)
+                {
+                    skipped++;
+                    continue;
+                }
+                // Events recorded after the sample above are a few ticks ahead of it
+                int64_t ageTicks = static_cast<int64_t>(ticksAtDump - event.ticks);
+                int64_t wallNs = wallNowNs - static_cast<int64_t>(static_cast<double>(ageTicks) * nsPerTick);
+                time_t seconds = static_cast<time_t>(wallNs / 1000000000LL);
+                struct tm utc;
+                gmtime_r(&seconds, &utc);
+                char date[32];
+                std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &utc);
+                event.text[FLIGHT_TEXT_BYTES - 1] = '\0';
+                std::string detail = (event.type == FLIGHT_METADATA_DISCARDED) ? discardReasons(event.arg) : "";
+                std::fprintf(file, "%s.%06lld %-18s pts=%lld arg=%d value=%.3f %s%s\n", date, static_cast<long long>((wallNs / 1000) % 1000000),
+                             kEventNames[event.type], static_cast<long long>(event.pts), event.arg, event.value, event.text, detail.c_str());
+                written++;
+            }
+            bool ok = std::fflush(file) == 0;
+            ok = (std::fclose(file) == 0) && ok;
+            if (!ok || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+            {
+                LOG_ERROR("Failed to write " << path << ": " << strerror(errno));
+                std::remove(tmpPath.c_str());
+                return -1;
+            }
+            LOG_INFO("Flight recorder: " << written << " events dumped to " << path << ", " << skipped << " skipped while being written");
+            return 0;
+        }
+    }
+}
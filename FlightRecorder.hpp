@@ -0,0 +1,115 @@
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+#include <string>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        // Events kept, the oldest is overwritten; must be a power of two
+        constexpr size_t FLIGHT_RECORDER_EVENTS = 4096;
+        constexpr size_t FLIGHT_TEXT_BYTES = 20;
+        constexpr const char *FLIGHT_RECORDER_DUMP_PATH = "/opt/surveillance_flight.txt";
+
+        typedef enum
+        {
+            FLIGHT_METADATA_ACCEPTED,  // arg: 1 if it qualified for the thumbnail, value: union box area
+            FLIGHT_METADATA_DISCARDED, // arg: FLIGHT_DISCARD_* bits, value: union box area
+            FLIGHT_METADATA_MISSED,    // Qualified, but its frame was not captured
+            FLIGHT_FRAME_CACHED,       // arg: FLIGHT_CACHE_*
+            FLIGHT_PREDICTION,         // arg: ObjectType, value: confidence, text: "accepted" or "rejected"
+            FLIGHT_CLIP_START,         // text: clip name
+            FLIGHT_CLIP_END,           // text: clip name, arg: 1 if a thumbnail was handed over
+            FLIGHT_EVENT_TYPES
+        } FLIGHT_EVENT_TYPE;
+
+        // Why metadata did not qualify for the thumbnail
+        constexpr int FLIGHT_DISCARD_NOT_CAPTURING = 0x01; // No clip in progress
+        constexpr int FLIGHT_DISCARD_MOTION_FILTERED = 0x02; // Event type or ROI/DOI flags
+        constexpr int FLIGHT_DISCARD_SMALLER_BOX = 0x04; // Union box not larger than the cached one
+
+        constexpr int FLIGHT_CACHE_THUMBNAIL = 0;
+        constexpr int FLIGHT_CACHE_CLASSIFICATION = 1;
+
+        /**
+         * @struct FlightEvent
+         * @brief One recorded pipeline event.
+         */
+        struct FlightEvent
+        {
+            uint64_t ticks; // FlightRecorder::ticksNow()
+            int64_t pts;    // Frame PTS, -1 if none
+            uint16_t type;  // FLIGHT_EVENT_TYPE
+            uint16_t reserved;
+            int32_t arg;
+            float value;
+            char text[FLIGHT_TEXT_BYTES];
+        };
+
+        /**
+         * @brief Fixed-size record of the latest pipeline events, kept in memory and dumped on demand.
+         *
+         * record() claims a slot with one atomic increment and publishes the event under a per slot
+         * sequence number; it never blocks or allocates, so any thread can record on the hot path.
+         * dump() copies out the events that are complete and skips a slot that is being rewritten.
+         */
+        class FlightRecorder
+        {
+        public:
+            static FlightRecorder &instance();
+            // The generic timer counter on aarch64, a single register read; CLOCK_MONOTONIC in ns elsewhere
+            static uint64_t ticksNow()
+            {
+#if defined(__aarch64__)
+                uint64_t ticks;
+                asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+                return ticks;
+#else
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + static_cast<uint64_t>(now.tv_nsec);
+#endif
+            }
+
+            void record(FLIGHT_EVENT_TYPE type, int64_t pts = -1, int32_t arg = 0, float value = 0.0f, const char *text = nullptr);
+            // Writes the recorded events, oldest first, as text; returns 0 on success, -1 on failure
+            int dump(const std::string &path = FLIGHT_RECORDER_DUMP_PATH);
+            // Asks the main loop for a dump; a lock-free store, safe from a signal handler or a bus callback
+            static void requestDump()
+            {
+                sDumpRequested.store(true, std::memory_order_relaxed);
+            }
+            // Clears a pending request and returns whether there was one
+            static bool takeDumpRequest()
+            {
+                return sDumpRequested.exchange(false, std::memory_order_relaxed);
+            }
+
+        private:
+            static constexpr size_t WORDS = sizeof(FlightEvent) / sizeof(uint64_t);
+            static_assert(sizeof(FlightEvent) % sizeof(uint64_t) == 0, "FlightEvent is stored as whole words");
+
+            struct alignas(64) Slot
+            {
+                // 2 * ticket + 1 while being written, 2 * ticket + 2 once complete
+                std::atomic<uint64_t> sequence{0};
+                std::atomic<uint64_t> words[WORDS];
+            };
+
+            FlightRecorder();
+            bool read(uint64_t ticket, FlightEvent *event) const;
+
+            static std::atomic<bool> sDumpRequested;
+            static_assert(std::atomic<bool>::is_always_lock_free, "requestDump() is called from a signal handler");
+
+            std::atomic<uint64_t> mHead;
+            Slot mSlots[FLIGHT_RECORDER_EVENTS];
+        };
+    }
+}
+#endif // FLIGHT_RECORDER_HPP
@@ -0,0 +1,104 @@
+#ifndef FRAME_HISTORY_HPP
+#define FRAME_HISTORY_HPP
+
+#include <cstdint>
+#include <mutex>
+#include "FramePool.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        /**
+         * @brief Ring of the most recently captured frames, looked up by PTS.
+         *
+         * Frames are pool slots (exact NV12 size) held by reference, so a hit hands the frame on
+         * without copying it. Entries are evicted in capture order. The PTS index is a small direct
+         * mapped table, so lookups are O(1); the rare entry whose bucket is taken by a newer PTS is
+         * reported as a miss.
+         */
+        template <size_t Capacity>
+        class FrameHistory
+        {
+        public:
+            FrameHistory() : mNext(0)
+            {
+                for (size_t i = 0; i < IndexSize; ++i)
+                {
+                    mIndex[i] = -1;
+                }
+            }
+
+            /**
+             * @brief Adds a captured frame, evicting the oldest one when the ring is full.
+             */
+            void add(int64_t pts, const FrameRef &frame)
+            {
+                std::lock_guard<std::mutex> lock(mHistoryMutex);
+                Entry &entry = mEntries[mNext];
+                if (entry.frame)
+                {
+                    size_t oldBucket = bucket(entry.pts);
+                    if (mIndex[oldBucket] == static_cast<int>(mNext))
+                    {
+                        mIndex[oldBucket] = -1;
+                    }
+                }
+                entry.pts = pts;
+                entry.frame = frame;
+                mIndex[bucket(pts)] = static_cast<int>(mNext);
+                mNext = (mNext + 1) % Capacity;
+            }
+
+            /**
+             * @brief Returns the frame captured at @p pts, or an empty handle if it was evicted or never captured.
+             */
+            FrameRef find(int64_t pts)
+            {
+                std::lock_guard<std::mutex> lock(mHistoryMutex);
+                int slot = mIndex[bucket(pts)];
+                if (slot >= 0 && mEntries[slot].frame && mEntries[slot].pts == pts)
+                {
+                    return mEntries[slot].frame;
+                }
+                return FrameRef();
+            }
+
+            // Drops every frame, the slots go back to the pool
+            void clear()
+            {
+                std::lock_guard<std::mutex> lock(mHistoryMutex);
+                for (size_t i = 0; i < Capacity; ++i)
+                {
+                    mEntries[i].frame.reset();
+                }
+                for (size_t i = 0; i < IndexSize; ++i)
+                {
+                    mIndex[i] = -1;
+                }
+            }
+
+        private:
+            static constexpr size_t IndexSize = 4 * Capacity;
+
+            struct Entry
+            {
+                int64_t pts = 0;
+                FrameRef frame;
+            };
+
+            static size_t bucket(int64_t pts)
+            {
+                // PTS steps are a multiple of the frame interval, mix the bits before taking the modulo
+                uint64_t hash = static_cast<uint64_t>(pts) * 0x9E3779B97F4A7C15ULL;
+                return static_cast<size_t>(hash >> 32) % IndexSize;
+            }
+
+            Entry mEntries[Capacity];
+            int mIndex[IndexSize];
+            size_t mNext;
+            std::mutex mHistoryMutex;
+        };
+    }
+}
+#endif // FRAME_HISTORY_HPP
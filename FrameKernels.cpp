@@ -0,0 +1,316 @@
+#include "FrameKernels.hpp"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FRAME_KERNELS_NEON 1
+#endif
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            // BT.601 limited range YUV -> RGB coefficients in Q13 (fit in int16 for NEON multiplies)
+            constexpr int kCoefY = 9539;    // 1.164
+            constexpr int kCoefVR = 13075;  // 1.596
+            constexpr int kCoefVG = -6660;  // -0.813
+            constexpr int kCoefUG = -3209;  // -0.392
+            constexpr int kCoefUB = 16525;  // 2.017
+            constexpr int kShift = 13;
+
+            struct Tap
+            {
+                int32_t i0;
+                int32_t i1;
+                int32_t w; // weight of i1 in 1/256 units
+            };
+
+            /**
+             * Builds the bilinear taps of one axis. @p scale maps output pixels to luma pixels,
+             * @p subsample is 1 for luma and 2 for the half resolution chroma plane.
+             */
+            void computeTaps(float start, float scale, int count, int limit, int subsample, Tap *taps)
+            {
+                for (int d = 0; d < count; ++d)
+                {
+                    float pos = (start + (d + 0.5f) * scale) / subsample - 0.5f;
+                    int i = static_cast<int>(std::floor(pos));
+                    int w = static_cast<int>(std::lround((pos - i) * 256.0f));
+                    if (w >= 256)
+                    {
+                        ++i;
+                        w = 0;
+                    }
+                    taps[d].i0 = std::clamp(i, 0, limit - 1);
+                    taps[d].i1 = std::clamp(i + 1, 0, limit - 1);
+                    taps[d].w = w;
+                }
+            }
+
+            inline uint8_t bilinear(uint32_t a, uint32_t b, uint32_t c, uint32_t d, uint32_t wx, uint32_t wy)
+            {
+                uint32_t top = a * (256 - wx) + b * wx;
+                uint32_t bottom = c * (256 - wx) + d * wx;
+                return static_cast<uint8_t>((top * (256 - wy) + bottom * wy + 32768) >> 16);
+            }
+
+            inline uint8_t clampToByte(int value)
+            {
+                return static_cast<uint8_t>(std::clamp(value, 0, 255));
+            }
+
+            void yuvRowToRGB(const uint8_t *yRow, const uint8_t *uRow, const uint8_t *vRow, uint8_t *dst, int count, bool bgrOrder)
+            {
+                int i = 0;
+#ifdef FRAME_KERNELS_NEON
+                const int16x8_t k16 = vdupq_n_s16(16);
+                const int16x8_t k128 = vdupq_n_s16(128);
+                const int16x8_t kZero = vdupq_n_s16(0);
+                for (; i + 8 <= count; i += 8)
+                {
+                    int16x8_t y = vmaxq_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(yRow + i))), k16), kZero);
+                    int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(uRow + i))), k128);
+                    int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(vRow + i))), k128);
+
+                    int32x4_t yLo = vmull_n_s16(vget_low_s16(y), kCoefY);
+                    int32x4_t yHi = vmull_n_s16(vget_high_s16(y), kCoefY);
+
+                    int32x4_t rLo = vmlal_n_s16(yLo, vget_low_s16(v), kCoefVR);
+                    int32x4_t rHi = vmlal_n_s16(yHi, vget_high_s16(v), kCoefVR);
+                    int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(yLo, vget_low_s16(v), kCoefVG), vget_low_s16(u), kCoefUG);
+                    int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(yHi, vget_high_s16(v), kCoefVG), vget_high_s16(u), kCoefUG);
+                    int32x4_t bLo = vmlal_n_s16(yLo, vget_low_s16(u), kCoefUB);
+                    int32x4_t bHi = vmlal_n_s16(yHi, vget_high_s16(u), kCoefUB);
+
+                    uint8x8_t r = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(rLo, kShift), vqrshrun_n_s32(rHi, kShift)));
+                    uint8x8_t g = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(gLo, kShift), vqrshrun_n_s32(gHi, kShift)));
+                    uint8x8_t b = vqmovn_u16(vcombine_u16(vqrshrun_n_s32(bLo, kShift), vqrshrun_n_s32(bHi, kShift)));
+
+                    uint8x8x3_t pixels;
+                    pixels.val[0] = bgrOrder ? b : r;
+                    pixels.val[1] = g;
+                    pixels.val[2] = bgrOrder ? r : b;
+                    vst3_u8(dst + 3 * i, pixels);
+                }
+#endif
+                const int rIdx = bgrOrder ? 2 : 0;
+                const int bIdx = bgrOrder ? 0 : 2;
+                const int round = 1 << (kShift - 1);
+                for (; i < count; ++i)
+                {
+                    int y = std::max(0, yRow[i] - 16) * kCoefY;
+                    int u = uRow[i] - 128;
+                    int v = vRow[i] - 128;
+                    uint8_t *px = dst + 3 * i;
+                    px[rIdx] = clampToByte((y + kCoefVR * v + round) >> kShift);
+                    px[1] = clampToByte((y + kCoefVG * v + kCoefUG * u + round) >> kShift);
+                    px[bIdx] = clampToByte((y + kCoefUB * u + round) >> kShift);
+                }
+            }
+        }
+
+        void nv12CropResizeToRGB(const uint8_t *yPlane, const uint8_t *uvPlane, int width, int height, const SourceRect &src,
+                                 uint8_t *dst, int dstWidth, int dstHeight, bool bgrOrder)
+        {
+            // Scratch space is kept per thread so steady-state calls do not allocate.
+            thread_local std::vector<Tap> xTaps, cxTaps, yTaps, cyTaps;
+            thread_local std::vector<uint8_t> rowScratch;
+            xTaps.resize(dstWidth);
+            cxTaps.resize(dstWidth);
+            yTaps.resize(dstHeight);
+            cyTaps.resize(dstHeight);
+            rowScratch.resize(static_cast<size_t>(dstWidth) * 3);
+
+            const float scaleX = src.width / dstWidth;
+            const float scaleY = src.height / dstHeight;
+            const int chromaWidth = width / 2;
+            const int chromaHeight = height / 2;
+            computeTaps(src.x, scaleX, dstWidth, width, 1, xTaps.data());
+            computeTaps(src.x, scaleX, dstWidth, chromaWidth, 2, cxTaps.data());
+            computeTaps(src.y, scaleY, dstHeight, height, 1, yTaps.data());
+            computeTaps(src.y, scaleY, dstHeight, chromaHeight, 2, cyTaps.data());
+
+            uint8_t *yRow = rowScratch.data();
+            uint8_t *uRow = yRow + dstWidth;
+            uint8_t *vRow = uRow + dstWidth;
+            for (int dy = 0; dy < dstHeight; ++dy)
+            {
+                const Tap &ty = yTaps[dy];
+                const Tap &tc = cyTaps[dy];
+                const uint8_t *y0 = yPlane + static_cast<size_t>(ty.i0) * width;
+                const uint8_t *y1 = yPlane + static_cast<size_t>(ty.i1) * width;
+                const uint8_t *c0 = uvPlane + static_cast<size_t>(tc.i0) * width;
+                const uint8_t *c1 = uvPlane + static_cast<size_t>(tc.i1) * width;
+                for (int dx = 0; dx < dstWidth; ++dx)
+                {
+                    const Tap &tx = xTaps[dx];
+                    yRow[dx] = bilinear(y0[tx.i0], y0[tx.i1], y1[tx.i0], y1[tx.i1], tx.w, ty.w);
+                    const Tap &cx = cxTaps[dx];
+                    const int u0 = 2 * cx.i0;
+                    const int u1 = 2 * cx.i1;
+                    uRow[dx] = bilinear(c0[u0], c0[u1], c1[u0], c1[u1], cx.w, tc.w);
+                    vRow[dx] = bilinear(c0[u0 + 1], c0[u1 + 1], c1[u0 + 1], c1[u1 + 1], cx.w, tc.w);
+                }
+                yuvRowToRGB(yRow, uRow, vRow, dst + static_cast<size_t>(dy) * dstWidth * 3, dstWidth, bgrOrder);
+            }
+        }
+
+        void nv12CropResizeToI420(const uint8_t *yPlane, const uint8_t *uvPlane, int width, int height, const SourceRect &src,
+                                  uint8_t *dstY, uint8_t *dstU, uint8_t *dstV, int dstWidth, int dstHeight, bool fullRange)
+        {
+            // Limited -> full range, built once: Y' = (Y - 16) * 255 / 219, C' = (C - 128) * 255 / 224 + 128
+            struct RangeTables
+            {
+                uint8_t luma[256];
+                uint8_t chroma[256];
+                RangeTables()
+                {
+                    for (int i = 0; i < 256; ++i)
+                    {
+                        luma[i] = clampToByte(static_cast<int>(std::lround((i - 16) * 255.0 / 219.0)));
+                        chroma[i] = clampToByte(static_cast<int>(std::lround((i - 128) * 255.0 / 224.0)) + 128);
+                    }
+                }
+            };
+            static const RangeTables rangeTables;
+
+            const int chromaDstWidth = (dstWidth + 1) / 2;
+            const int chromaDstHeight = (dstHeight + 1) / 2;
+            thread_local std::vector<Tap> xTaps, cxTaps, yTaps, cyTaps;
+            xTaps.resize(dstWidth);
+            cxTaps.resize(chromaDstWidth);
+            yTaps.resize(dstHeight);
+            cyTaps.resize(chromaDstHeight);
+
+            const float scaleX = src.width / dstWidth;
+            const float scaleY = src.height / dstHeight;
+            computeTaps(src.x, scaleX, dstWidth, width, 1, xTaps.data());
+            computeTaps(src.x, 2.0f * scaleX, chromaDstWidth, width / 2, 2, cxTaps.data());
+            computeTaps(src.y, scaleY, dstHeight, height, 1, yTaps.data());
+            computeTaps(src.y, 2.0f * scaleY, chromaDstHeight, height / 2, 2, cyTaps.data());
+
+            for (int dy = 0; dy < dstHeight; ++dy)
+            {
+                const Tap &ty = yTaps[dy];
+                const uint8_t *y0 = yPlane + static_cast<size_t>(ty.i0) * width;
+                const uint8_t *y1 = yPlane + static_cast<size_t>(ty.i1) * width;
+                uint8_t *yRow = dstY + static_cast<size_t>(dy) * dstWidth;
+                for (int dx = 0; dx < dstWidth; ++dx)
+                {
+                    const Tap &tx = xTaps[dx];
+                    yRow[dx] = bilinear(y0[tx.i0], y0[tx.i1], y1[tx.i0], y1[tx.i1], tx.w, ty.w);
+                }
+            }
+            for (int dy = 0; dy < chromaDstHeight; ++dy)
+            {
+                const Tap &tc = cyTaps[dy];
+                const uint8_t *c0 = uvPlane + static_cast<size_t>(tc.i0) * width;
+                const uint8_t *c1 = uvPlane + static_cast<size_t>(tc.i1) * width;
+                uint8_t *uRow = dstU + static_cast<size_t>(dy) * chromaDstWidth;
+                uint8_t *vRow = dstV + static_cast<size_t>(dy) * chromaDstWidth;
+                for (int dx = 0; dx < chromaDstWidth; ++dx)
+                {
+                    const Tap &cx = cxTaps[dx];
+                    const int u0 = 2 * cx.i0;
+                    const int u1 = 2 * cx.i1;
+                    uRow[dx] = bilinear(c0[u0], c0[u1], c1[u0], c1[u1], cx.w, tc.w);
+                    vRow[dx] = bilinear(c0[u0 + 1], c0[u1 + 1], c1[u0 + 1], c1[u1 + 1], cx.w, tc.w);
+                }
+            }
+            if (fullRange)
+            {
+                const size_t chromaSize = static_cast<size_t>(chromaDstWidth) * chromaDstHeight;
+                applyLookupTable(dstY, static_cast<size_t>(dstWidth) * dstHeight, rangeTables.luma);
+                applyLookupTable(dstU, chromaSize, rangeTables.chroma);
+                applyLookupTable(dstV, chromaSize, rangeTables.chroma);
+            }
+        }
+
+        void computeLumaSignature(const uint8_t *yPlane, int width, int height, const SourceRect &src, uint8_t signature[LUMA_SIGNATURE_CELLS])
+        {
+            constexpr int kSamples = 8;
+            const float x0 = std::clamp(src.x, 0.0f, static_cast<float>(width - 1));
+            const float y0 = std::clamp(src.y, 0.0f, static_cast<float>(height - 1));
+            const float cellW = (std::clamp(src.x + src.width, x0 + 1.0f, static_cast<float>(width)) - x0) / LUMA_SIGNATURE_GRID;
+            const float cellH = (std::clamp(src.y + src.height, y0 + 1.0f, static_cast<float>(height)) - y0) / LUMA_SIGNATURE_GRID;
+            for (int cy = 0; cy < LUMA_SIGNATURE_GRID; ++cy)
+            {
+                for (int cx = 0; cx < LUMA_SIGNATURE_GRID; ++cx)
+                {
+                    uint32_t sum = 0;
+                    for (int sy = 0; sy < kSamples; ++sy)
+                    {
+                        int y = std::min(height - 1, static_cast<int>(y0 + (cy + (sy + 0.5f) / kSamples) * cellH));
+                        const uint8_t *row = yPlane + static_cast<size_t>(y) * width;
+                        for (int sx = 0; sx < kSamples; ++sx)
+                        {
+                            int x = std::min(width - 1, static_cast<int>(x0 + (cx + (sx + 0.5f) / kSamples) * cellW));
+                            sum += row[x];
+                        }
+                    }
+                    signature[cy * LUMA_SIGNATURE_GRID + cx] = static_cast<uint8_t>((sum + kSamples * kSamples / 2) / (kSamples * kSamples));
+                }
+            }
+        }
+
+        int lumaSignatureDistance(const uint8_t a[LUMA_SIGNATURE_CELLS], const uint8_t b[LUMA_SIGNATURE_CELLS])
+        {
+            int distance = 0;
+            for (int i = 0; i < LUMA_SIGNATURE_CELLS; ++i)
+            {
+                distance = std::max(distance, std::abs(a[i] - b[i]));
+            }
+            return distance;
+        }
+
+        bool buildQuantizationTable(float scale, int zeroPoint, float lBound, float uBound, uint8_t table[256])
+        {
+            bool identity = true;
+            for (int p = 0; p < 256; ++p)
+            {
+                float normalized = p / 255.0f;
+                float real = lBound + normalized * (uBound - lBound);
+                long quantized = (scale > 0.0f) ? std::lround(real / scale) + zeroPoint : p;
+                table[p] = static_cast<uint8_t>(std::clamp<long>(quantized, 0, 255));
+                identity = identity && (table[p] == p);
+            }
+            return identity;
+        }
+
+        void applyLookupTable(uint8_t *data, size_t count, const uint8_t table[256])
+        {
+            size_t i = 0;
+#if defined(FRAME_KERNELS_NEON) && defined(__aarch64__)
+            uint8x16x4_t t0, t1, t2, t3;
+            for (int k = 0; k < 4; ++k)
+            {
+                t0.val[k] = vld1q_u8(table + 16 * k);
+                t1.val[k] = vld1q_u8(table + 64 + 16 * k);
+                t2.val[k] = vld1q_u8(table + 128 + 16 * k);
+                t3.val[k] = vld1q_u8(table + 192 + 16 * k);
+            }
+            const uint8x16_t k64 = vdupq_n_u8(64);
+            for (; i + 16 <= count; i += 16)
+            {
+                // Out of range indices return 0 for TBL and leave the lane untouched for TBX.
+                uint8x16_t idx = vld1q_u8(data + i);
+                uint8x16_t out = vqtbl4q_u8(t0, idx);
+                idx = vsubq_u8(idx, k64);
+                out = vqtbx4q_u8(out, t1, idx);
+                idx = vsubq_u8(idx, k64);
+                out = vqtbx4q_u8(out, t2, idx);
+                idx = vsubq_u8(idx, k64);
+                out = vqtbx4q_u8(out, t3, idx);
+                vst1q_u8(data + i, out);
+            }
+#endif
+            for (; i < count; ++i)
+            {
+                data[i] = table[data[i]];
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef FRAME_KERNELS_HPP
+#define FRAME_KERNELS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        /**
+         * @struct SourceRect
+         * @brief Region of the source frame, in source pixels, that is mapped onto the output image.
+         *
+         * The rectangle may extend past the frame borders; border pixels are replicated in that case,
+         * the same way cv::getRectSubPix does.
+         */
+        struct SourceRect
+        {
+            float x;
+            float y;
+            float width;
+            float height;
+        };
+
+        /**
+         * @brief Converts and resamples a region of an NV12 frame straight into packed RGB (or BGR).
+         *
+         * Only the Y and UV rows covered by @p src are read. Luma and chroma are sampled bilinearly with
+         * 8-bit fixed point weights and converted with BT.601 limited range coefficients in Q13. The
+         * colour conversion is vectorised with NEON when available.
+         *
+         * @param yPlane Pointer to the Y plane (stride == width).
+         * @param uvPlane Pointer to the interleaved UV plane (stride == width).
+         * @param width Width of the source frame.
+         * @param height Height of the source frame.
+         * @param src Region of the source frame to sample.
+         * @param dst Output buffer of dstWidth * dstHeight * 3 bytes.
+         * @param dstWidth Width of the output image.
+         * @param dstHeight Height of the output image.
+         * @param bgrOrder Writes BGR instead of RGB when true.
+         */
+        void nv12CropResizeToRGB(const uint8_t *yPlane, const uint8_t *uvPlane, int width, int height, const SourceRect &src,
+                                 uint8_t *dst, int dstWidth, int dstHeight, bool bgrOrder);
+
+        /**
+         * @brief Resamples a region of an NV12 frame into planar YUV 4:2:0 (I420), ready for a JPEG encoder.
+         *
+         * Uses the same bilinear sampling as nv12CropResizeToRGB. The chroma planes are
+         * ceil(dstWidth / 2) x ceil(dstHeight / 2) and sampled at the centre of each 2x2 luma block.
+         * When @p fullRange is set the BT.601 limited range samples are expanded to the full range
+         * YCbCr that JFIF decoders assume, so the colours match the RGB path.
+         *
+         * @param dstY Output luma plane, dstWidth * dstHeight bytes.
+         * @param dstU Output Cb plane.
+         * @param dstV Output Cr plane.
+         */
+        void nv12CropResizeToI420(const uint8_t *yPlane, const uint8_t *uvPlane, int width, int height, const SourceRect &src,
+                                  uint8_t *dstY, uint8_t *dstU, uint8_t *dstV, int dstWidth, int dstHeight, bool fullRange);
+
+        constexpr int LUMA_SIGNATURE_GRID = 8;
+        constexpr int LUMA_SIGNATURE_CELLS = LUMA_SIGNATURE_GRID * LUMA_SIGNATURE_GRID;
+
+        /**
+         * @brief Computes a cheap content signature of a frame region: the mean luma of each cell of
+         *        an 8x8 grid laid over @p src, estimated from at most 8x8 samples per cell.
+         */
+        void computeLumaSignature(const uint8_t *yPlane, int width, int height, const SourceRect &src, uint8_t signature[LUMA_SIGNATURE_CELLS]);
+
+        /**
+         * @brief Returns the largest per-cell difference between two luma signatures.
+         */
+        int lumaSignatureDistance(const uint8_t a[LUMA_SIGNATURE_CELLS], const uint8_t b[LUMA_SIGNATURE_CELLS]);
+
+        /**
+         * @brief Builds the uint8 -> quantized uint8 mapping of a model input.
+         *
+         * A pixel p is normalized to p / 255, stretched to the model's real input range [lBound, uBound]
+         * and quantized with (scale, zeroPoint). Since the input is uint8, the whole transform fits in
+         * a 256-entry table.
+         *
+         * @return true if the table is the identity, in which case it does not need to be applied.
+         */
+        bool buildQuantizationTable(float scale, int zeroPoint, float lBound, float uBound, uint8_t table[256]);
+
+        /**
+         * @brief Replaces every byte of @p data with table[byte], in place (NEON TBL on aarch64).
+         */
+        void applyLookupTable(uint8_t *data, size_t count, const uint8_t table[256]);
+    }
+}
+#endif // FRAME_KERNELS_HPP
@@ -0,0 +1,224 @@
+#ifndef FRAME_POOL_HPP
+#define FRAME_POOL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Logger.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        class FramePool;
+
+        /**
+         * @brief A single preallocated NV12 frame slot owned by a FramePool.
+         *
+         * Slots are never freed while the pool is alive. A slot holds one captured frame
+         * and is shared by reference between the thumbnail and classification caches.
+         */
+        struct FrameSnapshot
+        {
+            uint8_t *data;
+            size_t capacity;
+            size_t size;
+            int width;
+            int height;
+            int64_t pts; // PTS of the frame held, -1 until known
+            std::atomic<int> refCount;
+            FramePool *owner;
+
+            FrameSnapshot() : data(nullptr), capacity(0), size(0), width(0), height(0), pts(-1), refCount(0), owner(nullptr) {}
+            ~FrameSnapshot()
+            {
+                free(data);
+            }
+            FrameSnapshot(const FrameSnapshot &) = delete;
+            FrameSnapshot &operator=(const FrameSnapshot &) = delete;
+
+            uint8_t *yPlane() const
+            {
+                return data;
+            }
+            uint8_t *uvPlane() const
+            {
+                return data + static_cast<size_t>(width) * height;
+            }
+        };
+
+        /**
+         * @brief Reference counted handle to a FrameSnapshot.
+         *
+         * Copying the handle shares the snapshot, dropping the last handle returns the
+         * slot to its pool. No allocation, copy or memset of frame data takes place.
+         */
+        class FrameRef
+        {
+        public:
+            FrameRef() : mSnapshot(nullptr) {}
+            FrameRef(const FrameRef &other) : mSnapshot(other.mSnapshot)
+            {
+                retain();
+            }
+            FrameRef(FrameRef &&other) noexcept : mSnapshot(other.mSnapshot)
+            {
+                other.mSnapshot = nullptr;
+            }
+            FrameRef &operator=(const FrameRef &other)
+            {
+                if (mSnapshot != other.mSnapshot)
+                {
+                    release();
+                    mSnapshot = other.mSnapshot;
+                    retain();
+                }
+                return *this;
+            }
+            FrameRef &operator=(FrameRef &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    release();
+                    mSnapshot = other.mSnapshot;
+                    other.mSnapshot = nullptr;
+                }
+                return *this;
+            }
+            ~FrameRef()
+            {
+                release();
+            }
+
+            void reset()
+            {
+                release();
+                mSnapshot = nullptr;
+            }
+            explicit operator bool() const
+            {
+                return mSnapshot != nullptr;
+            }
+            FrameSnapshot *operator->() const
+            {
+                return mSnapshot;
+            }
+            FrameSnapshot *get() const
+            {
+                return mSnapshot;
+            }
+
+        private:
+            friend class FramePool;
+            explicit FrameRef(FrameSnapshot *snapshot) : mSnapshot(snapshot) {}
+            void retain()
+            {
+                if (mSnapshot)
+                {
+                    mSnapshot->refCount.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            inline void release();
+
+            FrameSnapshot *mSnapshot;
+        };
+
+        /**
+         * @brief Fixed-size pool of NV12 frame slots.
+         *
+         * Slots are allocated once, the first time a frame of a given size is seen, and then
+         * recycled. acquire() only pops a free slot; it does not realloc or clear memory on
+         * the steady-state path.
+         */
+        class FramePool
+        {
+        public:
+            explicit FramePool(size_t slotCount) : mSlots(new FrameSnapshot[slotCount]), mSlotCount(slotCount)
+            {
+                mFreeSlots.reserve(slotCount);
+                for (size_t i = 0; i < slotCount; ++i)
+                {
+                    mSlots[i].owner = this;
+                    mFreeSlots.push_back(&mSlots[i]);
+                }
+            }
+            FramePool(const FramePool &) = delete;
+            FramePool &operator=(const FramePool &) = delete;
+
+            /**
+             * @brief Takes a free slot able to hold a frame of the given size.
+             * @return A handle to the slot, or an empty handle if the pool is exhausted.
+             */
+            FrameRef acquire(int width, int height)
+            {
+                size_t frameSize = static_cast<size_t>(width) * height * 3 / 2;
+                FrameSnapshot *slot = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(mPoolMutex);
+                    if (mFreeSlots.empty())
+                    {
+                        return FrameRef();
+                    }
+                    slot = mFreeSlots.back();
+                    mFreeSlots.pop_back();
+                }
+                // Only happens on first use of a slot or when the stream resolution changes.
+                if (slot->capacity < frameSize)
+                {
+                    uint8_t *newData = static_cast<uint8_t *>(realloc(slot->data, frameSize));
+                    if (!newData)
+                    {
+                        LOG_ERROR("Memory allocation failed for frame slot of " << frameSize << " bytes");
+                        recycle(slot);
+                        return FrameRef();
+                    }
+                    slot->data = newData;
+                    slot->capacity = frameSize;
+                }
+                slot->size = frameSize;
+                slot->width = width;
+                slot->height = height;
+                slot->pts = -1;
+                slot->refCount.store(1, std::memory_order_relaxed);
+                return FrameRef(slot);
+            }
+
+            size_t slotCount() const
+            {
+                return mSlotCount;
+            }
+
+            size_t freeSlots()
+            {
+                std::lock_guard<std::mutex> lock(mPoolMutex);
+                return mFreeSlots.size();
+            }
+
+        private:
+            friend class FrameRef;
+            void recycle(FrameSnapshot *slot)
+            {
+                std::lock_guard<std::mutex> lock(mPoolMutex);
+                mFreeSlots.push_back(slot);
+            }
+
+            std::unique_ptr<FrameSnapshot[]> mSlots;
+            size_t mSlotCount;
+            std::vector<FrameSnapshot *> mFreeSlots;
+            std::mutex mPoolMutex;
+        };
+
+        inline void FrameRef::release()
+        {
+            if (mSnapshot && mSnapshot->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                mSnapshot->owner->recycle(mSnapshot);
+            }
+        }
+    }
+}
+#endif // FRAME_POOL_HPP
@@ -0,0 +1,63 @@
+#include "InferenceEngine.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        InferenceEngine::InferenceEngine(size_t workerCount) : keepRunning(true)
+        {
+            if (workerCount == 0)
+            {
+                workerCount = 1;
+            }
+            for (size_t i = 0; i < workerCount; ++i)
+            {
+                mWorkers.emplace_back(&InferenceEngine::run, this);
+            }
+            LOG_INFO("Inference engine started with " << workerCount << " worker(s)");
+        }
+
+        InferenceEngine::~InferenceEngine()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mQueueMutex);
+                keepRunning = false;
+            }
+            mQueueCV.notify_all();
+            for (std::thread &worker : mWorkers)
+            {
+                if (worker.joinable())
+                {
+                    worker.join();
+                }
+            }
+        }
+
+        size_t InferenceEngine::pendingJobs()
+        {
+            std::lock_guard<std::mutex> lock(mQueueMutex);
+            return mJobs.size();
+        }
+
+        void InferenceEngine::run()
+        {
+            while (true)
+            {
+                std::function<void()> job;
+                {
+                    std::unique_lock<std::mutex> lock(mQueueMutex);
+                    mQueueCV.wait(lock, [this]
+                                  { return !keepRunning || !mJobs.empty(); });
+                    // Queued jobs are still run on shutdown so that no future is left without a result
+                    if (mJobs.empty())
+                    {
+                        return;
+                    }
+                    job = std::move(mJobs.front());
+                    mJobs.pop_front();
+                }
+                job();
+            }
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#ifndef INFERENCE_ENGINE_HPP
+#define INFERENCE_ENGINE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "Logger.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        /**
+         * @brief Runs model work on its own worker threads.
+         *
+         * Jobs are queued with submit() and their result is delivered through a std::future, so the
+         * thread that hands in the work never holds its own locks while a model runs. One worker is
+         * the default: the TFLite runners share one CPU backend context and thread pool, so
+         * concurrent invokes would only contend for the same cores.
+         */
+        class InferenceEngine
+        {
+        public:
+            explicit InferenceEngine(size_t workerCount = 1);
+            ~InferenceEngine();
+            InferenceEngine(const InferenceEngine &) = delete;
+            InferenceEngine &operator=(const InferenceEngine &) = delete;
+
+            /**
+             * @brief Queues a job.
+             * @return Future holding the result of the job, or its exception.
+             */
+            template <typename Job>
+            auto submit(Job &&job) -> std::future<typename std::invoke_result<Job>::type>
+            {
+                using Result = typename std::invoke_result<Job>::type;
+                auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Job>(job));
+                std::future<Result> result = task->get_future();
+                {
+                    std::lock_guard<std::mutex> lock(mQueueMutex);
+                    mJobs.emplace_back([task]
+                                       { (*task)(); });
+                }
+                mQueueCV.notify_one();
+                return result;
+            }
+
+            size_t pendingJobs();
+
+        private:
+            void run();
+
+            std::deque<std::function<void()>> mJobs;
+            std::mutex mQueueMutex;
+            std::condition_variable mQueueCV;
+            std::vector<std::thread> mWorkers;
+            bool keepRunning;
+        };
+    }
+}
+#endif // INFERENCE_ENGINE_HPP
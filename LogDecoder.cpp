@@ -0,0 +1,103 @@
+#include "AsyncLogBackend.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+// Turns binary logs written by AsyncLogBackend into text, one line per record in the layout of the
+// log4cplus PatternLayout used before: date, thread, level, function:line - message.
+// Usage: logDecoder [-f] file... (oldest first, e.g. surveillance.blog.3 ... surveillance.blog)
+//        -f also prints the source file of each call site
+
+static const char *levelName(uint16_t level)
+{
+  static const char *names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+  return level < sizeof(names) / sizeof(names[0]) ? names[level] : "?";
+}
+
+static int decodeFile(const char *path, bool printFile)
+{
+  FILE *file = std::fopen(path, "rb");
+  if (!file)
+  {
+    std::fprintf(stderr, "%s: %s\n", path, std::strerror(errno));
+    return -1;
+  }
+  AsyncLogFileHeader fileHeader;
+  if (std::fread(&fileHeader, sizeof(fileHeader), 1, file) != 1 || fileHeader.magic != ASYNC_LOG_MAGIC || fileHeader.version != ASYNC_LOG_VERSION)
+  {
+    std::fprintf(stderr, "%s: not a binary log of version %u\n", path, ASYNC_LOG_VERSION);
+    std::fclose(file);
+    return -1;
+  }
+  std::vector<std::string> sites;
+  std::string text;
+  AsyncLogRecordHeader header;
+  long records = 0;
+  while (std::fread(&header, sizeof(header), 1, file) == 1)
+  {
+    text.resize(header.length);
+    if (header.length > 0 && std::fread(&text[0], header.length, 1, file) != 1)
+    {
+      // Cut short by a crash or power loss while the block was written
+      std::fprintf(stderr, "%s: last record truncated\n", path);
+      break;
+    }
+    if (header.level == ASYNC_LOG_SITE_RECORD)
+    {
+      if (header.site >= sites.size())
+      {
+        sites.resize(header.site + 1);
+      }
+      sites[header.site] = text;
+      continue;
+    }
+    std::string site = header.site < sites.size() && !sites[header.site].empty() ? sites[header.site] : "?";
+    size_t space = site.find(' ');
+    std::string location = site.substr(0, space);
+    if (printFile && space != std::string::npos)
+    {
+      location += " (" + site.substr(space + 1) + ")";
+    }
+    time_t seconds = static_cast<time_t>(header.timestampNs / 1000000000ULL);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &utc);
+    std::printf("%s.%03u %u %s %s - %s\n", date, static_cast<unsigned>((header.timestampNs / 1000000ULL) % 1000), header.threadId,
+                levelName(header.level), location.c_str(), text.c_str());
+    ++records;
+  }
+  std::fclose(file);
+  std::fprintf(stderr, "%s: %ld records\n", path, records);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  bool printFile = false;
+  int status = 0;
+  int files = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "-f") == 0)
+    {
+      printFile = true;
+      continue;
+    }
+    ++files;
+    if (decodeFile(argv[i], printFile) != 0)
+    {
+      status = 1;
+    }
+  }
+  if (files == 0)
+  {
+    std::fprintf(stderr, "Usage: %s [-f] file...\n", argv[0]);
+    return 1;
+  }
+  return status;
+}
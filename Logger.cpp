@@ -1,33 +1,106 @@
 #include "Logger.hpp"
+#include "AsyncLogBackend.hpp"
 #include <log4cplus/configurator.h>
+#include <mutex>
 
-void Logger::log(LogLevel level, const std::string &message)
+namespace
 {
-    log4cplus::Logger logger = getLogger();
+    Logger::LogSite sSites[LOGGER_MAX_SITES];
+    std::atomic<uint32_t> sSiteCount{0};
+    std::mutex sSitesMutex;
+    const Logger::LogSite kUnknownSite = {"?", "?", 0};
+}
+
+void Logger::log(LogLevel level, uint32_t siteId, const std::string &message)
+{
+    if (sAsync.load(std::memory_order_relaxed))
+    {
+        AsyncLogBackend::instance().append(level, siteId, message);
+        return;
+    }
+    log4cplus::Logger &logger = getLogger();
+    LogSite logSite = site(siteId);
+    std::string text = std::string(logSite.function) + ":" + std::to_string(logSite.line) + " - " + message;
 
     switch (level)
     {
     case TRACE:
-        LOG4CPLUS_TRACE(logger, message);
+        LOG4CPLUS_TRACE(logger, text);
         break;
     case DEBUG:
-        LOG4CPLUS_DEBUG(logger, message);
+        LOG4CPLUS_DEBUG(logger, text);
         break;
     case INFO:
-        LOG4CPLUS_INFO(logger, message);
+        LOG4CPLUS_INFO(logger, text);
         break;
     case WARN:
-        LOG4CPLUS_WARN(logger, message);
+        LOG4CPLUS_WARN(logger, text);
         break;
     case ERROR:
-        LOG4CPLUS_ERROR(logger, message);
+        LOG4CPLUS_ERROR(logger, text);
         break;
     case FATAL:
-        LOG4CPLUS_FATAL(logger, message);
+        LOG4CPLUS_FATAL(logger, text);
         break;
     }
 }
 
+void Logger::refreshLevel()
+{
+    log4cplus::Logger &logger = getLogger();
+    const log4cplus::LogLevel levels[] = {log4cplus::TRACE_LOG_LEVEL, log4cplus::DEBUG_LOG_LEVEL, log4cplus::INFO_LOG_LEVEL,
+                                          log4cplus::WARN_LOG_LEVEL, log4cplus::ERROR_LOG_LEVEL, log4cplus::FATAL_LOG_LEVEL};
+    int threshold = FATAL + 1;
+    for (int level = TRACE; level <= FATAL; ++level)
+    {
+        if (logger.isEnabledFor(levels[level]))
+        {
+            threshold = level;
+            break;
+        }
+    }
+    sThreshold.store(threshold, std::memory_order_relaxed);
+}
+
+uint32_t Logger::registerSite(const char *function, const char *file, int line)
+{
+    std::lock_guard<std::mutex> lock(sSitesMutex);
+    uint32_t id = sSiteCount.load(std::memory_order_relaxed);
+    if (id >= LOGGER_MAX_SITES)
+    {
+        return LOGGER_MAX_SITES;
+    }
+    sSites[id] = {function, file, line};
+    sSiteCount.store(id + 1, std::memory_order_release);
+    return id;
+}
+
+uint32_t Logger::siteCount()
+{
+    return sSiteCount.load(std::memory_order_acquire);
+}
+
+Logger::LogSite Logger::site(uint32_t id)
+{
+    return id < siteCount() ? sSites[id] : kUnknownSite;
+}
+
+bool Logger::startAsync(const std::string &path)
+{
+    if (!AsyncLogBackend::instance().start(path))
+    {
+        return false;
+    }
+    sAsync.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+void Logger::stopAsync()
+{
+    sAsync.store(false, std::memory_order_relaxed);
+    AsyncLogBackend::instance().stop();
+}
+
 log4cplus::Logger &Logger::getLogger()
 {
     static log4cplus::Logger logger = log4cplus::Logger::getInstance(LOG4CPLUS_TEXT("ApplicationLogger"));
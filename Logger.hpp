@@ -3,39 +3,42 @@
 
 #include <log4cplus/logger.h>
 #include <log4cplus/loggingmacros.h>
+#include <atomic>
+#include <cstdint>
 #include <string>
 #include <sstream>
 
-#define LOG_INFO(message) { \
-    std::ostringstream oss; \
-    oss << __FUNCTION__ << ":" << __LINE__ << " - " << message; \
-    Logger::log(Logger::INFO, oss.str()); \
-}
-#define LOG_DEBUG(message) { \
-    std::ostringstream oss; \
-    oss << __FUNCTION__ << ":" << __LINE__ << " - " << message; \
-    Logger::log(Logger::DEBUG, oss.str()); \
-}
-#define LOG_WARN(message) { \
-    std::ostringstream oss; \
-    oss << __FUNCTION__ << ":" << __LINE__ << " - " << message; \
-    Logger::log(Logger::WARN, oss.str()); \
-}
-#define LOG_ERROR(message) { \
-    std::ostringstream oss; \
-    oss << __FUNCTION__ << ":" << __LINE__ << " - " << message; \
-    Logger::log(Logger::ERROR, oss.str()); \
-}
-#define LOG_TRACE(message) { \
-    std::ostringstream oss; \
-    oss << __FUNCTION__ << ":" << __LINE__ << " - " << message; \
-    Logger::log(Logger::TRACE, oss.str()); \
-}
-#define LOG_FATAL(message) { \
-    std::ostringstream oss; \
-    oss << __FUNCTION__ << ":" << __LINE__ << " - " << message; \
-    Logger::log(Logger::FATAL, oss.str()); \
-}
+// The level is checked before the message is formatted, so a disabled level costs one relaxed load and a compare.
+// Function and line are registered once per call site and travel as the site id.
+#define LOG_AT_LEVEL(level, message) do { \
+    if (Logger::isEnabled(level)) { \
+        static const uint32_t logSite = Logger::registerSite(__FUNCTION__, __FILE__, __LINE__); \
+        std::ostringstream oss; \
+        oss << message; \
+        Logger::log(level, logSite, oss.str()); \
+    } \
+} while (0)
+// Compiled out, the message is still type checked
+#define LOG_STRIPPED(message) do { \
+    if (false) { \
+        std::ostringstream oss; \
+        oss << message; \
+    } \
+} while (0)
+
+#define LOG_INFO(message) LOG_AT_LEVEL(Logger::INFO, message)
+#define LOG_WARN(message) LOG_AT_LEVEL(Logger::WARN, message)
+#define LOG_ERROR(message) LOG_AT_LEVEL(Logger::ERROR, message)
+#define LOG_FATAL(message) LOG_AT_LEVEL(Logger::FATAL, message)
+#ifdef LOG_STRIP_DEBUG
+#define LOG_DEBUG(message) LOG_STRIPPED(message)
+#define LOG_TRACE(message) LOG_STRIPPED(message)
+#else
+#define LOG_DEBUG(message) LOG_AT_LEVEL(Logger::DEBUG, message)
+#define LOG_TRACE(message) LOG_AT_LEVEL(Logger::TRACE, message)
+#endif
+// Call sites beyond this share the "?" site
+constexpr uint32_t LOGGER_MAX_SITES = 4096;
 class Logger {
 public:
     enum LogLevel {
@@ -47,9 +50,37 @@ public:
         FATAL
     };
 
-    static void log(LogLevel level, const std::string& message);
+    struct LogSite {
+        const char *function;
+        const char *file;
+        int line;
+    };
+
+    static void log(LogLevel level, uint32_t site, const std::string& message);
+    static bool isEnabled(LogLevel level)
+    {
+        return level >= sThreshold.load(std::memory_order_relaxed);
+    }
+    /**
+     * @brief Caches the level log4cplus is configured with; call after (re)configuring log4cplus.
+     *
+     * Until then every level is passed on and log4cplus filters.
+     */
+    static void refreshLevel();
+    static uint32_t registerSite(const char *function, const char *file, int line);
+    static uint32_t siteCount();
+    static LogSite site(uint32_t id);
+    /**
+     * @brief Hands logging over to the asynchronous binary backend, see AsyncLogBackend.
+     * @return false if the log file cannot be created; logging stays on log4cplus.
+     */
+    static bool startAsync(const std::string &path);
+    // Back to log4cplus, after everything logged so far is written
+    static void stopAsync();
 private:
     static log4cplus::Logger& getLogger();
+    static inline std::atomic<int> sThreshold{TRACE};
+    static inline std::atomic<bool> sAsync{false};
 };
 
 #endif // LOGGER_H
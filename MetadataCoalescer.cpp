@@ -0,0 +1,89 @@
+#include "MetadataCoalescer.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        MetadataCoalescer::MetadataCoalescer() : mCount(0), mSequence(0)
+        {
+        }
+
+        bool MetadataCoalescer::isBetter(const Candidate &candidate, const Candidate &other)
+        {
+            bool qualified = isQualifiedMotion(candidate.metaData.event_type, candidate.motionFlags);
+            bool otherQualified = isQualifiedMotion(other.metaData.event_type, other.motionFlags);
+            if (qualified != otherQualified)
+            {
+                return qualified;
+            }
+            int area = candidate.metaData.unionBox.boundingBoxWidth * candidate.metaData.unionBox.boundingBoxHeight;
+            int otherArea = other.metaData.unionBox.boundingBoxWidth * other.metaData.unionBox.boundingBoxHeight;
+            if (area != otherArea)
+            {
+                return area > otherArea;
+            }
+            if (candidate.metaData.motionScore != other.metaData.motionScore)
+            {
+                return candidate.metaData.motionScore > other.metaData.motionScore;
+            }
+            return candidate.sequence > other.sequence;
+        }
+
+        void MetadataCoalescer::push(const MotionEventMetadata &metaData, int motionFlags)
+        {
+            std::lock_guard<std::mutex> lock(mCoalescerMutex);
+            mStats.received++;
+            Candidate incoming;
+            incoming.metaData = metaData;
+            incoming.motionFlags = motionFlags;
+            incoming.sequence = ++mSequence;
+            if (mCount < METADATA_BACKLOG_SLOTS)
+            {
+                mBacklog[mCount++] = incoming;
+                return;
+            }
+            size_t worst = 0;
+            for (size_t i = 1; i < mCount; ++i)
+            {
+                if (isBetter(mBacklog[worst], mBacklog[i]))
+                {
+                    worst = i;
+                }
+            }
+            mStats.dropped++;
+            if (isBetter(incoming, mBacklog[worst]))
+            {
+                mBacklog[worst] = incoming;
+            }
+        }
+
+        bool MetadataCoalescer::take(MotionEventMetadata *metaData, int *motionFlags)
+        {
+            std::lock_guard<std::mutex> lock(mCoalescerMutex);
+            if (mCount == 0)
+            {
+                return false;
+            }
+            size_t best = 0;
+            for (size_t i = 1; i < mCount; ++i)
+            {
+                if (isBetter(mBacklog[i], mBacklog[best]))
+                {
+                    best = i;
+                }
+            }
+            *metaData = mBacklog[best].metaData;
+            *motionFlags = mBacklog[best].motionFlags;
+            mStats.coalesced += mCount - 1;
+            mStats.windows++;
+            mCount = 0;
+            return true;
+        }
+
+        CoalescerStats MetadataCoalescer::stats()
+        {
+            std::lock_guard<std::mutex> lock(mCoalescerMutex);
+            return mStats;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef METADATA_COALESCER_HPP
+#define METADATA_COALESCER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "MotionEventMetadata.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        // Metadata events held between two drains
+        constexpr size_t METADATA_BACKLOG_SLOTS = 16;
+
+        /**
+         * @struct CoalescerStats
+         * @brief received = pushed events, coalesced = superseded by a better candidate at a drain,
+         * dropped = evicted because the backlog was full, windows = drains that produced a candidate.
+         */
+        struct CoalescerStats
+        {
+            uint64_t received;
+            uint64_t coalesced;
+            uint64_t dropped;
+            uint64_t windows;
+            CoalescerStats() : received(0), coalesced(0), dropped(0), windows(0) {}
+        };
+
+        /**
+         * @brief Collapses the metadata received in one dispatch window into its best candidate.
+         *
+         * Only that candidate reaches processFrameMetaData, so at most one frame is copied per window
+         * however many events xVision sent. Candidates are ranked by: qualifying motion inside the
+         * ROI/DOI first, then the largest union box, then the highest motion score, then the newest.
+         * When the backlog is full the lowest ranked event is dropped, which may be the incoming one.
+         */
+        class MetadataCoalescer
+        {
+        public:
+            MetadataCoalescer();
+
+            void push(const MotionEventMetadata &metaData, int motionFlags);
+            /**
+             * @brief Takes the best candidate and clears the backlog.
+             * @return false if nothing was pushed since the last drain.
+             */
+            bool take(MotionEventMetadata *metaData, int *motionFlags);
+            CoalescerStats stats();
+
+        private:
+            struct Candidate
+            {
+                MotionEventMetadata metaData;
+                int motionFlags = 0;
+                uint64_t sequence = 0;
+            };
+
+            static bool isBetter(const Candidate &candidate, const Candidate &other);
+
+            Candidate mBacklog[METADATA_BACKLOG_SLOTS];
+            size_t mCount;
+            uint64_t mSequence;
+            CoalescerStats mStats;
+            std::mutex mCoalescerMutex;
+        };
+    }
+}
+#endif // METADATA_COALESCER_HPP
@@ -0,0 +1,233 @@
+#include "MetadataRing.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            // Shared (not PRIVATE) futex operations, the word lives in memory mapped by two processes
+            long futexWait(std::atomic<uint32_t> *word, uint32_t expected, int timeoutMs)
+            {
+                struct timespec timeout;
+                timeout.tv_sec = timeoutMs / 1000;
+                timeout.tv_nsec = static_cast<long>(timeoutMs % 1000) * 1000000L;
+                return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+            }
+
+            long futexWake(std::atomic<uint32_t> *word)
+            {
+                return syscall(SYS_futex, reinterpret_cast<uint32_t *>(word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+            }
+
+            size_t segmentSize()
+            {
+                return sizeof(MetadataRingHeader) + sizeof(MetadataRecord) * METADATA_RING_SLOTS;
+            }
+        }
+
+        MetadataRing::MetadataRing() : mOwner(false), mSize(0), mInode(0), mHeader(nullptr), mRecords(nullptr)
+        {
+        }
+
+        MetadataRing::~MetadataRing()
+        {
+            close();
+        }
+
+        int MetadataRing::create(const std::string &name)
+        {
+            close();
+            shm_unlink(name.c_str());
+            int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0660);
+            if (fd < 0)
+            {
+                LOG_ERROR("shm_open(" << name << ") failed: " << strerror(errno));
+                return -1;
+            }
+            if (ftruncate(fd, static_cast<off_t>(segmentSize())) != 0)
+            {
+                LOG_ERROR("ftruncate(" << name << ") failed: " << strerror(errno));
+                ::close(fd);
+                shm_unlink(name.c_str());
+                return -1;
+            }
+            mName = name;
+            mOwner = true;
+            return map(fd, true);
+        }
+
+        int MetadataRing::open(const std::string &name)
+        {
+            close();
+            int fd = shm_open(name.c_str(), O_RDWR, 0);
+            if (fd < 0)
+            {
+                // Not an error, the producer may simply not be running
+                return -1;
+            }
+            struct stat statbuf;
+            if (fstat(fd, &statbuf) != 0 || static_cast<size_t>(statbuf.st_size) < segmentSize())
+            {
+                LOG_ERROR("Metadata ring " << name << " has an unexpected size");
+                ::close(fd);
+                return -1;
+            }
+            mName = name;
+            mOwner = false;
+            if (map(fd, false) != 0)
+            {
+                return -1;
+            }
+            if (mHeader->magic != METADATA_RING_MAGIC || mHeader->version != METADATA_RING_VERSION ||
+                mHeader->slotCount != METADATA_RING_SLOTS || mHeader->recordSize != sizeof(MetadataRecord))
+            {
+                LOG_ERROR("Metadata ring " << name << " layout mismatch, version " << mHeader->version << " record size " << mHeader->recordSize);
+                close();
+                return -1;
+            }
+            return 0;
+        }
+
+        int MetadataRing::map(int fd, bool initialize)
+        {
+            size_t size = segmentSize();
+            struct stat statbuf;
+            mInode = (fstat(fd, &statbuf) == 0) ? statbuf.st_ino : 0;
+            void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (addr == MAP_FAILED)
+            {
+                LOG_ERROR("mmap of metadata ring failed: " << strerror(errno));
+                return -1;
+            }
+            mSize = size;
+            mHeader = static_cast<MetadataRingHeader *>(addr);
+            mRecords = reinterpret_cast<MetadataRecord *>(static_cast<uint8_t *>(addr) + sizeof(MetadataRingHeader));
+            if (initialize)
+            {
+                new (mHeader) MetadataRingHeader();
+                mHeader->slotCount = METADATA_RING_SLOTS;
+                mHeader->recordSize = sizeof(MetadataRecord);
+                mHeader->version = METADATA_RING_VERSION;
+                mHeader->writeIndex.store(0, std::memory_order_relaxed);
+                mHeader->readIndex.store(0, std::memory_order_relaxed);
+                mHeader->dropped.store(0, std::memory_order_relaxed);
+                mHeader->futexSeq.store(0, std::memory_order_relaxed);
+                mHeader->consumerWaiting.store(0, std::memory_order_relaxed);
+                // Written last so that a consumer never accepts a half initialised segment
+                std::atomic_thread_fence(std::memory_order_release);
+                mHeader->magic = METADATA_RING_MAGIC;
+            }
+            return 0;
+        }
+
+        void MetadataRing::close()
+        {
+            if (mHeader)
+            {
+                munmap(mHeader, mSize);
+                mHeader = nullptr;
+                mRecords = nullptr;
+                if (mOwner)
+                {
+                    shm_unlink(mName.c_str());
+                }
+            }
+            mOwner = false;
+        }
+
+        bool MetadataRing::publish(MetadataRecord &record)
+        {
+            uint64_t write = mHeader->writeIndex.load(std::memory_order_relaxed);
+            uint64_t read = mHeader->readIndex.load(std::memory_order_acquire);
+            if (write - read >= METADATA_RING_SLOTS)
+            {
+                mHeader->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            record.publishTimeNs = monotonicNs();
+            mRecords[write & (METADATA_RING_SLOTS - 1)] = record;
+            mHeader->writeIndex.store(write + 1, std::memory_order_release);
+            mHeader->futexSeq.fetch_add(1, std::memory_order_release);
+            if (mHeader->consumerWaiting.load(std::memory_order_seq_cst))
+            {
+                futexWake(&mHeader->futexSeq);
+            }
+            return true;
+        }
+
+        bool MetadataRing::consume(MetadataRecord *record, int timeoutMs)
+        {
+            uint64_t read = mHeader->readIndex.load(std::memory_order_relaxed);
+            while (true)
+            {
+                uint32_t seq = mHeader->futexSeq.load(std::memory_order_acquire);
+                if (mHeader->writeIndex.load(std::memory_order_acquire) != read)
+                {
+                    break;
+                }
+                if (timeoutMs <= 0)
+                {
+                    return false;
+                }
+                mHeader->consumerWaiting.store(1, std::memory_order_seq_cst);
+                // Re-check after announcing the wait, a publish in between changes futexSeq and the wait returns at once
+                long ret = 0;
+                if (mHeader->writeIndex.load(std::memory_order_seq_cst) == read)
+                {
+                    ret = futexWait(&mHeader->futexSeq, seq, timeoutMs);
+                }
+                mHeader->consumerWaiting.store(0, std::memory_order_relaxed);
+                if (ret != 0 && errno == ETIMEDOUT)
+                {
+                    return false;
+                }
+            }
+            *record = mRecords[read & (METADATA_RING_SLOTS - 1)];
+            mHeader->readIndex.store(read + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool MetadataRing::isStale() const
+        {
+            if (!mHeader)
+            {
+                return true;
+            }
+            int fd = shm_open(mName.c_str(), O_RDONLY, 0);
+            if (fd < 0)
+            {
+                return true;
+            }
+            struct stat statbuf;
+            bool stale = (fstat(fd, &statbuf) != 0) || (statbuf.st_ino != mInode);
+            ::close(fd);
+            return stale;
+        }
+
+        uint64_t MetadataRing::dropped() const
+        {
+            return mHeader ? mHeader->dropped.load(std::memory_order_relaxed) : 0;
+        }
+
+        int64_t MetadataRing::monotonicNs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+        }
+    }
+}
@@ -0,0 +1,130 @@
+#ifndef METADATA_RING_HPP
+#define METADATA_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include <type_traits>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        constexpr const char *METADATA_RING_NAME = "/smarttn_metadata";
+        constexpr uint32_t METADATA_RING_MAGIC = 0x534D5452; // "SMTR"
+        constexpr uint32_t METADATA_RING_VERSION = 1;
+        constexpr uint32_t METADATA_RING_SLOTS = 64; // Power of two
+        constexpr int METADATA_RING_MAX_BLOBS = 5;   // Matches UPPER_LIMIT_BLOB_BB
+
+        /**
+         * @struct MetadataBox
+         * @brief Absolute bounding box as published by xVision.
+         */
+        struct MetadataBox
+        {
+            int32_t x;
+            int32_t y;
+            int32_t width;
+            int32_t height;
+        };
+
+        /**
+         * @struct MetadataRecord
+         * @brief One motion metadata event, fixed layout so that it can be shared between processes.
+         *
+         * Any change to this layout must bump METADATA_RING_VERSION.
+         */
+        struct MetadataRecord
+        {
+            int64_t framePTS;
+            int64_t eventTime;     // Wall clock time of the event, in ms
+            int64_t publishTimeNs; // CLOCK_MONOTONIC when published, for latency accounting
+            int32_t eventType;
+            int32_t motionFlags;
+            double motionScore;
+            MetadataBox unionBox;
+            MetadataBox deliveryUnionBox;
+            int32_t blobCount;
+            MetadataBox blobs[METADATA_RING_MAX_BLOBS];
+        };
+        static_assert(std::is_trivially_copyable<MetadataRecord>::value, "MetadataRecord is copied across processes");
+        static_assert(std::is_standard_layout<MetadataRecord>::value, "MetadataRecord is copied across processes");
+
+        /**
+         * @struct MetadataRingHeader
+         * @brief Control block at the start of the shared memory segment.
+         *
+         * Single producer, single consumer: the producer only writes writeIndex, the consumer only
+         * writes readIndex, each on its own cache line. futexSeq is bumped on every publish and is
+         * what a waiting consumer sleeps on.
+         */
+        struct MetadataRingHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t slotCount;
+            uint32_t recordSize;
+            alignas(64) std::atomic<uint64_t> writeIndex;
+            std::atomic<uint64_t> dropped;
+            std::atomic<uint32_t> futexSeq;
+            alignas(64) std::atomic<uint64_t> readIndex;
+            std::atomic<uint32_t> consumerWaiting;
+        };
+        static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                      "Ring indices must be lock free to live in shared memory");
+
+        /**
+         * @brief Lock-free SPSC ring of MetadataRecord in POSIX shared memory.
+         *
+         * The producer never blocks: when the ring is full the record is dropped and counted. The
+         * consumer waits on a futex in the segment, so no syscall is made while records keep coming.
+         */
+        class MetadataRing
+        {
+        public:
+            MetadataRing();
+            ~MetadataRing();
+            MetadataRing(const MetadataRing &) = delete;
+            MetadataRing &operator=(const MetadataRing &) = delete;
+
+            // Creates (or recreates) the segment, producer side. Returns 0 on success, -1 on error.
+            int create(const std::string &name = METADATA_RING_NAME);
+            // Maps an existing segment and checks its layout, consumer side. Returns 0 on success, -1 on error.
+            int open(const std::string &name = METADATA_RING_NAME);
+            void close();
+            // True once the producer has removed or recreated the segment this ring is mapped to
+            bool isStale() const;
+
+            /**
+             * @brief Publishes a record. Stamps publishTimeNs.
+             * @return false if the ring was full and the record was dropped.
+             */
+            bool publish(MetadataRecord &record);
+            /**
+             * @brief Takes the next record, waiting up to @p timeoutMs for one to arrive.
+             * @return false on timeout.
+             */
+            bool consume(MetadataRecord *record, int timeoutMs);
+
+            uint64_t dropped() const;
+            bool isOpen() const
+            {
+                return mHeader != nullptr;
+            }
+            static int64_t monotonicNs();
+
+        private:
+            int map(int fd, bool initialize);
+
+            std::string mName;
+            bool mOwner;
+            size_t mSize;
+            ino_t mInode;
+            MetadataRingHeader *mHeader;
+            MetadataRecord *mRecords;
+        };
+    }
+}
+#endif // METADATA_RING_HPP
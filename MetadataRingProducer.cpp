@@ -0,0 +1,85 @@
+#include "MetadataRing.hpp"
+#include "Logger.hpp"
+
+#include <log4cplus/configurator.h>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+// Stand-in for the xVision side of the metadata ring: publishes synthetic motion events so that
+// the consumer in surveillanceApp can be exercised and timed without xVision running.
+// Usage: metadataProducer [events per second, 0 = as fast as possible] [event count, 0 = until Ctrl+C]
+
+volatile std::sig_atomic_t stop;
+
+void signalHandler(int signum)
+{
+  stop = 1;
+}
+using namespace ::camera;
+using namespace ::camera::camera_ml;
+
+int main(int argc, char *argv[])
+{
+  std::signal(SIGINT, signalHandler);
+  log4cplus::initialize();
+  log4cplus::BasicConfigurator::doConfigure();
+  Logger::refreshLevel();
+  int rate = (argc > 1) ? std::atoi(argv[1]) : 15;
+  long count = (argc > 2) ? std::atol(argv[2]) : 0;
+
+  MetadataRing ring;
+  if (ring.create() != 0)
+  {
+    return 1;
+  }
+  std::cout << "Publishing on " << METADATA_RING_NAME << " at " << (rate > 0 ? std::to_string(rate) : "max") << " events/s" << std::endl;
+
+  // PTS advances on a 90 kHz clock, as the frames from xStreamer do
+  const int64_t ptsStep = 90000 / (rate > 0 ? rate : 15);
+  MetadataRecord record = {};
+  record.eventType = 4;
+  record.motionFlags = 0;
+  record.blobCount = 2;
+  long published = 0;
+  long full = 0;
+  int64_t publishTotalNs = 0;
+  auto begin = std::chrono::steady_clock::now();
+  auto next = begin;
+  for (long i = 0; !stop && (count == 0 || i < count); ++i)
+  {
+    record.framePTS = i * ptsStep;
+    record.eventTime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.motionScore = static_cast<double>(i % 100) / 100.0;
+    // Union box grows and shrinks so that thumbnail candidates keep qualifying
+    int size = 40 + static_cast<int>(i % 80);
+    record.unionBox = {100, 60, size, size};
+    record.deliveryUnionBox = {90, 50, size + 20, size + 20};
+    record.blobs[0] = {100, 60, size / 2, size / 2};
+    record.blobs[1] = {100 + size / 2, 60 + size / 2, size / 2, size / 2};
+
+    int64_t start = MetadataRing::monotonicNs();
+    if (ring.publish(record))
+    {
+      published++;
+    }
+    else
+    {
+      full++;
+    }
+    publishTotalNs += MetadataRing::monotonicNs() - start;
+
+    if (rate > 0)
+    {
+      next += std::chrono::microseconds(1000000 / rate);
+      std::this_thread::sleep_until(next);
+    }
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  long total = published + full;
+  std::cout << published << " published, " << full << " dropped (ring full) in " << seconds << " s, "
+            << (seconds > 0 ? total / seconds : 0) << " events/s, publish avg " << (total ? publishTotalNs / total : 0) << " ns" << std::endl;
+  return 0;
+}
@@ -0,0 +1,264 @@
+#include "MetricsRegistry.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            const char *kTypeNames[] = {"counter", "gauge", "summary"};
+
+            std::string labelSet(const std::string &labels, const std::string &extra = "")
+            {
+                if (labels.empty() && extra.empty())
+                {
+                    return "";
+                }
+                return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+            }
+        }
+
+        MetricsRegistry &MetricsRegistry::instance()
+        {
+            static MetricsRegistry registry;
+            return registry;
+        }
+
+        MetricsRegistry::Metric *MetricsRegistry::findOrAdd(const std::string &name, const std::string &help, const std::string &labels, METRIC_TYPE type)
+        {
+            std::lock_guard<std::mutex> lock(mMetricsMutex);
+            for (const auto &metric : mMetrics)
+            {
+                if (metric->name == name && metric->labels == labels)
+                {
+                    if (metric->type != type)
+                    {
+                        LOG_ERROR("Metric " << name << " registered as " << kTypeNames[metric->type] << " and as " << kTypeNames[type]);
+                    }
+                    return metric.get();
+                }
+            }
+            std::unique_ptr<Metric> metric(new Metric());
+            metric->name = name;
+            metric->help = help;
+            metric->labels = labels;
+            metric->type = type;
+            if (type == METRIC_SUMMARY)
+            {
+                metric->summary.reset(new LatencyHistogram());
+            }
+            mMetrics.push_back(std::move(metric));
+            return mMetrics.back().get();
+        }
+
+        Counter *MetricsRegistry::counter(const std::string &name, const std::string &help, const std::string &labels)
+        {
+            return &findOrAdd(name, help, labels, METRIC_COUNTER)->counter;
+        }
+
+        Gauge *MetricsRegistry::gauge(const std::string &name, const std::string &help, const std::string &labels)
+        {
+            return &findOrAdd(name, help, labels, METRIC_GAUGE)->gauge;
+        }
+
+        LatencyHistogram *MetricsRegistry::summary(const std::string &name, const std::string &help, const std::string &labels)
+        {
+            Metric *metric = findOrAdd(name, help, labels, METRIC_SUMMARY);
+            // A name first registered as another type has no histogram, hand out one that is not exposed
+            if (!metric->summary)
+            {
+                static LatencyHistogram unexposed;
+                return &unexposed;
+            }
+            return metric->summary.get();
+        }
+
+        /**
+         * The values are read with relaxed loads while the pipeline keeps updating them, so counters of
+         * one scrape are not a consistent snapshot of each other. All samples of a name are written
+         * together, as the text format requires.
+         */
+        std::string MetricsRegistry::render()
+        {
+            std::ostringstream out;
+            std::lock_guard<std::mutex> lock(mMetricsMutex);
+            std::vector<bool> written(mMetrics.size(), false);
+            for (size_t i = 0; i < mMetrics.size(); ++i)
+            {
+                if (written[i])
+                {
+                    continue;
+                }
+                const Metric &family = *mMetrics[i];
+                out << "# HELP " << family.name << " " << family.help << "\n";
+                out << "# TYPE " << family.name << " " << kTypeNames[family.type] << "\n";
+                for (size_t j = i; j < mMetrics.size(); ++j)
+                {
+                    const Metric &metric = *mMetrics[j];
+                    if (written[j] || metric.name != family.name)
+                    {
+                        continue;
+                    }
+                    written[j] = true;
+                    if (metric.type == METRIC_COUNTER)
+                    {
+                        out << metric.name << labelSet(metric.labels) << " " << metric.counter.value() << "\n";
+                    }
+                    else if (metric.type == METRIC_GAUGE)
+                    {
+                        out << metric.name << labelSet(metric.labels) << " " << metric.gauge.value() << "\n";
+                    }
+                    else if (metric.summary)
+                    {
+                        const LatencyHistogram &summary = *metric.summary;
+                        out << metric.name << labelSet(metric.labels, "quantile=\"0.5\"") << " " << summary.quantile(0.5) << "\n";
+                        out << metric.name << labelSet(metric.labels, "quantile=\"0.9\"") << " " << summary.quantile(0.9) << "\n";
+                        out << metric.name << labelSet(metric.labels, "quantile=\"0.99\"") << " " << summary.quantile(0.99) << "\n";
+                        out << metric.name << "_sum" << labelSet(metric.labels) << " " << summary.sum() << "\n";
+                        out << metric.name << "_count" << labelSet(metric.labels) << " " << summary.count() << "\n";
+                    }
+                }
+            }
+            return out.str();
+        }
+
+        MetricsServer::MetricsServer() : mListenFd(-1)
+        {
+            mShutdownEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (mShutdownEventFd < 0)
+            {
+                LOG_ERROR("Failed to create the metrics shutdown eventfd: " << strerror(errno));
+            }
+        }
+
+        MetricsServer::~MetricsServer()
+        {
+            stop();
+            if (mShutdownEventFd >= 0)
+            {
+                close(mShutdownEventFd);
+            }
+        }
+
+        int MetricsServer::start(const std::string &path)
+        {
+            if (mServerThread.joinable())
+            {
+                return 0;
+            }
+            struct sockaddr_un addr;
+            if (mShutdownEventFd < 0 || path.size() >= sizeof(addr.sun_path))
+            {
+                LOG_ERROR("Metrics server not started on " << path);
+                return -1;
+            }
+            mListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (mListenFd < 0)
+            {
+                LOG_ERROR("Failed to create the metrics socket: " << strerror(errno));
+                return -1;
+            }
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+            // Left behind by a previous run that did not exit cleanly
+            unlink(path.c_str());
+            if (bind(mListenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(mListenFd, 4) != 0)
+            {
+                LOG_ERROR("Failed to listen on " << path << ": " << strerror(errno));
+                close(mListenFd);
+                mListenFd = -1;
+                return -1;
+            }
+            mPath = path;
+            mServerThread = std::thread(&MetricsServer::run, this);
+            LOG_INFO("Serving metrics on " << path);
+            return 0;
+        }
+
+        void MetricsServer::stop()
+        {
+            if (!mServerThread.joinable())
+            {
+                return;
+            }
+            uint64_t one = 1;
+            if (write(mShutdownEventFd, &one, sizeof(one)) != sizeof(one))
+            {
+                LOG_ERROR("Failed to signal the metrics server: " << strerror(errno));
+            }
+            mServerThread.join();
+            close(mListenFd);
+            mListenFd = -1;
+            unlink(mPath.c_str());
+        }
+
+        void MetricsServer::run()
+        {
+            struct pollfd fds[2];
+            fds[0].fd = mListenFd;
+            fds[0].events = POLLIN;
+            fds[1].fd = mShutdownEventFd;
+            fds[1].events = POLLIN;
+            while (true)
+            {
+                int ret = poll(fds, 2, -1);
+                if (ret < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    LOG_ERROR("poll failed: " << strerror(errno));
+                    break;
+                }
+                if (fds[1].revents & POLLIN)
+                {
+                    break;
+                }
+                if (fds[0].revents & POLLIN)
+                {
+                    int clientFd = accept4(mListenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (clientFd >= 0)
+                    {
+                        serve(clientFd);
+                        close(clientFd);
+                    }
+                }
+            }
+        }
+
+        void MetricsServer::serve(int clientFd)
+        {
+            struct timeval timeout;
+            timeout.tv_sec = METRICS_CLIENT_TIMEOUT_MS / 1000;
+            timeout.tv_usec = (METRICS_CLIENT_TIMEOUT_MS % 1000) * 1000;
+            setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            std::string text = MetricsRegistry::instance().render();
+            size_t offset = 0;
+            while (offset < text.size())
+            {
+                ssize_t written = send(clientFd, text.data() + offset, text.size() - offset, MSG_NOSIGNAL);
+                if (written < 0)
+                {
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    LOG_DEBUG("Metrics client went away: " << strerror(errno));
+                    return;
+                }
+                offset += static_cast<size_t>(written);
+            }
+        }
+    }
+}
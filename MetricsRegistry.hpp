@@ -0,0 +1,130 @@
+#ifndef METRICS_REGISTRY_HPP
+#define METRICS_REGISTRY_HPP
+
+#include "PipelineTracer.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        constexpr const char *METRICS_SOCKET_PATH = "/tmp/surveillance_metrics.sock";
+        // A scraper that does not read its reply within this time is dropped
+        constexpr int METRICS_CLIENT_TIMEOUT_MS = 1000;
+
+        typedef enum
+        {
+            METRIC_COUNTER,
+            METRIC_GAUGE,
+            METRIC_SUMMARY
+        } METRIC_TYPE;
+
+        /**
+         * @brief Monotonic count, updated lock free.
+         */
+        class Counter
+        {
+        public:
+            void inc(uint64_t n = 1)
+            {
+                mValue.fetch_add(n, std::memory_order_relaxed);
+            }
+            uint64_t value() const
+            {
+                return mValue.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<uint64_t> mValue{0};
+        };
+
+        /**
+         * @brief Current level of something, updated lock free.
+         */
+        class Gauge
+        {
+        public:
+            void set(int64_t value)
+            {
+                mValue.store(value, std::memory_order_relaxed);
+            }
+            void add(int64_t delta)
+            {
+                mValue.fetch_add(delta, std::memory_order_relaxed);
+            }
+            int64_t value() const
+            {
+                return mValue.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::atomic<int64_t> mValue{0};
+        };
+
+        /**
+         * @brief Process wide set of metrics, rendered in the Prometheus text format.
+         *
+         * Metrics are created once, usually in a constructor, and the returned pointer stays valid
+         * for the life of the process; updating it never takes a lock. Asking again for the same name
+         * and labels returns the same metric. Latency distributions are LatencyHistograms exposed as
+         * summaries with p50/p90/p99.
+         */
+        class MetricsRegistry
+        {
+        public:
+            static MetricsRegistry &instance();
+
+            // @p labels is the inside of the label set, e.g. model="person"
+            Counter *counter(const std::string &name, const std::string &help, const std::string &labels = "");
+            Gauge *gauge(const std::string &name, const std::string &help, const std::string &labels = "");
+            LatencyHistogram *summary(const std::string &name, const std::string &help, const std::string &labels = "");
+            std::string render();
+
+        private:
+            struct Metric
+            {
+                std::string name;
+                std::string help;
+                std::string labels;
+                METRIC_TYPE type;
+                Counter counter;
+                Gauge gauge;
+                std::unique_ptr<LatencyHistogram> summary;
+            };
+
+            MetricsRegistry() = default;
+            Metric *findOrAdd(const std::string &name, const std::string &help, const std::string &labels, METRIC_TYPE type);
+
+            std::mutex mMetricsMutex; // Guards mMetrics, only taken to register and to render
+            std::vector<std::unique_ptr<Metric>> mMetrics;
+        };
+
+        /**
+         * @brief Serves the registry on a Unix domain socket: every connection gets one rendering and is closed.
+         */
+        class MetricsServer
+        {
+        public:
+            MetricsServer();
+            ~MetricsServer();
+            int start(const std::string &path = METRICS_SOCKET_PATH);
+            void stop();
+
+        private:
+            void run();
+            void serve(int clientFd);
+
+            std::string mPath;
+            int mListenFd;
+            int mShutdownEventFd; // Signalled by stop()
+            std::thread mServerThread;
+        };
+    }
+}
+#endif // METRICS_REGISTRY_HPP
@@ -1,5 +1,7 @@
 #ifndef MODEL_PROCESSOR_HPP
 #define MODEL_PROCESSOR_HPP
+#include <cstddef>
+#include <cstdint>
 #include <vector>
 #include <string>
 #include <algorithm>
@@ -69,6 +71,8 @@ namespace camera
         {
             uint32_t noOfBoxes;
             std::vector<BoxPrediction> predictions;
+            // Set once the model has run and its outputs were parsed
+            bool isValid = false;
 
         } DetectionOutput;
 
@@ -88,6 +92,33 @@ namespace camera
 
             virtual int initializeModelInterface() = 0;
             virtual DetectionOutput runModelInterface(uint8_t *inputFrame) = 0;
+            /**
+             * @brief Runs the model on the data already written into getInputBuffer().
+             */
+            virtual DetectionOutput runModelInterface() = 0;
+            /**
+             * @brief Gives direct write access to the model's input buffer so that preprocessing can
+             *        produce the input in place instead of handing over a copy.
+             * @param size Receives the size of the buffer in bytes.
+             * @return Pointer to the input buffer, or nullptr if the model is not loaded.
+             */
+            virtual uint8_t *getInputBuffer(size_t *size) = 0;
+            /**
+             * @brief Runs the model on several inputs, one DetectionOutput per input in the same order.
+             *
+             * Runners that can resize their batch dimension override this to use a single invocation,
+             * the default runs the inputs one after the other.
+             */
+            virtual std::vector<DetectionOutput> runModelInterfaceBatch(const std::vector<uint8_t *> &inputFrames)
+            {
+                std::vector<DetectionOutput> results;
+                results.reserve(inputFrames.size());
+                for (uint8_t *inputFrame : inputFrames)
+                {
+                    results.push_back(runModelInterface(inputFrame));
+                }
+                return results;
+            }
             TensorFormatSettings getTensorPreprocessingParams()
             {
                 return mTensorFormatSettings;
@@ -1,11 +1,31 @@
 #include "MotionEventMetadata.hpp"
 #include "Logger.hpp"
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cstdio>
 #include <sstream>
 
+namespace
+{
+    // Copies rtMessage text into an inline buffer, truncating it if it does not fit
+    void copyText(char *buffer, size_t size, const char *text)
+    {
+        snprintf(buffer, size, "%s", text ? text : "");
+    }
+
+    void formatTimestamp(char *buffer, size_t size, int64_t value)
+    {
+        std::to_chars_result result = std::to_chars(buffer, buffer + size - 1, value);
+        *result.ptr = '\0';
+    }
+}
+
 MotionEventMetadata::MotionEventMetadata()
-    : motionFramePTS(nullptr), event_type(0), motionScore(0.0), motionEventTime(nullptr)
+    : motionFramePTS(-1), event_type(0), tsDelta(0), motionScore(0.0), motionEventTime(0)
 {
+    motionFramePTSText[0] = '\0';
+    motionEventTimeText[0] = '\0';
     memset(&unionBox, 0, sizeof(unionBox));
     memset(&deliveryUnionBox, 0, sizeof(deliveryUnionBox));
     for (auto &box : objectBoxs)
@@ -16,30 +36,13 @@ MotionEventMetadata::MotionEventMetadata()
         box.boundingBoxHeight = INVALID_BBOX_ORD;
     }
 }
-// Custom Copy Assignment Operator for MotionEventMetadata
-MotionEventMetadata &MotionEventMetadata::operator=(const MotionEventMetadata &other)
-{
-    if (this != &other)
-    {
-        motionFramePTS = other.motionFramePTS;
-        event_type = other.event_type;
-        motionScore = other.motionScore;
-        deliveryUnionBox = other.deliveryUnionBox;
-        unionBox = other.unionBox;
-        for (int i = 0; i < UPPER_LIMIT_BLOB_BB; ++i)
-        {
-            objectBoxs[i] = other.objectBoxs[i];
-        }
-        motionEventTime = other.motionEventTime;
-    }
-    return *this;
-}
-
 // Define the reset method
 void MotionEventMetadata::reset()
 {
-    motionFramePTS = nullptr;
+    motionFramePTS = -1;
+    motionFramePTSText[0] = '\0';
     event_type = 0;
+    tsDelta = 0;
     motionScore = 0.0;
     deliveryUnionBox = BoundingBox(); // Reset to default constructed BoundingBox
     unionBox = BoundingBox();         // Reset to default constructed BoundingBox
@@ -50,7 +53,26 @@ void MotionEventMetadata::reset()
         objectBoxs[i] = BoundingBox();
     }
 
-    motionEventTime = nullptr;
+    motionEventTime = 0;
+    motionEventTimeText[0] = '\0';
+}
+
+bool MotionEventMetadata::parseTimestamp(const char *text, int64_t *value)
+{
+    if (!text)
+    {
+        return false;
+    }
+    std::from_chars_result result = std::from_chars(text, text + strlen(text), *value);
+    return result.ec == std::errc();
+}
+
+void MotionEventMetadata::setTimestamps(int64_t framePTS, int64_t eventTime)
+{
+    motionFramePTS = framePTS;
+    motionEventTime = eventTime;
+    formatTimestamp(motionFramePTSText, sizeof(motionFramePTSText), framePTS);
+    formatTimestamp(motionEventTimeText, sizeof(motionEventTimeText), eventTime);
 }
 /**
  * @brief Normalize the bounding box coordinates to the range [0, 1].
@@ -84,10 +106,23 @@ void MotionEventMetadata::parseMessage(MotionEventMetadata *eventMetaData, const
 {
     assert(eventMetaData != nullptr && "eventMetaData should not be NULL");
 
-    rtMessage_GetString(m, "timestamp", &eventMetaData->motionFramePTS);
+    // The strings belong to the message, keep a copy of their text and their value
+    char const *framePTS = nullptr;
+    char const *eventTime = nullptr;
+    rtMessage_GetString(m, "timestamp", &framePTS);
     rtMessage_GetInt32(m, "event_type", &eventMetaData->event_type);
     rtMessage_GetDouble(m, "motionScore", &eventMetaData->motionScore);
-    rtMessage_GetString(m, "currentTime", &eventMetaData->motionEventTime);
+    rtMessage_GetString(m, "currentTime", &eventTime);
+    copyText(eventMetaData->motionFramePTSText, sizeof(eventMetaData->motionFramePTSText), framePTS);
+    copyText(eventMetaData->motionEventTimeText, sizeof(eventMetaData->motionEventTimeText), eventTime);
+    if (!parseTimestamp(framePTS, &eventMetaData->motionFramePTS))
+    {
+        eventMetaData->motionFramePTS = -1;
+    }
+    if (!parseTimestamp(eventTime, &eventMetaData->motionEventTime))
+    {
+        eventMetaData->motionEventTime = 0;
+    }
 
     // Parsing unionBox
     rtMessage_GetInt32(m, "boundingBoxXOrd", &eventMetaData->unionBox.boundingBoxXOrd);
@@ -106,7 +141,7 @@ void MotionEventMetadata::parseMessage(MotionEventMetadata *eventMetaData, const
     // Parsing objectBoxs
     int32_t len = 0;
     rtMessage_GetArrayLength(m, "objectBoxs", &len);
-    for (int32_t i = 0; i < len; ++i)
+    for (int32_t i = 0; i < len && i < UPPER_LIMIT_BLOB_BB; ++i)
     {
         rtMessage bbox;
         rtMessage_GetMessageItem(m, "objectBoxs", i, &bbox);
@@ -123,10 +158,10 @@ void MotionEventMetadata::print() const
     std::ostringstream logMsg;
 
     logMsg << "MotionEventMetadata Log: \n";
-    logMsg << "Motion Frame PTS: " << (motionFramePTS ? motionFramePTS : "null") << "\n";
+    logMsg << "Motion Frame PTS: " << motionFramePTS << "\n";
     logMsg << "Event Type: " << event_type << "\n";
     logMsg << "Motion Score: " << motionScore << "\n";
-    logMsg << "Motion Event Time: " << (motionEventTime ? motionEventTime : "null") << "\n";
+    logMsg << "Motion Event Time: " << motionEventTimeText << "\n";
 
     logMsg << "Union Box: " << unionBox.boundingBoxXOrd << ", "
            << unionBox.boundingBoxYOrd << ", "
@@ -3,12 +3,16 @@
 #include <rtMessage.h>
 #include <rtConnection.h>
 #include <rtLog.h>
+#include <cstdint>
 #include <cstring> // For std::memset
 #include <string>  // For std::string
+#include <type_traits>
 #include <vector>
 // Define the UPPER_LIMIT_BLOB_BB and INVALID_BBOX_ORD appropriately
 constexpr int UPPER_LIMIT_BLOB_BB = 5;
 constexpr int INVALID_BBOX_ORD = -1;
+// Room for the decimal text of a 64 bit timestamp and its terminator
+constexpr size_t METADATA_TIMESTAMP_MAX = 24;
 // #define ENABLE_CLASSIFICATION
 
 /**
@@ -19,6 +23,7 @@ struct Point
 {
     float x; /**< x-coordinate of the point. */
     float y; /**< y-coordinate of the point. */
+    Point() : x(0), y(0) {}
     Point(float x, float y) : x(x), y(y) {}
 };
 
@@ -41,11 +46,11 @@ struct CropSize
 
 struct ScalingParams
 {
-    double scalingFactor;
+    double scaleFactor;
     Point point2f;
     CropSize size;
-    ScalingParams() : scalingFactor(1.0), point2f(), size() {}
-    ScalingParams(double scalingFactor, Point point2f.CropSize size) : scalingFactor(scalingFactor), point2f(point2f), size(size) {}
+    ScalingParams() : scaleFactor(1.0), point2f(), size() {}
+    ScalingParams(double scaleFactor, Point point2f, CropSize size) : scaleFactor(scaleFactor), point2f(point2f), size(size) {}
 };
 /**
  * @struct NormalizedBoundingBox
@@ -89,24 +94,56 @@ struct BoundingBox
     }
 };
 
+/**
+ * @brief Motion metadata of one frame.
+ *
+ * Self-contained and trivially copyable: the timestamps are parsed once into integers and their
+ * text is kept in inline buffers, so nothing points back into the rtMessage it was parsed from and
+ * a copy never allocates.
+ */
 class MotionEventMetadata
 {
 public:
     MotionEventMetadata();
     static void parseMessage(MotionEventMetadata *smInfo, const rtMessage m);
-    MotionEventMetadata &operator=(const MotionEventMetadata &other);
+    /**
+     * @brief Parses a decimal integer as sent in rtMessage strings.
+     * @return false if @p text is null or does not start with a number.
+     */
+    static bool parseTimestamp(const char *text, int64_t *value);
+    // Sets the frame PTS and the event time along with their text
+    void setTimestamps(int64_t framePTS, int64_t eventTime);
     void print() const;
     void reset();
 
-    char const *motionFramePTS;
+    int64_t motionFramePTS; // -1 when the message carried none
     int32_t event_type;
     uint64_t tsDelta;
     double motionScore;
     BoundingBox deliveryUnionBox;
     BoundingBox unionBox;
     BoundingBox objectBoxs[UPPER_LIMIT_BLOB_BB];
-    char const *motionEventTime;
+    int64_t motionEventTime;
+    char motionFramePTSText[METADATA_TIMESTAMP_MAX];
+    char motionEventTimeText[METADATA_TIMESTAMP_MAX];
     std::vector<NormalizedBoundingBox> getNormalizedBoundingBox(float boxFrameWidth = 320.0f, float boxFrameHeight = 240.0f) const;
 };
+static_assert(std::is_trivially_copyable<MotionEventMetadata>::value, "MotionEventMetadata is copied per message");
+
+// Event type of a motion event that can produce a thumbnail
+constexpr int32_t MOTION_EVENT_TYPE = 4;
+
+/**
+ * @brief True for a motion event inside the ROI or DOI, or anywhere when neither is set.
+ * @param motionFlags ROI set (0x08), inside ROI (0x04), DOI set (0x02), inside DOI (0x01).
+ */
+inline bool isQualifiedMotion(int32_t eventType, int motionFlags)
+{
+    bool hasROISet = (motionFlags & 0x08) != 0;
+    bool isInsideROI = (motionFlags & 0x04) != 0;
+    bool hasDOISet = (motionFlags & 0x02) != 0;
+    bool isInsideDOI = (motionFlags & 0x01) != 0;
+    return eventType == MOTION_EVENT_TYPE && ((hasROISet && isInsideROI) || (hasDOISet && isInsideDOI) || (!hasROISet && !hasDOISet));
+}
 
 #endif // MOTION_EVENT_METADATA_H
@@ -8,7 +8,7 @@
 
 using namespace ::camera;
 using namespace ::camera::camera_ml;
-ObjectClassifier::ObjectClassifier(const std::string &modelPath, const std::string device)
+ObjectClassifier::ObjectClassifier(const std::string &modelPath, const std::string device, InferenceEngine *engine) : mInferenceEngine(engine), mLatencyMetric(nullptr)
 {
 #ifdef USE_TVM
     mModelInterface = std::make_unique<TVMRunner>(modelPath, device);
@@ -23,12 +23,87 @@ int ObjectClassifier::intializeObjectClassifier()
 }
 DetectionOutput ObjectClassifier::RunObjectClassifier(uint8_t *inputFrame, int inputWidth, int inputHeight)
 {
-    return mModelInterface->runModelInterface(inputFrame);
+    std::lock_guard<std::mutex> lock(mClassifierMutex);
+    auto start = std::chrono::steady_clock::now();
+    DetectionOutput output = mModelInterface->runModelInterface(inputFrame);
+    recordLatency(start);
+    return output;
+}
+DetectionOutput ObjectClassifier::RunObjectClassifier()
+{
+    std::lock_guard<std::mutex> lock(mClassifierMutex);
+    auto start = std::chrono::steady_clock::now();
+    DetectionOutput output = mModelInterface->runModelInterface();
+    recordLatency(start);
+    return output;
+}
+uint8_t *ObjectClassifier::getInputBuffer(size_t *size)
+{
+    return mModelInterface->getInputBuffer(size);
+}
+std::vector<DetectionOutput> ObjectClassifier::RunObjectClassifierBatch(const std::vector<uint8_t *> &inputFrames)
+{
+    std::lock_guard<std::mutex> lock(mClassifierMutex);
+    auto start = std::chrono::steady_clock::now();
+    std::vector<DetectionOutput> outputs = mModelInterface->runModelInterfaceBatch(inputFrames);
+    recordLatency(start);
+    return outputs;
+}
+std::future<DetectionOutput> ObjectClassifier::RunObjectClassifierAsync(PreprocessFn preprocess)
+{
+    auto job = [this, preprocess = std::move(preprocess)]() -> DetectionOutput
+    {
+        std::lock_guard<std::mutex> lock(mClassifierMutex);
+        size_t size = 0;
+        uint8_t *input = mModelInterface->getInputBuffer(&size);
+        if (input == nullptr || !preprocess(input, size))
+        {
+            return DetectionOutput();
+        }
+        auto start = std::chrono::steady_clock::now();
+        DetectionOutput output = mModelInterface->runModelInterface(input);
+        recordLatency(start);
+        return output;
+    };
+    if (mInferenceEngine == nullptr)
+    {
+        return std::async(std::launch::deferred, std::move(job));
+    }
+    return mInferenceEngine->submit(std::move(job));
+}
+std::future<std::vector<DetectionOutput>> ObjectClassifier::RunObjectClassifierBatchAsync(std::vector<std::shared_ptr<uint8_t[]>> inputFrames)
+{
+    auto job = [this, inputFrames = std::move(inputFrames)]() -> std::vector<DetectionOutput>
+    {
+        std::vector<uint8_t *> inputs;
+        inputs.reserve(inputFrames.size());
+        for (const auto &inputFrame : inputFrames)
+        {
+            inputs.push_back(inputFrame.get());
+        }
+        return RunObjectClassifierBatch(inputs);
+    };
+    if (mInferenceEngine == nullptr)
+    {
+        return std::async(std::launch::deferred, std::move(job));
+    }
+    return mInferenceEngine->submit(std::move(job));
 }
 TensorFormatSettings ObjectClassifier::getTensorPreprocessingParams()
 {
     return mModelInterface->getTensorPreprocessingParams();
 }
+void ObjectClassifier::setLatencyMetric(LatencyHistogram *latency)
+{
+    mLatencyMetric = latency;
+}
+void ObjectClassifier::recordLatency(std::chrono::steady_clock::time_point start)
+{
+    if (mLatencyMetric)
+    {
+        mLatencyMetric->record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+}
 // Sorting using a lambda function
 void ObjectClassifier::sortDetectionsByScore(std::vector<BoxPrediction> &detections)
 {
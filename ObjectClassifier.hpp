@@ -1,7 +1,13 @@
 #ifndef OBJECT_CLASSIFIER_HPP
 #define OBJECT_CLASSIFIER_HPP
 #include "ModelProcessor.hpp"
+#include "InferenceEngine.hpp"
+#include "PipelineTracer.hpp"
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 
@@ -12,16 +18,41 @@ namespace camera
         class ObjectClassifier
         {
         public:
-            ObjectClassifier(const std::string &modelPath, const std::string device);
+            // Writes the model input into the buffer it is given, returns false to skip the run
+            using PreprocessFn = std::function<bool(uint8_t *input, size_t size)>;
+
+            ObjectClassifier(const std::string &modelPath, const std::string device, InferenceEngine *engine = nullptr);
             int intializeObjectClassifier();
             DetectionOutput RunObjectClassifier(uint8_t *inputFrame, int inputWidth, int inputHeight);
+            // Runs the model on the data written into the buffer returned by getInputBuffer()
+            DetectionOutput RunObjectClassifier();
+            uint8_t *getInputBuffer(size_t *size);
+            // Runs all inputs in one batch, results are in input order
+            std::vector<DetectionOutput> RunObjectClassifierBatch(const std::vector<uint8_t *> &inputFrames);
+            /**
+             * @brief Queues preprocessing plus inference on the inference engine.
+             *
+             * @p preprocess runs on the engine worker, with the classifier locked, and writes straight
+             * into the model input. Without an engine the work runs when the future is waited on.
+             */
+            std::future<DetectionOutput> RunObjectClassifierAsync(PreprocessFn preprocess);
+            // Batched variant, the inputs are kept alive until the job is done
+            std::future<std::vector<DetectionOutput>> RunObjectClassifierBatchAsync(std::vector<std::shared_ptr<uint8_t[]>> inputFrames);
             TensorFormatSettings getTensorPreprocessingParams();
+            // Every model run records its duration in microseconds into @p latency
+            void setLatencyMetric(LatencyHistogram *latency);
             static void sortDetectionsByScore(std::vector<BoxPrediction> &detections);
             // Find the detection with the highest score
             static const BoxPrediction &findHighestScoredDetection(const std::vector<BoxPrediction> &detections);
 
         private:
             std::unique_ptr<ModelProcessor> mModelInterface;
+            InferenceEngine *mInferenceEngine;
+            // One run at a time per model, the interpreter and its input buffer are not reentrant
+            std::mutex mClassifierMutex;
+            LatencyHistogram *mLatencyMetric;
+
+            void recordLatency(std::chrono::steady_clock::time_point start);
         };
     }
 }
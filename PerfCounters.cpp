@@ -0,0 +1,146 @@
+#include "PerfCounters.hpp"
+#ifdef ENABLE_PERF_COUNTERS
+#include "Logger.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            const uint64_t kEventConfigs[PERF_EVENT_COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES,
+                                                              PERF_COUNT_HW_BRANCH_MISSES};
+            const char *kEventMetrics[PERF_EVENT_COUNT] = {"surveillance_perf_cycles_total", "surveillance_perf_instructions_total",
+                                                           "surveillance_perf_cache_misses_total", "surveillance_perf_branch_misses_total"};
+            const char *kEventHelp[PERF_EVENT_COUNT] = {"CPU cycles spent in the scope", "Instructions retired in the scope",
+                                                        "Last level cache misses in the scope", "Mispredicted branches in the scope"};
+
+            std::atomic<bool> sOpenFailureLogged(false);
+
+            /**
+             * One group per thread, read with a single read(): the counters of a group are scheduled
+             * together, so the deltas of a scope belong to the same interval. If the PMU has to be
+             * shared the group is multiplexed and the deltas are scaled by enabled/running time.
+             */
+            class ThreadGroup
+            {
+            public:
+                ThreadGroup() : mLastEnabled(0), mLastRunning(0)
+                {
+                    std::memset(mLastRaw, 0, sizeof(mLastRaw));
+                    std::memset(mTotals, 0, sizeof(mTotals));
+                    for (int i = 0; i < PERF_EVENT_COUNT; ++i)
+                    {
+                        mFds[i] = -1;
+                    }
+                    for (int i = 0; i < PERF_EVENT_COUNT; ++i)
+                    {
+                        struct perf_event_attr attr;
+                        std::memset(&attr, 0, sizeof(attr));
+                        attr.size = sizeof(attr);
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.config = kEventConfigs[i];
+                        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                        attr.disabled = (i == 0) ? 1 : 0;
+                        attr.exclude_hv = 1;
+                        int fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, (i == 0) ? -1 : mFds[0], PERF_FLAG_FD_CLOEXEC));
+                        if (fd < 0)
+                        {
+                            if (!sOpenFailureLogged.exchange(true))
+                            {
+                                LOG_ERROR("perf_event_open failed for counter " << i << ": " << strerror(errno) << ", PERF_SCOPE counts nothing");
+                            }
+                            close();
+                            return;
+                        }
+                        mFds[i] = fd;
+                    }
+                    ioctl(mFds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+                    ioctl(mFds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+                }
+                ~ThreadGroup()
+                {
+                    close();
+                }
+
+                bool read(uint64_t values[PERF_EVENT_COUNT])
+                {
+                    if (mFds[0] < 0)
+                    {
+                        return false;
+                    }
+                    // nr, time_enabled, time_running, then one value per counter
+                    uint64_t buffer[3 + PERF_EVENT_COUNT];
+                    if (::read(mFds[0], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)) || buffer[0] != PERF_EVENT_COUNT)
+                    {
+                        return false;
+                    }
+                    uint64_t enabled = buffer[1] - mLastEnabled;
+                    uint64_t running = buffer[2] - mLastRunning;
+                    mLastEnabled = buffer[1];
+                    mLastRunning = buffer[2];
+                    for (int i = 0; i < PERF_EVENT_COUNT; ++i)
+                    {
+                        uint64_t delta = buffer[3 + i] - mLastRaw[i];
+                        mLastRaw[i] = buffer[3 + i];
+                        if (running > 0 && running < enabled)
+                        {
+                            delta = static_cast<uint64_t>(static_cast<double>(delta) * static_cast<double>(enabled) / static_cast<double>(running));
+                        }
+                        // Running totals of scaled deltas, so a scope only needs to subtract
+                        mTotals[i] += delta;
+                        values[i] = mTotals[i];
+                    }
+                    return true;
+                }
+
+            private:
+                void close()
+                {
+                    for (int i = PERF_EVENT_COUNT - 1; i >= 0; --i)
+                    {
+                        if (mFds[i] >= 0)
+                        {
+                            ::close(mFds[i]);
+                            mFds[i] = -1;
+                        }
+                    }
+                }
+
+                int mFds[PERF_EVENT_COUNT];
+                uint64_t mLastRaw[PERF_EVENT_COUNT];
+                uint64_t mTotals[PERF_EVENT_COUNT];
+                uint64_t mLastEnabled;
+                uint64_t mLastRunning;
+            };
+        }
+
+        PerfScopeStats *PerfCounters::stats(const char *scope)
+        {
+            MetricsRegistry &registry = MetricsRegistry::instance();
+            std::string labels = std::string("scope=\"") + scope + "\"";
+            PerfScopeStats *stats = new PerfScopeStats(); // One per call site, kept for the life of the process
+            stats->runs = registry.counter("surveillance_perf_runs_total", "Times the scope was run with counters available", labels);
+            for (int i = 0; i < PERF_EVENT_COUNT; ++i)
+            {
+                stats->events[i] = registry.counter(kEventMetrics[i], kEventHelp[i], labels);
+            }
+            return stats;
+        }
+
+        bool PerfCounters::read(uint64_t values[PERF_EVENT_COUNT])
+        {
+            thread_local ThreadGroup group;
+            return group.read(values);
+        }
+    }
+}
+#endif // ENABLE_PERF_COUNTERS
@@ -0,0 +1,102 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+/*
+ * PERF_SCOPE("name") counts CPU cycles, instructions, cache misses and branch misses from the
+ * statement to the end of the enclosing block, and adds them to the surveillance_perf_* counters
+ * of the metrics registry, labelled scope="name". Cycles per instruction and misses per
+ * instruction tell a memory bound stage from a compute bound one.
+ *
+ * Built only with -DENABLE_PERF_COUNTERS; otherwise PERF_SCOPE expands to nothing.
+ */
+#ifdef ENABLE_PERF_COUNTERS
+
+#include "MetricsRegistry.hpp"
+#include <cstdint>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        typedef enum
+        {
+            PERF_CYCLES,
+            PERF_INSTRUCTIONS,
+            PERF_CACHE_MISSES,
+            PERF_BRANCH_MISSES,
+            PERF_EVENT_COUNT
+        } PERF_EVENT;
+
+        /**
+         * @struct PerfScopeStats
+         * @brief Totals of one named scope, shared by every thread that runs it.
+         */
+        struct PerfScopeStats
+        {
+            Counter *runs;
+            Counter *events[PERF_EVENT_COUNT];
+        };
+
+        /**
+         * @brief Per-thread group of hardware counters opened with perf_event_open.
+         *
+         * The group is opened on the first scope a thread enters and counts that thread only, in
+         * user and kernel mode. Without a PMU, or when perf_event_paranoid forbids it, scopes
+         * count nothing and the failure is logged once.
+         */
+        class PerfCounters
+        {
+        public:
+            // Registers the counters of @p scope, called once per call site
+            static PerfScopeStats *stats(const char *scope);
+            // Current values of the calling thread's group, false if it could not be opened
+            static bool read(uint64_t values[PERF_EVENT_COUNT]);
+        };
+
+        class PerfScope
+        {
+        public:
+            explicit PerfScope(PerfScopeStats *stats) : mStats(stats)
+            {
+                mValid = PerfCounters::read(mStart);
+            }
+            ~PerfScope()
+            {
+                uint64_t end[PERF_EVENT_COUNT];
+                if (!mValid || !PerfCounters::read(end))
+                {
+                    return;
+                }
+                mStats->runs->inc();
+                for (int i = 0; i < PERF_EVENT_COUNT; ++i)
+                {
+                    mStats->events[i]->inc(end[i] - mStart[i]);
+                }
+            }
+            PerfScope(const PerfScope &) = delete;
+            PerfScope &operator=(const PerfScope &) = delete;
+
+        private:
+            PerfScopeStats *mStats;
+            bool mValid;
+            uint64_t mStart[PERF_EVENT_COUNT];
+        };
+    }
+}
+
+#define PERF_CONCAT_INNER(a, b) a##b
+#define PERF_CONCAT(a, b) PERF_CONCAT_INNER(a, b)
+#define PERF_SCOPE(name)                                                                                                      \
+    static ::camera::camera_ml::PerfScopeStats *PERF_CONCAT(perfStats, __LINE__) = ::camera::camera_ml::PerfCounters::stats(name); \
+    ::camera::camera_ml::PerfScope PERF_CONCAT(perfScope, __LINE__)(PERF_CONCAT(perfStats, __LINE__))
+
+#else
+
+#define PERF_SCOPE(name) \
+    do                   \
+    {                    \
+    } while (0)
+
+#endif // ENABLE_PERF_COUNTERS
+
+#endif // PERF_COUNTERS_HPP
@@ -0,0 +1,167 @@
+#include "PipelineTracer.hpp"
+#include "Logger.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            const char *kStageNames[TRACE_STAGE_COUNT] = {"capture", "metadata", "frame copy", "preprocess", "invoke",
+                                                          "postprocess", "ring insert", "delivery decision", "thumbnail encode", "upload"};
+        }
+
+        LatencyHistogram::LatencyHistogram() : mCount(0), mSum(0), mMax(0)
+        {
+            for (auto &bucket : mBuckets)
+            {
+                bucket.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        int LatencyHistogram::bucketOf(uint64_t value)
+        {
+            if (value < HISTOGRAM_LINEAR_LIMIT)
+            {
+                return static_cast<int>(value);
+            }
+            int exponent = 63 - __builtin_clzll(value); // >= 4
+            int sub = static_cast<int>((value >> (exponent - 3)) & (HISTOGRAM_SUB_BUCKETS - 1));
+            return HISTOGRAM_LINEAR_LIMIT + (exponent - 4) * HISTOGRAM_SUB_BUCKETS + sub;
+        }
+
+        uint64_t LatencyHistogram::bucketUpperBound(int bucket)
+        {
+            if (bucket < HISTOGRAM_LINEAR_LIMIT)
+            {
+                return static_cast<uint64_t>(bucket);
+            }
+            int exponent = (bucket - HISTOGRAM_LINEAR_LIMIT) / HISTOGRAM_SUB_BUCKETS + 4;
+            uint64_t sub = static_cast<uint64_t>((bucket - HISTOGRAM_LINEAR_LIMIT) % HISTOGRAM_SUB_BUCKETS);
+            uint64_t width = 1ULL << (exponent - 3);
+            return (1ULL << exponent) + (sub + 1) * width - 1;
+        }
+
+        void LatencyHistogram::record(int64_t value)
+        {
+            if (value < 0)
+            {
+                value = 0;
+            }
+            mBuckets[bucketOf(static_cast<uint64_t>(value))].fetch_add(1, std::memory_order_relaxed);
+            mCount.fetch_add(1, std::memory_order_relaxed);
+            mSum.fetch_add(value, std::memory_order_relaxed);
+            int64_t max = mMax.load(std::memory_order_relaxed);
+            while (value > max && !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed))
+            {
+            }
+        }
+
+        uint64_t LatencyHistogram::count() const
+        {
+            return mCount.load(std::memory_order_relaxed);
+        }
+
+        int64_t LatencyHistogram::sum() const
+        {
+            return mSum.load(std::memory_order_relaxed);
+        }
+
+        int64_t LatencyHistogram::max() const
+        {
+            return mMax.load(std::memory_order_relaxed);
+        }
+
+        int64_t LatencyHistogram::quantile(double quantile) const
+        {
+            uint64_t counts[HISTOGRAM_BUCKETS];
+            uint64_t total = 0;
+            for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+            {
+                counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+                total += counts[i];
+            }
+            if (total == 0)
+            {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(quantile * static_cast<double>(total) + 0.5);
+            rank = rank < 1 ? 1 : (rank > total ? total : rank);
+            uint64_t seen = 0;
+            for (int i = 0; i < HISTOGRAM_BUCKETS; ++i)
+            {
+                seen += counts[i];
+                if (seen >= rank)
+                {
+                    // The bucket bound may overshoot the largest value recorded
+                    int64_t bound = static_cast<int64_t>(bucketUpperBound(i));
+                    return bound < max() ? bound : max();
+                }
+            }
+            return max();
+        }
+
+        PipelineTracer &PipelineTracer::instance()
+        {
+            static PipelineTracer tracer;
+            return tracer;
+        }
+
+        size_t PipelineTracer::slotOf(int64_t pts)
+        {
+            // PTS advance in large fixed steps, mix them before taking the low bits
+            return static_cast<size_t>((static_cast<uint64_t>(pts) * 0x9E3779B97F4A7C15ULL) >> 32) & (TRACE_CAPTURE_SLOTS - 1);
+        }
+
+        void PipelineTracer::capture(int64_t pts)
+        {
+            if (pts < 0)
+            {
+                return;
+            }
+            CaptureSlot &slot = mCaptures[slotOf(pts)];
+            // A reader matching the PTS sees its time, a slot being reused is at worst matched to the older capture
+            slot.pts.store(-1, std::memory_order_relaxed);
+            slot.timeNs.store(nowNs(), std::memory_order_release);
+            slot.pts.store(pts, std::memory_order_release);
+        }
+
+        void PipelineTracer::mark(TraceStage stage, int64_t pts)
+        {
+            if (pts < 0)
+            {
+                return;
+            }
+            const CaptureSlot &slot = mCaptures[slotOf(pts)];
+            if (slot.pts.load(std::memory_order_acquire) != pts)
+            {
+                return;
+            }
+            int64_t captureNs = slot.timeNs.load(std::memory_order_acquire);
+            mSinceCapture[stage].record((nowNs() - captureNs) / 1000);
+        }
+
+        void PipelineTracer::record(TraceStage stage, int64_t durationUs, int64_t pts)
+        {
+            mDuration[stage].record(durationUs);
+            mark(stage, pts);
+        }
+
+        void PipelineTracer::report()
+        {
+            for (int stage = 0; stage < TRACE_STAGE_COUNT; ++stage)
+            {
+                const LatencyHistogram &duration = mDuration[stage];
+                const LatencyHistogram &sinceCapture = mSinceCapture[stage];
+                if (duration.count() == 0 && sinceCapture.count() == 0)
+                {
+                    continue;
+                }
+                LOG_INFO("Trace " << kStageNames[stage] << ": " << duration.count() << " runs, took p50/p90/p99/max " << duration.quantile(0.5) << "/"
+                                  << duration.quantile(0.9) << "/" << duration.quantile(0.99) << "/" << duration.max() << " us; " << sinceCapture.count()
+                                  << " matched, after capture p50/p90/p99/max " << sinceCapture.quantile(0.5) << "/" << sinceCapture.quantile(0.9) << "/"
+                                  << sinceCapture.quantile(0.99) << "/" << sinceCapture.max() << " us");
+            }
+        }
+    }
+}
@@ -0,0 +1,122 @@
+#ifndef PIPELINE_TRACER_HPP
+#define PIPELINE_TRACER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <ctime>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        typedef enum
+        {
+            TRACE_CAPTURE,           // CAPTURE message handled, the frame read when the policy reads eagerly
+            TRACE_METADATA,          // Motion metadata of the frame arrived
+            TRACE_FRAME_COPY,        // Frame copied from the camera buffer into a pool slot
+            TRACE_PREPROCESS,        // Crop, resize and quantise into a model input
+            TRACE_INVOKE,            // Model invoke
+            TRACE_POSTPROCESS,       // Predictions filtered down to the best one
+            TRACE_RING_INSERT,       // Person candidate queued for the delivery model
+            TRACE_DELIVERY_DECISION, // Delivery model run over the queued candidates
+            TRACE_THUMBNAIL_ENCODE,  // Thumbnail candidate encoded to JPEG
+            TRACE_UPLOAD,            // Thumbnail upload acknowledged
+            TRACE_STAGE_COUNT
+        } TraceStage;
+
+        // Capture times kept for matching later stages by PTS, about a minute of frames at 15 fps
+        constexpr size_t TRACE_CAPTURE_SLOTS = 1024;
+        // Values below this are counted exactly, above it in 8 sub-buckets per power of two (at most 12.5% error)
+        constexpr int HISTOGRAM_LINEAR_LIMIT = 16;
+        constexpr int HISTOGRAM_SUB_BUCKETS = 8;
+        constexpr int HISTOGRAM_BUCKETS = HISTOGRAM_LINEAR_LIMIT + (64 - 4) * HISTOGRAM_SUB_BUCKETS;
+
+        /**
+         * @brief Log-linear histogram of non-negative values, recorded lock free from any thread.
+         */
+        class LatencyHistogram
+        {
+        public:
+            LatencyHistogram();
+            void record(int64_t value);
+            uint64_t count() const;
+            int64_t sum() const;
+            int64_t max() const;
+            // Upper bound of the bucket holding the @p quantile (0..1) of the recorded values, 0 if empty
+            int64_t quantile(double quantile) const;
+
+        private:
+            static int bucketOf(uint64_t value);
+            static uint64_t bucketUpperBound(int bucket);
+
+            std::atomic<uint64_t> mBuckets[HISTOGRAM_BUCKETS];
+            std::atomic<uint64_t> mCount;
+            std::atomic<int64_t> mSum;
+            std::atomic<int64_t> mMax;
+        };
+
+        /**
+         * @brief Per-stage latency of the pipeline, keyed by frame PTS.
+         *
+         * Every stage has two histograms: how long the stage took, and how long after the CAPTURE
+         * of the same PTS it completed. capture() stamps the CAPTURE time on the monotonic clock;
+         * later stages are matched to it by PTS. Stages that run without a known PTS only feed the
+         * duration histogram.
+         */
+        class PipelineTracer
+        {
+        public:
+            static PipelineTracer &instance();
+            static int64_t nowNs()
+            {
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                return static_cast<int64_t>(now.tv_sec) * 1000000000LL + now.tv_nsec;
+            }
+
+            void capture(int64_t pts);
+            // Stage completed now for @p pts, without a duration of its own
+            void mark(TraceStage stage, int64_t pts);
+            // Stage took @p durationUs and completed now; @p pts < 0 if not known
+            void record(TraceStage stage, int64_t durationUs, int64_t pts = -1);
+            // Logs count and p50/p90/p99/max of each stage that has been recorded
+            void report();
+
+        private:
+            struct CaptureSlot
+            {
+                std::atomic<int64_t> pts{-1};
+                std::atomic<int64_t> timeNs{0};
+            };
+
+            PipelineTracer() = default;
+            static size_t slotOf(int64_t pts);
+
+            CaptureSlot mCaptures[TRACE_CAPTURE_SLOTS];
+            LatencyHistogram mDuration[TRACE_STAGE_COUNT];
+            LatencyHistogram mSinceCapture[TRACE_STAGE_COUNT];
+        };
+
+        /**
+         * @brief Records the time from construction to destruction as the duration of a stage.
+         */
+        class TraceScope
+        {
+        public:
+            explicit TraceScope(TraceStage stage, int64_t pts = -1) : mStage(stage), mPts(pts), mStartNs(PipelineTracer::nowNs()) {}
+            ~TraceScope()
+            {
+                PipelineTracer::instance().record(mStage, (PipelineTracer::nowNs() - mStartNs) / 1000, mPts);
+            }
+            TraceScope(const TraceScope &) = delete;
+            TraceScope &operator=(const TraceScope &) = delete;
+
+        private:
+            TraceStage mStage;
+            int64_t mPts;
+            int64_t mStartNs;
+        };
+    }
+}
+#endif // PIPELINE_TRACER_HPP
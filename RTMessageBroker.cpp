@@ -1,20 +1,73 @@
 #include "RTMessageBroker.hpp"
-#include <sstream>
 #include <chrono>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 namespace camera
 {
     namespace camera_ml
     {
+        namespace
+        {
+            struct TopicHandler
+            {
+                const char *topic;
+                void (*handler)(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
+            };
+
+            // Indexed by RT_TOPIC
+            const TopicHandler kTopicHandlers[RT_TOPIC_MAX] = {
+                {"RDKC.SMARTTN.CAPTURE", RTMessageBroker::onMsgCaptureFrame},
+                {"RDKC.SMARTTN.METADATA", RTMessageBroker::onMsgProcessFrame},
+                {"RDKC.CVR.CLIP.STATUS", RTMessageBroker::onMsgCvr},
+                {"RDKC.CVR.UPLOAD.STATUS", RTMessageBroker::onMsgCvrUpload},
+                {"RDKC.SMARTTN.METRICS", RTMessageBroker::onMsgMetrics},
+                {"RDKC.SMARTTN.FLIGHTDUMP", RTMessageBroker::onMsgFlightDump},
+            };
+
+            int64_t elapsedUs(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+            {
+                return std::chrono::duration_cast<std::chrono::microseconds>(to - from).count();
+            }
+
+            BoundingBox toBoundingBox(const MetadataBox &box)
+            {
+                BoundingBox boundingBox;
+                boundingBox.boundingBoxXOrd = box.x;
+                boundingBox.boundingBoxYOrd = box.y;
+                boundingBox.boundingBoxWidth = box.width;
+                boundingBox.boundingBoxHeight = box.height;
+                return boundingBox;
+            }
+
+            static_assert(METADATA_RING_MAX_BLOBS == UPPER_LIMIT_BLOB_BB, "Ring record and metadata disagree on the blob count");
+        }
+
         RTMessageBroker::RTMessageBroker(SurveillanceSystem *surveillance)
-            : surveillanceRef(surveillance)
+            : surveillanceRef(surveillance), mTerm(false), mQueue(new QueuedMessage[RT_QUEUE_SLOTS]), mQueueHead(0), mQueueCount(0), mRingActive(false)
         {
-            mTerm = false;
-            // Constructor implementation (if needed)
+            mQueueEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            mShutdownEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (mQueueEventFd < 0 || mShutdownEventFd < 0)
+            {
+                LOG_ERROR("Failed to create the dispatch eventfds: " << strerror(errno));
+            }
         }
         RTMessageBroker::~RTMessageBroker()
         {
+            stop();
             rtConnection_Destroy(connectionSend);
             rtConnection_Destroy(connectionRecv);
+            if (mQueueEventFd >= 0)
+            {
+                close(mQueueEventFd);
+            }
+            if (mShutdownEventFd >= 0)
+            {
+                close(mShutdownEventFd);
+            }
         }
 
         int RTMessageBroker::rtMsgInit()
@@ -23,13 +76,180 @@ namespace camera
             rtLog_SetOption(rdkLog);
             rtConnection_Create(&connectionSend, "SMART_TN_SEND", "tcp://127.0.0.1:10001");
             rtConnection_Create(&connectionRecv, "SMART_TN_RECV", "tcp://127.0.0.1:10001");
-            rtConnection_AddListener(connectionRecv, "RDKC.SMARTTN.CAPTURE", onMsgCaptureFrame, this);
-            rtConnection_AddListener(connectionRecv, "RDKC.SMARTTN.METADATA", onMsgProcessFrame, this);
-            rtConnection_AddListener(connectionRecv, "RDKC.CVR.CLIP.STATUS", onMsgCvr, this);
-            rtConnection_AddListener(connectionRecv, "RDKC.CVR.UPLOAD.STATUS", onMsgCvrUpload, this);
+            // The listeners only queue the message, the handlers run on the dispatch thread
+            for (const TopicHandler &topicHandler : kTopicHandlers)
+            {
+                rtConnection_AddListener(connectionRecv, topicHandler.topic, onMsgQueued, this);
+            }
             return 0;
         }
 
+        int RTMessageBroker::start()
+        {
+            if (mDispatchThread.joinable())
+            {
+                return 0;
+            }
+            if (mQueueEventFd < 0 || mShutdownEventFd < 0)
+            {
+                LOG_ERROR("Dispatch thread not started, eventfds are missing");
+                return -1;
+            }
+            mTerm = false;
+            mDispatchThread = std::thread(&RTMessageBroker::receiveRtmessage, this);
+            mRingThread = std::thread(&RTMessageBroker::consumeMetadataRing, this);
+            return 0;
+        }
+
+        void RTMessageBroker::stop()
+        {
+            if (!mDispatchThread.joinable())
+            {
+                return;
+            }
+            mTerm = true;
+            uint64_t one = 1;
+            if (write(mShutdownEventFd, &one, sizeof(one)) != sizeof(one))
+            {
+                LOG_ERROR("Failed to signal the dispatch thread: " << strerror(errno));
+            }
+            mDispatchThread.join();
+            if (mRingThread.joinable())
+            {
+                mRingThread.join();
+            }
+            printStats();
+        }
+
+        /**
+         * Runs on the rtConnection reader thread: copies the message into a free queue slot and wakes
+         * the dispatch thread. Nothing here waits on the surveillance system.
+         */
+        void RTMessageBroker::onMsgQueued(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure)
+        {
+            RTMessageBroker *self = static_cast<RTMessageBroker *>(closure);
+            if (!self || !hdr)
+            {
+                return;
+            }
+            int topic = 0;
+            while (topic < RT_TOPIC_MAX && strcmp(hdr->topic, kTopicHandlers[topic].topic) != 0)
+            {
+                ++topic;
+            }
+            if (topic == RT_TOPIC_MAX)
+            {
+                LOG_ERROR("Message on unexpected topic " << hdr->topic);
+                return;
+            }
+            bool dropped = false;
+            size_t queued = 0;
+            {
+                std::lock_guard<std::mutex> lock(self->mQueueMutex);
+                if (self->mQueueCount == RT_QUEUE_SLOTS || n > RT_MESSAGE_SLOT_SIZE)
+                {
+                    self->mTopicStats[topic].dropped++;
+                    queued = self->mQueueCount;
+                    dropped = true;
+                }
+                else
+                {
+                    QueuedMessage &slot = self->mQueue[(self->mQueueHead + self->mQueueCount) % RT_QUEUE_SLOTS];
+                    slot.topic = static_cast<RT_TOPIC>(topic);
+                    slot.size = n;
+                    slot.enqueueTime = std::chrono::steady_clock::now();
+                    std::memcpy(slot.data, buff, n);
+                    self->mQueueCount++;
+                }
+            }
+            if (dropped)
+            {
+                // Logged outside mQueueMutex, an error may wait for room in the log ring
+                LOG_ERROR("Dropping message on " << hdr->topic << " (" << n << " bytes, " << queued << " queued)");
+                return;
+            }
+            uint64_t one = 1;
+            if (write(self->mQueueEventFd, &one, sizeof(one)) != sizeof(one))
+            {
+                LOG_ERROR("Failed to wake the dispatch thread: " << strerror(errno));
+            }
+        }
+
+        // The slot at the head stays owned by the dispatch thread until pop(), the reader only fills free slots
+        RTMessageBroker::QueuedMessage *RTMessageBroker::peek()
+        {
+            std::lock_guard<std::mutex> lock(mQueueMutex);
+            return (mQueueCount > 0) ? &mQueue[mQueueHead] : nullptr;
+        }
+
+        void RTMessageBroker::pop()
+        {
+            std::lock_guard<std::mutex> lock(mQueueMutex);
+            mQueueHead = (mQueueHead + 1) % RT_QUEUE_SLOTS;
+            mQueueCount--;
+        }
+
+        void RTMessageBroker::dispatch(const QueuedMessage &message)
+        {
+            auto start = std::chrono::steady_clock::now();
+            kTopicHandlers[message.topic].handler(nullptr, message.data, message.size, this);
+            auto end = std::chrono::steady_clock::now();
+
+            int64_t queueDelayUs = elapsedUs(message.enqueueTime, start);
+            int64_t handlerUs = elapsedUs(start, end);
+            TopicStats &stats = mTopicStats[message.topic];
+            stats.count++;
+            stats.queueDelayTotalUs += queueDelayUs;
+            stats.queueDelayMaxUs = std::max(stats.queueDelayMaxUs, queueDelayUs);
+            stats.handlerTotalUs += handlerUs;
+            stats.handlerMaxUs = std::max(stats.handlerMaxUs, handlerUs);
+            LOG_DEBUG(kTopicHandlers[message.topic].topic << " queued " << queueDelayUs << " us, handled in " << handlerUs << " us");
+        }
+
+        /**
+         * Hands the best metadata of the window that just closed to the surveillance system. Called by
+         * both the dispatch thread and the ring thread; the lock keeps windows in order and
+         * processFrameMetaData on one thread at a time.
+         */
+        void RTMessageBroker::processCoalescedMetadata()
+        {
+            std::lock_guard<std::mutex> lock(mMetadataDispatchMutex);
+            MotionEventMetadata metaData;
+            int motionFlags = 0;
+            if (mMetadataCoalescer.take(&metaData, &motionFlags))
+            {
+                surveillanceRef->processFrameMetaData(metaData, motionFlags);
+            }
+        }
+
+        void RTMessageBroker::printStats()
+        {
+            for (int topic = 0; topic < RT_TOPIC_MAX; ++topic)
+            {
+                TopicStats stats;
+                {
+                    // dropped is updated by the reader thread under the queue lock
+                    std::lock_guard<std::mutex> lock(mQueueMutex);
+                    stats = mTopicStats[topic];
+                }
+                if (stats.count == 0 && stats.dropped == 0)
+                {
+                    continue;
+                }
+                LOG_INFO(kTopicHandlers[topic].topic << ": " << stats.count << " msgs, " << stats.dropped << " dropped, queue delay avg/max "
+                                                     << (stats.count ? stats.queueDelayTotalUs / static_cast<int64_t>(stats.count) : 0) << "/" << stats.queueDelayMaxUs
+                                                     << " us, handler avg/max " << (stats.count ? stats.handlerTotalUs / static_cast<int64_t>(stats.count) : 0) << "/"
+                                                     << stats.handlerMaxUs << " us");
+            }
+            CoalescerStats coalescerStats = mMetadataCoalescer.stats();
+            if (coalescerStats.received > 0)
+            {
+                LOG_INFO("Metadata: " << coalescerStats.received << " received, " << coalescerStats.coalesced << " coalesced, " << coalescerStats.dropped
+                                      << " dropped, " << coalescerStats.windows << " processed");
+            }
+            PipelineTracer::instance().report();
+        }
+
         void RTMessageBroker::onMsgCaptureFrame(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure)
         {
             RTMessageBroker *self = static_cast<RTMessageBroker *>(closure);
@@ -40,13 +260,20 @@ namespace camera
             rtMessage m;
             rtMessage_FromBytes(&m, buff, n);
             int processPID;
-            char const *strFramePTS;
+            char const *strFramePTS = nullptr;
             rtMessage_GetInt32(m, "processID", &processPID);
             rtMessage_GetString(m, "timestamp", &strFramePTS);
-            long long lResFramePTS;
-            std::istringstream iss(strFramePTS);
-            iss >> lResFramePTS;
-            self->surveillanceRef->captureFrame(lResFramePTS);
+            int64_t framePTS;
+            if (MotionEventMetadata::parseTimestamp(strFramePTS, &framePTS))
+            {
+                PipelineTracer::instance().capture(framePTS);
+                TraceScope trace(TRACE_CAPTURE, framePTS);
+                self->surveillanceRef->captureFrame(framePTS);
+            }
+            else
+            {
+                LOG_ERROR("Capture request without a valid timestamp");
+            }
             rtMessage_Release(m);
             return;
         }
@@ -58,13 +285,19 @@ namespace camera
             {
                 return; // Error handling if self is nullptr
             }
+            if (self->mRingActive)
+            {
+                return; // The same event is delivered through the metadata ring
+            }
             rtMessage m;
             rtMessage_FromBytes(&m, buff, n);
             MotionEventMetadata metaData;
             MotionEventMetadata::parseMessage(&metaData, m);
-            int motionFlags;
+            int motionFlags = 0;
             rtMessage_GetInt32(m, "motionFlags", &motionFlags);
-            self->surveillanceRef->processFrameMetaData(metaData, motionFlags);
+            PipelineTracer::instance().mark(TRACE_METADATA, metaData.motionFramePTS);
+            // Processed once the dispatch window closes, see processCoalescedMetadata()
+            self->mMetadataCoalescer.push(metaData, motionFlags);
             rtMessage_Release(m);
             return;
         }
@@ -103,26 +336,156 @@ namespace camera
         void RTMessageBroker::onMsgCvrUpload(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure)
         {
         }
+        // Any message on the topic is a request, the reply goes out on RDKC.SMARTTN.METRICS.STATUS
+        void RTMessageBroker::onMsgMetrics(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure)
+        {
+            RTMessageBroker *self = static_cast<RTMessageBroker *>(closure);
+            if (!self)
+            {
+                return; // Error handling if self is nullptr
+            }
+            self->notifyMetrics();
+        }
+        // Any message on the topic is a request; the dump always goes to FLIGHT_RECORDER_DUMP_PATH, a bus client does not pick the file.
+        // The main loop writes it, the file IO would otherwise hold up the dispatch thread
+        void RTMessageBroker::onMsgFlightDump(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure)
+        {
+            RTMessageBroker *self = static_cast<RTMessageBroker *>(closure);
+            if (!self)
+            {
+                return; // Error handling if self is nullptr
+            }
+            FlightRecorder::requestDump();
+        }
         void RTMessageBroker::onMsgRefresh(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure)
         {
         }
+        /**
+         * Dispatch loop: blocks until a message is queued or stop() is called, then runs the handlers
+         * of everything queued. Latency stats are logged every RT_STATS_INTERVAL_MS.
+         */
         int RTMessageBroker::receiveRtmessage()
         {
-            rtError err;
-            while (mTerm)
+            struct pollfd fds[2];
+            fds[0].fd = mQueueEventFd;
+            fds[0].events = POLLIN;
+            fds[1].fd = mShutdownEventFd;
+            fds[1].events = POLLIN;
+            auto lastStats = std::chrono::steady_clock::now();
+            while (!mTerm)
             {
-                err = rtConnection_Dispatch(connectionRecv);
-                if (err != RT_OK)
+                int ret = poll(fds, 2, RT_STATS_INTERVAL_MS);
+                if (ret < 0)
                 {
-                    // rtLog_Debug("dispatch:%s", rtStrError(err));
-                    LOG_INFO("dispatch:" << rtStrError(err));
-                    LOG_INFO("Error receiving msg via rtmessage\n");
+                    if (errno == EINTR)
+                    {
+                        continue;
+                    }
+                    LOG_ERROR("poll failed: " << strerror(errno));
+                    break;
+                }
+                if (fds[1].revents & POLLIN)
+                {
+                    break;
+                }
+                if (fds[0].revents & POLLIN)
+                {
+                    uint64_t counter;
+                    if (read(mQueueEventFd, &counter, sizeof(counter)) < 0 && errno != EAGAIN)
+                    {
+                        LOG_ERROR("Failed to read the queue eventfd: " << strerror(errno));
+                    }
+                    while (QueuedMessage *message = peek())
+                    {
+                        // A capture request closes the window, so lazily captured frames are still read for the metadata before it
+                        if (message->topic == RT_TOPIC_CAPTURE)
+                        {
+                            processCoalescedMetadata();
+                        }
+                        dispatch(*message);
+                        pop();
+                    }
+                    processCoalescedMetadata();
+                }
+                auto now = std::chrono::steady_clock::now();
+                if (now - lastStats >= std::chrono::milliseconds(RT_STATS_INTERVAL_MS))
+                {
+                    printStats();
+                    lastStats = now;
                 }
-                std::this_thread::sleep_for(std::chrono::seconds(1)); // Sleep to reduce CPU usage
             }
             LOG_INFO("Exit rtMessage listening loop .\n");
             return 0;
         }
+        /**
+         * Metadata ring consumer: maps the ring once xVision has created it and feeds its records to
+         * the surveillance system, one coalesced candidate per batch read. Until then, or after the producer goes away, metadata keeps coming
+         * through the rtMessage topic.
+         */
+        void RTMessageBroker::consumeMetadataRing()
+        {
+            uint64_t received = 0;
+            int64_t latencyTotalUs = 0;
+            int64_t latencyMaxUs = 0;
+            auto lastStats = std::chrono::steady_clock::now();
+            while (!mTerm)
+            {
+                if (!mMetadataRing.isOpen())
+                {
+                    if (mMetadataRing.open() != 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(RT_RING_WAIT_MS));
+                        continue;
+                    }
+                    mRingActive = true;
+                    LOG_INFO("Metadata ring " << METADATA_RING_NAME << " mapped, rtMessage metadata ignored");
+                }
+                MetadataRecord record;
+                if (mMetadataRing.consume(&record, RT_RING_WAIT_MS))
+                {
+                    // Everything already in the ring belongs to the same window
+                    do
+                    {
+                        int64_t latencyUs = (MetadataRing::monotonicNs() - record.publishTimeNs) / 1000;
+                        received++;
+                        latencyTotalUs += latencyUs;
+                        latencyMaxUs = std::max(latencyMaxUs, latencyUs);
+
+                        MotionEventMetadata metaData;
+                        metaData.setTimestamps(record.framePTS, record.eventTime);
+                        metaData.event_type = record.eventType;
+                        metaData.motionScore = record.motionScore;
+                        metaData.unionBox = toBoundingBox(record.unionBox);
+#ifdef ENABLE_CLASSIFICATION
+                        metaData.deliveryUnionBox = toBoundingBox(record.deliveryUnionBox);
+#endif
+                        for (int i = 0; i < record.blobCount && i < UPPER_LIMIT_BLOB_BB; ++i)
+                        {
+                            metaData.objectBoxs[i] = toBoundingBox(record.blobs[i]);
+                        }
+                        PipelineTracer::instance().mark(TRACE_METADATA, metaData.motionFramePTS);
+                        mMetadataCoalescer.push(metaData, record.motionFlags);
+                    } while (mMetadataRing.consume(&record, 0));
+                    processCoalescedMetadata();
+                }
+                else if (mMetadataRing.isStale())
+                {
+                    LOG_INFO("Metadata ring producer went away, falling back to rtMessage");
+                    mRingActive = false;
+                    mMetadataRing.close();
+                }
+                auto now = std::chrono::steady_clock::now();
+                if (now - lastStats >= std::chrono::milliseconds(RT_STATS_INTERVAL_MS) && received > 0)
+                {
+                    LOG_INFO("Metadata ring: " << received << " records, " << mMetadataRing.dropped() << " dropped by the producer, latency avg/max "
+                                               << latencyTotalUs / static_cast<int64_t>(received) << "/" << latencyMaxUs << " us");
+                    lastStats = now;
+                }
+            }
+            mRingActive = false;
+            mMetadataRing.close();
+        }
+
         int RTMessageBroker::notify(const char *status)
         {
             if (!status)
@@ -142,5 +505,21 @@ namespace camera
             rtMessage_Release(req);
             return 0;
         }
+
+        int RTMessageBroker::notifyMetrics()
+        {
+            std::string metrics = MetricsRegistry::instance().render();
+            rtMessage req;
+            rtMessage_Create(&req);
+            rtMessage_SetString(req, "metrics", metrics.c_str());
+            rtError err = rtConnection_SendMessage(connectionSend, req, "RDKC.SMARTTN.METRICS.STATUS");
+            rtLog_Debug("SendRequest:%s", rtStrError(err));
+            if (err != RT_OK)
+            {
+                LOG_ERROR("Error sending metrics via rtmessage");
+            }
+            rtMessage_Release(req);
+            return (err == RT_OK) ? 0 : -1;
+        }
     }
 }
\ No newline at end of file
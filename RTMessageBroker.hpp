@@ -2,32 +2,111 @@
 #define RTMESSAGEBROKER_HPP
 
 #include "SurveillanceSystem.hpp"
+#include "MetadataRing.hpp"
+#include "MetadataCoalescer.hpp"
 #include <rtMessage.h>
 #include <rtConnection.h>
 #include <rtLog.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
 
 namespace camera
 {
     namespace camera_ml
     {
+        // Messages waiting for the dispatch thread, and the largest message a slot holds.
+        constexpr size_t RT_QUEUE_SLOTS = 64;
+        constexpr size_t RT_MESSAGE_SLOT_SIZE = 4096;
+        // Interval at which the per topic latency stats are logged.
+        constexpr int RT_STATS_INTERVAL_MS = 60000;
+        // How long the metadata ring consumer waits for a record before checking for shutdown or a restarted producer.
+        constexpr int RT_RING_WAIT_MS = 500;
+
+        typedef enum
+        {
+            RT_TOPIC_CAPTURE = 0,
+            RT_TOPIC_METADATA,
+            RT_TOPIC_CLIP_STATUS,
+            RT_TOPIC_UPLOAD_STATUS,
+            RT_TOPIC_METRICS,
+            RT_TOPIC_FLIGHT_DUMP,
+            RT_TOPIC_MAX
+        } RT_TOPIC;
+
+        /**
+         * @struct TopicStats
+         * @brief Queueing delay (listener to dispatch) and handler time of one topic, in microseconds.
+         */
+        struct TopicStats
+        {
+            uint64_t count;
+            uint64_t dropped;
+            int64_t queueDelayTotalUs;
+            int64_t queueDelayMaxUs;
+            int64_t handlerTotalUs;
+            int64_t handlerMaxUs;
+            TopicStats() : count(0), dropped(0), queueDelayTotalUs(0), queueDelayMaxUs(0), handlerTotalUs(0), handlerMaxUs(0) {}
+        };
+
         class RTMessageBroker
         {
         private:
+            struct QueuedMessage
+            {
+                RT_TOPIC topic;
+                uint32_t size;
+                std::chrono::steady_clock::time_point enqueueTime;
+                uint8_t data[RT_MESSAGE_SLOT_SIZE];
+            };
+
             rtConnection connectionSend;
             rtConnection connectionRecv;
             SurveillanceSystem *surveillanceRef; // Reference to Surveillance instance
-            bool mTerm;
+            std::atomic<bool> mTerm;             // Set to stop the dispatch thread
+            std::thread mDispatchThread;
+            int mQueueEventFd;    // Signalled when a message is queued
+            int mShutdownEventFd; // Signalled by stop()
+            std::mutex mQueueMutex;
+            std::unique_ptr<QueuedMessage[]> mQueue;
+            size_t mQueueHead;
+            size_t mQueueCount;
+            TopicStats mTopicStats[RT_TOPIC_MAX];
+            // Metadata published by xVision in shared memory; while it is mapped the rtMessage metadata topic is ignored
+            MetadataRing mMetadataRing;
+            std::atomic<bool> mRingActive;
+            std::thread mRingThread;
+            // Metadata from either source waits here until its dispatch window closes
+            MetadataCoalescer mMetadataCoalescer;
+            std::mutex mMetadataDispatchMutex; // Serializes processCoalescedMetadata()
+
+            static void onMsgQueued(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
+            QueuedMessage *peek();
+            void pop();
+            void dispatch(const QueuedMessage &message);
+            void printStats();
+            void consumeMetadataRing();
+            void processCoalescedMetadata();
+
         public:
             RTMessageBroker(SurveillanceSystem *surveillance);
             ~RTMessageBroker();
 
             int rtMsgInit();
+            // Starts and stops the thread that runs the message handlers
+            int start();
+            void stop();
             int receiveRtmessage();
             int notify(const char* status);
+            // Publishes the MetricsRegistry rendering on the metrics status topic
+            int notifyMetrics();
             static void onMsgCaptureFrame(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
             static void onMsgProcessFrame(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
             static void onMsgCvr(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
             static void onMsgCvrUpload(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
+            static void onMsgMetrics(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
+            static void onMsgFlightDump(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
             static void onMsgRefresh(rtMessageHeader const *hdr, uint8_t const *buff, uint32_t n, void *closure);
         };
     }
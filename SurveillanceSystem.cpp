@@ -1,4 +1,5 @@
 #include "SurveillanceSystem.hpp"
+#include <fstream>
 #include <sys/stat.h>
 #include <sys/types.h>
 using namespace ::std;
@@ -12,41 +13,170 @@ namespace camera
         {
             mCameraFrameHandler = std::make_unique<CameraFrameHandler>(bufferId);
             mThumbnailGenerater = std::make_unique<ThumbnailGenerater>(mCameraFrameHandler.get(), eventProps);
+            mFramePool = std::make_unique<FramePool>(FRAME_POOL_SLOTS);
             start_detection_time = std::chrono::high_resolution_clock::time_point::min();
             cachedFrame = 0;
             processedFrame = 0;
+            skippedFrame = 0;
+            droppedFrame = 0;
+            missedFrame = 0;
+            mCapturePolicy = CAPTURE_LAZY;
+            mPrefetchDepth = CAPTURE_PREFETCH_DEPTH;
+            mPrefetchBudget = 0;
+            mPendingCapturePTS = -1;
+            initMetrics();
         }
 #ifdef ENABLE_CLASSIFICATION
         SurveillanceSystem::SurveillanceSystem(int bufferId, const std::string &personModelPath, const std::string &deliveryModelPath, const std::string &eventProps, const std::string &device)
             : mMotionPayload(), mSurveillanceFrame(), mObjectClassificationFrame(), mROI(), mDeliveryModelParams(), mPersonModelParams(), classifyObj(false), keepRunning(true), motionDetected(false), mRawFrameInfo(nullptr)
         {
-            SurveillanceFrame(bufferId, eventProps);
-            mPersonClassifier = std::make_unique<ObjectClassifier>(personModelPath, device);
-            mDeliveryClassifier = std::make_unique<ObjectClassifier>(deliveryModelPath, device);
+            mCameraFrameHandler = std::make_unique<CameraFrameHandler>(bufferId);
+            mThumbnailGenerater = std::make_unique<ThumbnailGenerater>(mCameraFrameHandler.get(), eventProps);
+            mFramePool = std::make_unique<FramePool>(FRAME_POOL_SLOTS);
+            cachedFrame = 0;
+            processedFrame = 0;
+            skippedFrame = 0;
+            droppedFrame = 0;
+            missedFrame = 0;
+            mCapturePolicy = CAPTURE_LAZY;
+            mPrefetchDepth = CAPTURE_PREFETCH_DEPTH;
+            mPrefetchBudget = 0;
+            mPendingCapturePTS = -1;
+            mLastClassifiedGeneration = 0;
+            mLastClassifiedRect = SourceRect{0.0f, 0.0f, 0.0f, 0.0f};
+            hasLastClassified = false;
+            mInferenceEngine = std::make_unique<InferenceEngine>();
+            mPersonClassifier = std::make_unique<ObjectClassifier>(personModelPath, device, mInferenceEngine.get());
+            mDeliveryClassifier = std::make_unique<ObjectClassifier>(deliveryModelPath, device, mInferenceEngine.get());
             m_rb = std::make_unique<RingBuffer<ModelData, ModelDataScoreComparator>>(5);
+            initMetrics();
         }
 #endif
+        void SurveillanceSystem::initMetrics()
+        {
+            MetricsRegistry &registry = MetricsRegistry::instance();
+            mFramesCapturedMetric = registry.counter("surveillance_frames_captured_total", "Frames read from the camera into the history");
+            mFramesCachedMetric = registry.counter("surveillance_frames_cached_total", "Frames cached as thumbnail candidates");
+            mFramesDroppedMetric = registry.counter("surveillance_frames_dropped_total", "Frames not read because the frame pool was exhausted");
+            mMetadataMissedMetric = registry.counter("surveillance_metadata_missed_total", "Qualified metadata without a captured frame");
+#ifdef ENABLE_CLASSIFICATION
+            mPersonInferencesMetric = registry.counter("surveillance_inferences_total", "Model runs", "model=\"person\"");
+            mDeliveryInferencesMetric = registry.counter("surveillance_inferences_total", "Model runs", "model=\"delivery\"");
+            mPersonSkippedMetric = registry.counter("surveillance_inferences_skipped_total", "Model runs skipped because the frame had not changed", "model=\"person\"");
+            mDeliveryCandidatesMetric = registry.gauge("surveillance_delivery_candidates", "Person candidates waiting in the ring buffer for the delivery model");
+            mPersonClassifier->setLatencyMetric(registry.summary("surveillance_model_latency_us", "Model run time in microseconds", "model=\"person\""));
+            mDeliveryClassifier->setLatencyMetric(registry.summary("surveillance_model_latency_us", "Model run time in microseconds", "model=\"delivery\""));
+#endif
+        }
         void SurveillanceSystem::startSurveillance()
         {
             LOG_INFO("Starting the Surveillance..");
+            mThumbnailGenerater->start();
 #ifdef ENABLE_CLASSIFICATION
             mPersonClassifier->intializeObjectClassifier();
             mPersonModelParams = getNormalizationParams(mPersonClassifier->getTensorPreprocessingParams());
             mDeliveryClassifier->intializeObjectClassifier();
             mDeliveryModelParams = getNormalizationParams(mDeliveryClassifier->getTensorPreprocessingParams());
             classifierThread = std::thread(&SurveillanceSystem::classifyMotionObjects, this);
-            classifierThread.detach();
 #endif
         }
 
+        void SurveillanceSystem::setCapturePolicy(CAPTURE_POLICY policy, size_t prefetchDepth)
+        {
+            std::lock_guard<std::mutex> lock(mCaptureMutex);
+            mCapturePolicy = policy;
+            mPrefetchDepth = std::min(prefetchDepth, FRAME_HISTORY_SLOTS);
+            mPrefetchBudget = std::min(mPrefetchBudget, mPrefetchDepth);
+        }
+
+        /**
+         * Announces a new frame. With the eager policy, while prefetch budget is left or while
+         * classification is active, the frame is copied into the PTS history right away; otherwise
+         * only its PTS is remembered and the xStreamer buffer is not touched until metadata for it
+         * qualifies.
+         */
         void SurveillanceSystem::captureFrame(int64_t motionFramePTS)
         {
+            {
+                std::lock_guard<std::mutex> lock(mCaptureMutex);
+                bool readNow = (mCapturePolicy == CAPTURE_EAGER || mPrefetchBudget > 0);
+#ifdef ENABLE_CLASSIFICATION
+                // The classifier takes every frame that has metadata, reading late would mostly miss
+                readNow = readNow || classifyObj;
+#endif
+                if (readNow)
+                {
+                    if (mPrefetchBudget > 0)
+                    {
+                        mPrefetchBudget--;
+                    }
+                    readFrameIntoHistory(motionFramePTS);
+                }
+                else
+                {
+                    mPendingCapturePTS = motionFramePTS;
+                }
+            }
             std::lock_guard<std::mutex> lock(mResourceMutex);
-            mRawFrameInfo = mCameraFrameHandler->CaptureFrameFromCamera();
             mSurveillanceFrame.isCaptured = true;
             return;
         }
 
+        /**
+         * Reads the current frame from the camera into the history. Must be called with mCaptureMutex held.
+         * xStreamer only holds its latest frame, which may already be newer than @p framePTS when the
+         * read is late; such a frame is not bound to @p framePTS and nothing is returned.
+         */
+        FrameRef SurveillanceSystem::readFrameIntoHistory(int64_t framePTS)
+        {
+            frameInfoYUV *rawFrame = mCameraFrameHandler->CaptureFrameFromCamera();
+            if (!rawFrame || !rawFrame->y_addr)
+            {
+                LOG_ERROR("Failed to capture frame for PTS " << framePTS);
+                return FrameRef();
+            }
+            mRawFrameInfo = rawFrame;
+            if (static_cast<int64_t>(rawFrame->mono_pts) != framePTS)
+            {
+                LOG_DEBUG("Camera already holds the frame of PTS " << rawFrame->mono_pts << ", frame of PTS " << framePTS << " is gone");
+                mPendingCapturePTS = -1;
+                return FrameRef();
+            }
+            FrameRef frame;
+            {
+                TraceScope trace(TRACE_FRAME_COPY, framePTS);
+                frame = catcheFrame(rawFrame);
+            }
+            if (frame)
+            {
+                mFramesCapturedMetric->inc();
+                frame->pts = framePTS;
+                mFrameHistory.add(framePTS, frame);
+            }
+            mPendingCapturePTS = -1;
+            return frame;
+        }
+
+        /**
+         * Returns the frame of @p framePTS from the history, reading it now if it is the latest
+         * announced frame and was skipped by the lazy policy. A hit refills the prefetch budget,
+         * since more qualifying metadata is likely to follow.
+         */
+        FrameRef SurveillanceSystem::acquireFrame(int64_t framePTS)
+        {
+            FrameRef frame = mFrameHistory.find(framePTS);
+            std::lock_guard<std::mutex> lock(mCaptureMutex);
+            if (!frame && framePTS >= 0 && framePTS == mPendingCapturePTS)
+            {
+                frame = readFrameIntoHistory(framePTS);
+            }
+            if (frame && mCapturePolicy == CAPTURE_LAZY)
+            {
+                mPrefetchBudget = mPrefetchDepth;
+            }
+            return frame;
+        }
+
         void SurveillanceSystem::processFrameMetaData(MotionEventMetadata &metaData, int motionFlags)
         {
             auto currTime = std::chrono::system_clock::now();
@@ -56,22 +186,48 @@ namespace camera
             int isInsideDOI = motionFlags & 0x01;
 
             LOG_DEBUG("insideROI:" << isInsideROI << " insideDOI:" << isInsideDOI);
-            size_t width, height, y_size, uv_size, total_size;
+            // Decide first whether this event needs its frame at all, the frame is only read if it does
+            bool isQualified = false;
+            bool needsFrame = false;
+            int unionBoxArea = 0;
+            int newUnionBoxArea = 0;
+            int discardReasons = 0;
+            {
+                std::lock_guard<std::mutex> lock(mResourceMutex);
+                unionBoxArea = mSurveillanceFrame.eventData.unionBox.boundingBoxHeight * mSurveillanceFrame.eventData.unionBox.boundingBoxWidth;
+                newUnionBoxArea = metaData.unionBox.boundingBoxHeight * metaData.unionBox.boundingBoxWidth;
+                discardReasons = (mSurveillanceFrame.isCaptured ? 0 : FLIGHT_DISCARD_NOT_CAPTURING) |
+                                 (isQualifiedMotion(metaData.event_type, motionFlags) ? 0 : FLIGHT_DISCARD_MOTION_FILTERED) |
+                                 (newUnionBoxArea > unionBoxArea ? 0 : FLIGHT_DISCARD_SMALLER_BOX);
+                isQualified = (discardReasons == 0);
+                needsFrame = isQualified;
+#ifdef ENABLE_CLASSIFICATION
+                needsFrame = needsFrame || classifyObj;
+#endif
+            }
+            if (!needsFrame)
+            {
+                FlightRecorder::instance().record(FLIGHT_METADATA_DISCARDED, metaData.motionFramePTS, discardReasons, static_cast<float>(newUnionBoxArea));
+                LOG_DEBUG("discarded eventType " << metaData.event_type << " Current UniounBox " << unionBoxArea << " newUnionBoxArea " << newUnionBoxArea << " isInsideROI " << isInsideROI << " hasROISet " << hasROISet << " hasDOISet" << hasDOISet);
+                return;
+            }
+            // The frame this metadata was computed on, shared by the thumbnail and classification caches
+            FrameRef frame = acquireFrame(metaData.motionFramePTS);
+            if (!frame)
+            {
+                missedFrame++;
+                mMetadataMissedMetric->inc();
+                FlightRecorder::instance().record(FLIGHT_METADATA_MISSED, metaData.motionFramePTS, isQualified ? 1 : 0, static_cast<float>(newUnionBoxArea));
+                LOG_DEBUG("No captured frame for PTS " << metaData.motionFramePTS << ", metadata ignored");
+                return;
+            }
+            FlightRecorder::instance().record(FLIGHT_METADATA_ACCEPTED, metaData.motionFramePTS, isQualified ? 1 : 0, static_cast<float>(newUnionBoxArea));
             {
                 std::lock_guard<std::mutex> lock(mResourceMutex);
-                width = mRawFrameInfo->width;
-                height = mRawFrameInfo->height;
-                y_size = width * height;
-                uv_size = width * height / 2;
-                total_size = y_size + uv_size;
-
-                int unionBoxArea = mSurveillanceFrame.eventData.unionBox.boundingBoxHeight * mSurveillanceFrame.eventData.unionBox.boundingBoxWidth;
-                int newUnionBoxArea = metaData.unionBox.boundingBoxHeight * metaData.unionBox.boundingBoxWidth;
-
                 // if motion is detected update the metadata.
-                if ((mSurveillanceFrame.isCaptured && metaData.event_type == 4) && (newUnionBoxArea > unionBoxArea) && ((hasROISet && isInsideROI) || (hasDOISet && isInsideDOI) || (!hasROISet && !hasDOISet)))
+                if (isQualified)
                 {
-                    catcheFrameForThumbnail(metaData, width, height, y_size, uv_size, total_size);
+                    catcheFrameForThumbnail(metaData, frame);
 // trigger object classification now
 #ifdef ENABLE_CLASSIFICATION
                     motionDetected = true;
@@ -80,12 +236,14 @@ namespace camera
                 }
                 else
                 {
+                    // Only read for the classifier
+                    FlightRecorder::instance().record(FLIGHT_METADATA_DISCARDED, metaData.motionFramePTS, discardReasons, static_cast<float>(newUnionBoxArea));
                     LOG_DEBUG("discarded eventType " << metaData.event_type << " Current UniounBox " << unionBoxArea << " newUnionBoxArea " << newUnionBoxArea << " isInsideROI " << isInsideROI << " hasROISet " << hasROISet << " hasDOISet" << hasDOISet);
                 }
 #ifdef ENABLE_CLASSIFICATION
                 if (classifyObj)
                 {
-                    catcheFrameForMotionClassification(metaData, width, height, y_size, uv_size, total_size);
+                    catcheFrameForMotionClassification(metaData, frame);
                 }
 #endif
             } // release the lock
@@ -117,8 +275,12 @@ namespace camera
         void SurveillanceSystem::OnClipGenStart(const char *cvrClipFname)
         {
             LOG_INFO("OnClipGenStart");
+            FlightRecorder::instance().record(FLIGHT_CLIP_START, -1, 0, 0.0f, cvrClipFname);
+            // Candidates of the previous clip must not end up in this one
+            mThumbnailGenerater->discardCandidates();
+            std::lock_guard<std::mutex> lock(mResourceMutex);
             mMotionPayload.reset();
-            mMotionPayload.fileName = "/tmp/" + std::string(cvrClipFname) + ".jpeg";
+            mMotionPayload.fileName = cvrClipFname;
             mMotionPayload.isPayLoadReady = false;
             mMotionPayload.isInitiated = true;
         }
@@ -126,8 +288,31 @@ namespace camera
         void SurveillanceSystem::OnClipGenEnd(const char *cvrClipFname)
         {
             LOG_INFO("OnClipGenEnd");
-            if (mMotionPayload.isPayLoadReady && mMotionPayload.isInitiated)
+            bool isInitiated = false;
+            bool handedOver = false;
             {
+                std::lock_guard<std::mutex> lock(mResourceMutex);
+                isInitiated = mMotionPayload.isInitiated;
+            }
+            bool isStore = false;
+            struct stat statbuf;
+            if (stat("/tmp/.store", &statbuf) == 0)
+            {
+                LOG_INFO("Frame will be stored in jpg format for debugging");
+                isStore = true;
+            }
+            // The thumbnail was encoded while the clip was recorded, only the finished payload is taken here
+            PayLoadMetaData payload;
+            std::string storePath;
+            if (isInitiated && mThumbnailGenerater->takePayload(&payload))
+            {
+                storePath = "/tmp/" + payload.fileName + ".jpeg";
+                // Written before the upload takes over the JPEG buffer
+                if (isStore)
+                {
+                    std::ofstream file(storePath, std::ios::binary | std::ios::trunc);
+                    file.write(reinterpret_cast<const char *>(payload.jpegData.data()), static_cast<std::streamsize>(payload.jpegData.size()));
+                }
                 bool ignoreEvent = false;
                 auto now = std::chrono::system_clock::now();
                 uint64_t now_secs = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
@@ -138,74 +323,80 @@ namespace camera
                 }
                 if (!ignoreEvent)
                 {
+                    handedOver = mThumbnailGenerater->generateThumbnail(std::move(payload));
                 }
+            }
+            {
+                std::lock_guard<std::mutex> lock(mResourceMutex);
                 mMotionPayload.isPayLoadReady = false;
                 mMotionPayload.isInitiated = false;
             }
 #ifdef ENABLE_CLASSIFICATION
             classifyObj = false;
 #endif
-            LOG_INFO("Number of time new frame cached; " << cachedFrame << " No of frame processed for person: " << processedFrame);
-            bool isStore = false;
-            struct stat statbuf;
-            if (stat("/tmp/.store", &statbuf) == 0)
-            {
-                LOG_INFO("Frame will be stored in jpg format for debugging");
-                isStore = true;
-            }
-            if (isStore)
+            FlightRecorder::instance().record(FLIGHT_CLIP_END, -1, handedOver ? 1 : 0, 0.0f, cvrClipFname);
+            LOG_INFO("Number of time new frame cached; " << cachedFrame << " No of frame processed for person: " << processedFrame << " No of frame skipped(unchanged): " << skippedFrame << " No of frame dropped(pool exhausted): " << droppedFrame << " No of metadata without frame: " << missedFrame);
+            // Every clip starts from an empty cache, a later clip must not have to beat the union box of this one
+            FrameRef frame;
             {
+                std::lock_guard<std::mutex> resourceLock(mResourceMutex);
+                if (isStore && mSurveillanceFrame.isCached && !mSurveillanceFrame.isEmpty())
                 {
-                    std::lock_guard<std::mutex> resourceLock(mResourceMutex);
-
-                    if (mSurveillanceFrame.isCached && !mSurveillanceFrame.isEmpty())
-                    {
-                        uint8_t *yBuffer = mSurveillanceFrame.getBuffer();
-                        if (yBuffer)
-                        {
-                            mCameraFrameHandler->convertAndStore(yBuffer,mSurveillanceFrame.width, mSurveillanceFrame.height,400, 300,mMotionPayload.fileName,&mSurveillanceFrame.eventData.unionBox);
-                            mCameraFrameHandler->saveBufferAsJpeg(yBuffer, mSurveillanceFrame.width, mSurveillanceFrame.height, mMotionPayload.fileName + "_1");
-                        }
-                    }
-                    mSurveillanceFrame.reset();
+                    frame = mSurveillanceFrame.getSnapshot();
+                }
+                mSurveillanceFrame.reset();
 #ifdef ENABLE_CLASSIFICATION
-                    mObjectClassificationFrame.reset();
+                mObjectClassificationFrame.reset();
 #endif
-                    cachedFrame = 0;
-                    processedFrame = 0;
-                }
+                cachedFrame = 0;
+                processedFrame = 0;
+                skippedFrame = 0;
+                droppedFrame = 0;
+                missedFrame = 0;
+            }
+            // The full frame is written outside the lock, and only next to a thumbnail that was taken
+            if (frame && !storePath.empty())
+            {
+                mCameraFrameHandler->saveBufferAsJpeg(frame->data, frame->width, frame->height, storePath + "_1");
             }
         }
 
-        void SurveillanceSystem::catcheFrame(FrameBase &frame, const MotionEventMetadata &metaData, size_t width, size_t height, size_t y_size, size_t uv_size, size_t total_size)
+        FrameRef SurveillanceSystem::catcheFrame(const frameInfoYUV *rawFrame)
         {
-            frame.resizeBuffer(total_size);
-
-            uint8_t *buffer = frame.getBuffer();
-            if (buffer != nullptr)
+            size_t y_size = static_cast<size_t>(rawFrame->width) * rawFrame->height;
+            size_t uv_size = y_size / 2;
+            FrameRef frame = mFramePool->acquire(rawFrame->width, rawFrame->height);
+            if (!frame)
             {
-                std::memcpy(buffer, mRawFrameInfo->y_addr, y_size);
-                if (mRawFrameInfo->uv_addr)
-                {
-                    std::memcpy(buffer + y_size, mRawFrameInfo->uv_addr, uv_size);
-                }
-                frame.height = height;
-                frame.width = width;
-                frame.isCached = true;
+                droppedFrame++;
+                mFramesDroppedMetric->inc();
+                LOG_INFO("No free frame slot, unable to process frame.");
+                return frame;
             }
-            else
+            PERF_SCOPE("frame_copy");
+            std::memcpy(frame->yPlane(), rawFrame->y_addr, y_size);
+            if (rawFrame->uv_addr)
             {
-                LOG_INFO("Buffer is empty, unable to process frame.");
+                std::memcpy(frame->uvPlane(), rawFrame->uv_addr, uv_size);
             }
+            return frame;
         }
 
-        void SurveillanceSystem::catcheFrameForThumbnail(const MotionEventMetadata &metaData, size_t width, size_t height, size_t y_size, size_t uv_size, size_t total_size)
+        void SurveillanceSystem::catcheFrameForThumbnail(const MotionEventMetadata &metaData, const FrameRef &frame)
         {
             LOG_DEBUG("Processing metadata for thumbnail");
             mSurveillanceFrame.reset();
-            catcheFrame(mSurveillanceFrame, metaData, width, height, y_size, uv_size, total_size);
+            if (!frame)
+            {
+                return;
+            }
+            mSurveillanceFrame.attachSnapshot(frame);
             mSurveillanceFrame.eventData = metaData;
             cachedFrame++;
+            mFramesCachedMetric->inc();
+            FlightRecorder::instance().record(FLIGHT_FRAME_CACHED, frame->pts, FLIGHT_CACHE_THUMBNAIL);
+            // Encoded right away in the background, so that the clip end only has to hand it over
+            mThumbnailGenerater->submitCandidate(frame, metaData, mMotionPayload.fileName);
             mSurveillanceFrame.eventData.print();
         }
 #ifdef ENABLE_CLASSIFICATION
@@ -219,53 +410,25 @@ namespace camera
             params.noOfChannels = settings.noOfChannels;
             params.scale = settings.scale;
             params.zeroPoint = settings.zeroPoint;
+            params.isQuantTableIdentity = buildQuantizationTable(params.scale, params.zeroPoint, params.lBound, params.uBound, params.quantTable);
+            LOG_INFO("Quantization table built, identity mapping: " << std::boolalpha << params.isQuantTableIdentity);
             return params;
         }
-        void SurveillanceSystem::catcheFrameForMotionClassification(const MotionEventMetadata &metaData, size_t width, size_t height, size_t y_size, size_t uv_size, size_t total_size)
+        void SurveillanceSystem::catcheFrameForMotionClassification(const MotionEventMetadata &metaData, const FrameRef &frame)
         {
             LOG_DEBUG("Processing metadata for motion classification");
             mObjectClassificationFrame.reset();
-            catcheFrame(mObjectClassificationFrame, metaData, width, height, y_size, uv_size, total_size);
-            mObjectClassificationFrame.mDeleveryUnionBox = metaData.deliveryUnionBox;
-            mObjectClassificationFrame.mObjectBoxes = metaData.getNormalizedBoundingBox();
-        }
-
-        std::optional<BoxPrediction> SurveillanceSystem::processInput(const std::shared_ptr<uint8_t[]> &modelInput, ObjectType type)
-        {
-            LOG_INFO("modelInput(" << static_cast<void *>(modelInput.get()) << ")");
-
-            try
-            {
-                switch (type)
-                {
-                case PERSON:
-                {
-                    DetectionOutput modelOutput = mPersonClassifier->RunObjectClassifier(modelInput.get(), mPersonModelParams.inputWidth, mPersonModelParams.inputHeight);
-                    return processOutput(modelOutput.predictions, type);
-                }
-                case DELIVERY:
-                {
-                    DetectionOutput modelOutput = mDeliveryClassifier->RunObjectClassifier(modelInput.get(), mDeliveryModelParams.inputWidth, mDeliveryModelParams.inputHeight);
-                    return processOutput(modelOutput.predictions, type);
-                }
-                default:
-                    LOG_ERROR("Invalid ObjectType provided");
-                    return std::nullopt;
-                }
-            }
-            catch (const std::exception &e)
+            if (!frame)
             {
-                LOG_ERROR("Exception during processInput: " << e.what());
-                return std::nullopt;
-            }
-            catch (...)
-            {
-                LOG_ERROR("Unknown error occurred during processInput");
-                return std::nullopt;
+                return;
             }
+            mObjectClassificationFrame.attachSnapshot(frame);
+            FlightRecorder::instance().record(FLIGHT_FRAME_CACHED, frame->pts, FLIGHT_CACHE_CLASSIFICATION);
+            mObjectClassificationFrame.mDeleveryUnionBox = metaData.deliveryUnionBox;
+            mObjectClassificationFrame.mObjectBoxes = metaData.getNormalizedBoundingBox();
         }
 
-        std::optional<BoxPrediction> SurveillanceSystem::processOutput(const std::vector<BoxPrediction> &predictions, ObjectType type)
+        std::optional<BoxPrediction> SurveillanceSystem::processOutput(const std::vector<BoxPrediction> &predictions, ObjectType type, const std::vector<NormalizedBoundingBox> &objectBoxes, int64_t framePTS)
         {
             if (predictions.empty())
             {
@@ -275,7 +438,7 @@ namespace camera
 
             for (const BoxPrediction &prediction : predictions)
             {
-                LOG_INFO("BoxPrediction: "
+                LOG_DEBUG("BoxPrediction: "
                          << "y_min=" << prediction.y_min << ", "
                          << "x_min=" << prediction.x_min << ", "
                          << "y_max=" << prediction.y_max << ", "
@@ -287,14 +450,15 @@ namespace camera
             {
             case PERSON:
             {
-                auto objectBoxes = mObjectClassificationFrame.mObjectBoxes;
                 PredictionProcessor processor(objectBoxes, mROI);
                 auto prediction = processor.processOutput(predictions);
                 float confidenceThreshold = 0.60;
 
                 if (prediction.has_value())
                 {
-                    if (prediction.value().confidence >= confidenceThreshold)
+                    bool accepted = prediction.value().confidence >= confidenceThreshold;
+                    FlightRecorder::instance().record(FLIGHT_PREDICTION, framePTS, PERSON, prediction.value().confidence, accepted ? "accepted" : "rejected");
+                    if (accepted)
                     {
                         LOG_INFO("Person Detection above confidence threshold.");
                         return prediction;
@@ -307,6 +471,7 @@ namespace camera
             {
                 float confidenceThreshold = 0.87;
                 BoxPrediction prediction = ObjectClassifier::findHighestScoredDetection(predictions);
+                FlightRecorder::instance().record(FLIGHT_PREDICTION, framePTS, DELIVERY, prediction.confidence, prediction.confidence >= confidenceThreshold ? "accepted" : "rejected");
                 if (prediction.confidence >= confidenceThreshold)
                 {
                     LOG_INFO("Delivery Detection above confidence threshold.");
@@ -360,24 +525,52 @@ namespace camera
                 {
                     unique_lock<mutex> lock(mResourceMutex);
                     cvClassify.wait(lock, [this]
-                                    { return motionDetected.load(); });
+                                    { return motionDetected.load() || !keepRunning; });
                     motionDetected = false;
                 }
+                if (!keepRunning)
+                {
+                    break;
+                }
                 auto now = high_resolution_clock::now();
+                hasLastClassified = false;
                 LOG_INFO("Starting the object classification (" << std::boolalpha << classifyObj << ") after " << (duration_cast<seconds>(now - lastActivityTime)).count() << " secs of inactivity");
                 milliseconds sleepDuration(1000);
-                while (classifyObj)
+                while (classifyObj && keepRunning)
                 {
                     sleepDuration = milliseconds(1000);
                     lastActivityTime = high_resolution_clock::now();
+                    // Only take a reference to the cached frame under the lock, the model runs without it
+                    ObjectClassificationFrame frame;
                     {
                         std::lock_guard<std::mutex> resourceLock(mResourceMutex);
-                        if (mObjectClassificationFrame.isCached)
+                        if (mObjectClassificationFrame.isCached && !mObjectClassificationFrame.isEmpty())
                         {
-                            processFrameForPerson();
+                            frame.attachSnapshot(mObjectClassificationFrame.getSnapshot());
+                            frame.mDeleveryUnionBox = mObjectClassificationFrame.mDeleveryUnionBox;
+                            frame.mObjectBoxes = mObjectClassificationFrame.mObjectBoxes;
+                            frame.generation = mObjectClassificationFrame.generation;
                         }
-
                     } // Unlock as soon as possible
+                    if (frame.isCached)
+                    {
+                        SourceRect rect;
+                        uint8_t signature[LUMA_SIGNATURE_CELLS];
+                        if (isSameAsLastClassified(frame, rect, signature))
+                        {
+                            skippedFrame++;
+                            mPersonSkippedMetric->inc();
+                            LOG_DEBUG("Cached frame unchanged since the last pass, skipping person detection");
+                        }
+                        else if (processFrameForPerson(frame))
+                        {
+                            // Only a frame the model actually ran on becomes the reference, a failed run is retried
+                            mLastClassifiedGeneration = frame.generation;
+                            mLastClassifiedRect = rect;
+                            std::memcpy(mLastClassifiedSignature, signature, sizeof(signature));
+                            hasLastClassified = true;
+                        }
+                    }
                     auto timeTaken = duration_cast<milliseconds>(high_resolution_clock::now() - lastActivityTime);
                     LOG_INFO("Time taken for the person detection " << timeTaken.count() << " msecs");
                     sleepDuration -= timeTaken;
@@ -388,37 +581,87 @@ namespace camera
                     this_thread::sleep_for(sleepDuration);
                 }
                 LOG_INFO("Done with object calssification(Person) " << std::boolalpha << classifyObj << " It took " << duration_cast<seconds>(high_resolution_clock::now() - now).count() << " secs");
-                processFrameForDelivery();
+                if (keepRunning)
+                {
+                    processFrameForDelivery();
+                }
             }
         }
-        void SurveillanceSystem::cacheFrameForDelivery(uint8_t *yBuffer, BoxPrediction predictedPerson)
+        void SurveillanceSystem::cacheFrameForDelivery(ObjectClassificationFrame &frame, BoxPrediction predictedPerson)
         {
-            auto rawInput = mCameraFrameHandler->convertAndResize(yBuffer, mObjectClassificationFrame.width, mObjectClassificationFrame.height, mDeliveryModelParams.inputWidth, mDeliveryModelParams.inputHeight, &mObjectClassificationFrame.mDeleveryUnionBox);
+            uint8_t *yBuffer = frame.getBuffer();
+            int64_t framePTS = frame.getSnapshot()->pts;
+            std::shared_ptr<uint8_t[]> rawInput;
+            {
+                TraceScope trace(TRACE_PREPROCESS, framePTS);
+                rawInput = mCameraFrameHandler->convertAndResize(yBuffer, frame.width, frame.height, mDeliveryModelParams.inputWidth, mDeliveryModelParams.inputHeight, &frame.mDeleveryUnionBox);
+            }
             if (rawInput)
             {
                 // std::shared_ptr<uint8_t[]> dModelInput(rawInput); // Properly managing memory
-                m_rb->add(ModelData(std::move(rawInput), predictedPerson.confidence));
+                TraceScope trace(TRACE_RING_INSERT, framePTS);
+                m_rb->add(ModelData(std::move(rawInput), predictedPerson.confidence, framePTS));
+                mDeliveryCandidatesMetric->set(static_cast<int64_t>(m_rb->getBuffer().size()));
                 LOG_INFO("Caching for delivery: " << static_cast<void *>(yBuffer));
             }
         }
-        void SurveillanceSystem::processFrameForPerson()
+        /**
+         * A frame is skipped when it is the very frame that was classified last, or when the model
+         * crop covers the same region and its 8x8 luma signature is within SIGNATURE_CHANGE_THRESHOLD.
+         * The crop and signature are handed back so that the caller can keep them as the new reference
+         * once the model has run on the frame.
+         */
+        bool SurveillanceSystem::isSameAsLastClassified(ObjectClassificationFrame &frame, SourceRect &rect, uint8_t signature[LUMA_SIGNATURE_CELLS])
+        {
+            if (hasLastClassified && frame.generation == mLastClassifiedGeneration)
+            {
+                return true;
+            }
+            rect = CameraFrameHandler::getSourceRect(frame.width, frame.height, mPersonModelParams.inputWidth, mPersonModelParams.inputHeight, &frame.mDeleveryUnionBox);
+            computeLumaSignature(frame.getSnapshot()->yPlane(), frame.width, frame.height, rect, signature);
+            bool sameRegion = std::abs(rect.x - mLastClassifiedRect.x) < 1.0f && std::abs(rect.y - mLastClassifiedRect.y) < 1.0f &&
+                              std::abs(rect.width - mLastClassifiedRect.width) < 1.0f && std::abs(rect.height - mLastClassifiedRect.height) < 1.0f;
+            return hasLastClassified && sameRegion && lumaSignatureDistance(signature, mLastClassifiedSignature) <= SIGNATURE_CHANGE_THRESHOLD;
+        }
+        bool SurveillanceSystem::processFrameForPerson(ObjectClassificationFrame &frame)
         {
+            bool classified = false;
             LOG_INFO("Processing cached frame for person detection!");
-            if (!mObjectClassificationFrame.isEmpty())
+            if (!frame.isEmpty())
             {
-                uint8_t *yBuffer = mObjectClassificationFrame.getBuffer();
+                uint8_t *yBuffer = frame.getBuffer();
                 if (yBuffer)
                 {
-                    auto modelInput = mCameraFrameHandler->resizeNormalizeQuantize(yBuffer, mObjectClassificationFrame.width, mObjectClassificationFrame.height, mPersonModelParams, &mObjectClassificationFrame.mDeleveryUnionBox);
-                    if (modelInput)
+                    int64_t framePTS = frame.getSnapshot()->pts;
+                    // Preprocess straight into the input tensor on the inference engine, the runner then skips its input copy
+                    auto result = mPersonClassifier->RunObjectClassifierAsync([this, &frame, yBuffer, framePTS](uint8_t *modelInput, size_t inputSize)
+                                                                              {
+                                                                                  TraceScope trace(TRACE_PREPROCESS, framePTS);
+                                                                                  return mCameraFrameHandler->resizeNormalizeQuantize(yBuffer, frame.width, frame.height, mPersonModelParams, modelInput, inputSize, &frame.mDeleveryUnionBox); });
+                    try
                     {
+                        DetectionOutput modelOutput = result.get();
+                        if (!modelOutput.isValid)
+                        {
+                            LOG_ERROR("Person classification did not run");
+                            return false;
+                        }
+                        classified = true;
                         processedFrame++;
-                        auto bestPrediction = processInput(modelInput, PERSON);
+                        mPersonInferencesMetric->inc();
+                        std::optional<BoxPrediction> bestPrediction;
+                        {
+                            TraceScope trace(TRACE_POSTPROCESS, framePTS);
+                            bestPrediction = processOutput(modelOutput.predictions, PERSON, frame.mObjectBoxes, framePTS);
+                        }
                         if (bestPrediction)
                         {
-                            cacheFrameForDelivery(yBuffer, *bestPrediction);
+                            cacheFrameForDelivery(frame, *bestPrediction);
                         }
-                        // delete[] modelInput;
+                    }
+                    catch (const std::exception &e)
+                    {
+                        LOG_ERROR("Exception during person classification: " << e.what());
                     }
                 }
             }
@@ -427,6 +670,7 @@ namespace camera
                 LOG_INFO("Empty Buffer");
             }
             LOG_INFO("Processing cached frame complete.");
+            return classified;
         }
         void SurveillanceSystem::processFrameForDelivery()
         {
@@ -438,31 +682,65 @@ namespace camera
                 LOG_INFO("Frame will be stored in jpg format for debugging");
                 isStore = true;
             }
+            int64_t startNs = PipelineTracer::nowNs();
+            // All candidates go through the delivery model in a single batched invoke
+            std::vector<std::shared_ptr<uint8_t[]>> modelInputs;
+            std::vector<int64_t> inputPTS;
             for (const auto &data : m_rb->getBuffer())
             {
                 if (data.modelInput)
                 {
-                    auto bestPrediction = processInput(data.modelInput, DELIVERY);
-                    struct stat statbuf;
-                    if (isStore)
+                    modelInputs.push_back(data.modelInput);
+                    inputPTS.push_back(data.pts);
+                    if (isStore && count < 5)
                     {
-                        if (count < 5)
-                        {
-                            auto now = std::chrono::high_resolution_clock::now();
-                            auto tend = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
-                            std::string output_image_path = "/opt/image_" + std::to_string(tend) + ".jpg";
-                            mCameraFrameHandler->saveRGBBufferAsJPEG(data.modelInput.get(), mDeliveryModelParams.inputWidth, mDeliveryModelParams.inputHeight, output_image_path);
-                            count++;
-                        }
+                        auto now = std::chrono::high_resolution_clock::now();
+                        auto tend = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+                        std::string output_image_path = "/opt/image_" + std::to_string(tend) + ".jpg";
+                        mCameraFrameHandler->saveRGBBufferAsJPEG(data.modelInput.get(), mDeliveryModelParams.inputWidth, mDeliveryModelParams.inputHeight, output_image_path);
+                        count++;
                     }
-                    if (bestPrediction.has_value())
+                }
+            }
+            if (!modelInputs.empty())
+            {
+                std::optional<BoxPrediction> bestPrediction;
+                int64_t bestPTS = -1;
+                try
+                {
+                    std::vector<DetectionOutput> modelOutputs = mDeliveryClassifier->RunObjectClassifierBatchAsync(std::move(modelInputs)).get();
+                    for (size_t i = 0; i < modelOutputs.size(); ++i)
                     {
-                        LOG_INFO("DELIVERY DETECTED!!!  Confidence: " << bestPrediction.value().confidence);
-                        break;
+                        // Only runs that produced an output are counted, a failed one has nothing to look at
+                        if (!modelOutputs[i].isValid)
+                        {
+                            continue;
+                        }
+                        mDeliveryInferencesMetric->inc();
+                        std::optional<BoxPrediction> prediction;
+                        {
+                            TraceScope trace(TRACE_POSTPROCESS);
+                            prediction = processOutput(modelOutputs[i].predictions, DELIVERY, {}, i < inputPTS.size() ? inputPTS[i] : -1);
+                        }
+                        if (prediction && (!bestPrediction || prediction->confidence > bestPrediction->confidence))
+                        {
+                            bestPrediction = prediction;
+                            bestPTS = i < inputPTS.size() ? inputPTS[i] : -1;
+                        }
                     }
                 }
+                catch (const std::exception &e)
+                {
+                    LOG_ERROR("Exception during delivery classification: " << e.what());
+                }
+                if (bestPrediction.has_value())
+                {
+                    LOG_INFO("DELIVERY DETECTED!!!  Confidence: " << bestPrediction.value().confidence);
+                }
+                PipelineTracer::instance().record(TRACE_DELIVERY_DECISION, (PipelineTracer::nowNs() - startNs) / 1000, bestPTS);
             }
             m_rb->clear();
+            mDeliveryCandidatesMetric->set(0);
         }
 #endif
     }
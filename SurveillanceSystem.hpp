@@ -3,6 +3,11 @@
 
 #include "CameraFrameHandler.hpp"
 #include "ThumbnailGenerater.hpp"
+#include "FramePool.hpp"
+#include "FrameHistory.hpp"
+#include "PipelineTracer.hpp"
+#include "MetricsRegistry.hpp"
+#include "FlightRecorder.hpp"
 #ifdef ENABLE_CLASSIFICATION
 #include "ObjectClassifier.hpp"
 #include "RingBuffer.hpp"
@@ -18,11 +23,28 @@
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <atomic>
 #include <thread>
 namespace camera
 {
     namespace camera_ml
     {
+        // Recently captured frames kept so that metadata can be matched to its frame by PTS.
+        constexpr size_t FRAME_HISTORY_SLOTS = 4;
+        // Frame slots shared by the capture history, the thumbnail cache, the classification cache, one frame in flight
+        // and the thumbnail candidate being encoded.
+        constexpr size_t FRAME_POOL_SLOTS = FRAME_HISTORY_SLOTS + 4;
+        // Frames read eagerly after a qualifying event, while motion is likely to continue.
+        constexpr size_t CAPTURE_PREFETCH_DEPTH = 2;
+
+        typedef enum
+        {
+            CAPTURE_EAGER = 0, // Read every frame announced by a CAPTURE message
+            CAPTURE_LAZY       // Read a frame only once its metadata qualifies, plus the prefetch budget
+        } CAPTURE_POLICY;
+        // Largest per-cell luma change (0-255) for which two frames count as the same scene.
+        constexpr int SIGNATURE_CHANGE_THRESHOLD = 3;
+
         typedef enum
         {
             CVR_CLIP_GEN_START = 0,
@@ -46,10 +68,11 @@ namespace camera
         {
             std::shared_ptr<uint8_t[]> modelInput;
             float score;
+            int64_t pts; // PTS of the frame the input was cut from, -1 if not known
             // Construct with raw pointer and take ownership immediately
-            ModelData(uint8_t *input, float scr) : modelInput(input), score(scr) {}
+            ModelData(uint8_t *input, float scr, int64_t framePTS = -1) : modelInput(input), score(scr), pts(framePTS) {}
             // Optional: Constructor directly taking a shared_ptr for more explicit shared ownership scenarios
-            ModelData(std::shared_ptr<uint8_t[]> input, float scr) : modelInput(std::move(input)), score(scr) {}
+            ModelData(std::shared_ptr<uint8_t[]> input, float scr, int64_t framePTS = -1) : modelInput(std::move(input)), score(scr), pts(framePTS) {}
             // Overload the stream insertion operator to print details about ModelData
             friend std::ostream &operator<<(std::ostream &os, const ModelData &data)
             {
@@ -74,11 +97,10 @@ namespace camera
             int width;
             int height;
             bool isCached;
+            // Bumped every time a new snapshot is attached, survives reset() so that it never repeats
+            uint64_t generation;
             // Virtual destructor
-            virtual ~FrameBase()
-            {
-                free(buffer);
-            }
+            virtual ~FrameBase() = default;
 
             // Disable copying to prevent accidental duplication of large buffer data
             FrameBase(const FrameBase &) = delete;
@@ -86,10 +108,8 @@ namespace camera
 
             // Enable move semantics
             FrameBase(FrameBase &&other) noexcept
-                : width(other.width), height(other.height), buffer(other.buffer), bufferSize(other.bufferSize), isCached(other.isCached)
+                : width(other.width), height(other.height), isCached(other.isCached), generation(other.generation), snapshot(std::move(other.snapshot))
             {
-                other.buffer = nullptr;
-                other.bufferSize = 0;
                 other.isCached = false;
             }
 
@@ -97,89 +117,57 @@ namespace camera
             {
                 if (this != &other)
                 {
-                    free(buffer);
-
                     width = other.width;
                     height = other.height;
-                    buffer = other.buffer;
-                    bufferSize = other.bufferSize;
+                    isCached = other.isCached;
+                    generation = other.generation;
+                    snapshot = std::move(other.snapshot);
 
-                    other.buffer = nullptr;
-                    other.bufferSize = 0;
                     other.isCached = false;
                 }
                 return *this;
             }
 
-            // Method to reset all fields to their default values
+            // Method to reset all fields to their default values, the frame slot goes back to the pool
             virtual void reset()
             {
                 width = 0;
                 height = 0;
                 isCached = false;
-                if (buffer)
-                {
-                    memset(buffer, 0, bufferSize);
-                }
+                snapshot.reset();
             }
 
-            // Resizes the buffer and initializes new elements to zero
-            bool resizeBuffer(size_t newSize)
+            // Shares an already captured frame instead of copying it
+            void attachSnapshot(const FrameRef &frame)
             {
-                if (newSize == bufferSize)
-                {
-                    return true; // No change needed
-                }
-
-                uint8_t *newBuffer = static_cast<uint8_t *>(realloc(buffer, newSize));
-                if (!newBuffer)
-                {
-                    std::cerr << "Memory allocation failed for resizeBuffer" << std::endl;
-                    return false;
-                }
-
-                if (newSize > bufferSize)
-                {
-                    // Initialize the newly allocated memory to zero
-                    memset(newBuffer + bufferSize, 0, newSize - bufferSize);
-                }
-
-                buffer = newBuffer;
-                bufferSize = newSize;
-                return true;
+                snapshot = frame;
+                width = frame->width;
+                height = frame->height;
+                isCached = true;
+                ++generation;
             }
 
             // Checks if the buffer is empty
             bool isEmpty() const
             {
-                return bufferSize == 0;
+                return !snapshot;
             }
 
             // Returns a pointer to the buffer data
             uint8_t *getBuffer()
             {
-                return buffer;
+                return snapshot ? snapshot->data : nullptr;
             }
 
-            // Updates the buffer with new data
-            bool updateBuffer(const uint8_t *newData, size_t newSize)
+            const FrameRef &getSnapshot() const
             {
-                if (!resizeBuffer(newSize))
-                {
-                    return false;
-                }
-                if (buffer)
-                {
-                    std::memcpy(buffer, newData, newSize);
-                }
-                return true;
+                return snapshot;
             }
 
         protected:
-            uint8_t *buffer;
-            size_t bufferSize;
+            FrameRef snapshot;
             // Protected constructor for base class
-            FrameBase() : width(0), height(0), buffer(nullptr), bufferSize(0), isCached(false) {}
+            FrameBase() : width(0), height(0), isCached(false), generation(0), snapshot() {}
         };
 
         class SurveillanceFrame : public FrameBase
@@ -248,22 +236,44 @@ namespace camera
             SurveillanceSystem(int bufferId, const std::string &modelPath, const std::string &modelPath1, const std::string &eventProps, const std::string &device);
             ~SurveillanceSystem()
             {
-                keepRunning = false;
-                cvClassify.notify_one();
+                {
+                    std::lock_guard<std::mutex> lock(mResourceMutex);
+                    keepRunning = false;
+                    classifyObj = false;
+                }
+                cvClassify.notify_all();
+                // The classifier thread runs the models, it must be gone before the engine and the classifiers
+                if (classifierThread.joinable())
+                {
+                    classifierThread.join();
+                }
             };
 #endif
             void startSurveillance();
             void captureFrame(int64_t motionFramePTS);
             void processFrameMetaData(MotionEventMetadata &metaData, int motionFlags);
+            void setCapturePolicy(CAPTURE_POLICY policy, size_t prefetchDepth);
             void OnClipGenStart(const char *cvrClipFname);
             void OnClipGenEnd(const char *cvrClipFname);
 
         private:
-            void catcheFrame(FrameBase &frame, const MotionEventMetadata &metaData, size_t width, size_t height, size_t y_size, size_t uv_size, size_t total_size);
-            void catcheFrameForThumbnail(const MotionEventMetadata &metaData, size_t width, size_t height, size_t y_size, size_t uv_size, size_t total_size);
+            FrameRef catcheFrame(const frameInfoYUV *rawFrame);
+            FrameRef readFrameIntoHistory(int64_t framePTS);
+            FrameRef acquireFrame(int64_t framePTS);
+            void initMetrics();
+            void catcheFrameForThumbnail(const MotionEventMetadata &metaData, const FrameRef &frame);
 
+            // Declared first so that it outlives every holder of a frame, including the thumbnail encoder
+            std::unique_ptr<FramePool> mFramePool;
             std::unique_ptr<CameraFrameHandler> mCameraFrameHandler;
             std::unique_ptr<ThumbnailGenerater> mThumbnailGenerater;
+            FrameHistory<FRAME_HISTORY_SLOTS> mFrameHistory;
+            // Guards the frame reader and the capture policy state below, never held with mResourceMutex
+            std::mutex mCaptureMutex;
+            CAPTURE_POLICY mCapturePolicy;
+            size_t mPrefetchDepth;
+            size_t mPrefetchBudget;
+            int64_t mPendingCapturePTS; // Last announced frame that was not read, -1 if none
             // std::unique_ptr<RingBuffer> m_rb;
             SurveillanceFrame mSurveillanceFrame;
             ROI mROI;
@@ -274,16 +284,19 @@ namespace camera
             std::chrono::steady_clock::time_point last_processed_time;
 #ifdef ENABLE_CLASSIFICATION
             NormalizationParams getNormalizationParams(TensorFormatSettings settings);
-            void catcheFrameForMotionClassification(const MotionEventMetadata &metaData, size_t width, size_t height, size_t y_size, size_t uv_size, size_t total_size);
-            std::optional<BoxPrediction> processInput(const std::shared_ptr<uint8_t[]> &modelInput, ObjectType type);
-            std::optional<BoxPrediction> processOutput(const std::vector<BoxPrediction> &modelOutput, ObjectType type);
+            void catcheFrameForMotionClassification(const MotionEventMetadata &metaData, const FrameRef &frame);
+            std::optional<BoxPrediction> processOutput(const std::vector<BoxPrediction> &modelOutput, ObjectType type, const std::vector<NormalizedBoundingBox> &objectBoxes = {}, int64_t framePTS = -1);
             void classifyMotionObjects();
-            void cacheFrameForDelivery(uint8_t *yBuffer, BoxPrediction predictedPerson);
+            void cacheFrameForDelivery(ObjectClassificationFrame &frame, BoxPrediction predictedPerson);
             void processFrameForDelivery();
-            void processFrameForPerson();
+            // Returns true if the person model ran on the frame
+            bool processFrameForPerson(ObjectClassificationFrame &frame);
+            bool isSameAsLastClassified(ObjectClassificationFrame &frame, SourceRect &rect, uint8_t signature[LUMA_SIGNATURE_CELLS]);
 
             std::unique_ptr<ObjectClassifier> mDeliveryClassifier;
             std::unique_ptr<ObjectClassifier> mPersonClassifier;
+            // Declared after the classifiers so that it is drained and joined before they go away
+            std::unique_ptr<InferenceEngine> mInferenceEngine;
             std::unique_ptr<RingBuffer<ModelData, ModelDataScoreComparator>> m_rb;
             NormalizationParams mDeliveryModelParams;
             NormalizationParams mPersonModelParams;
@@ -293,10 +306,30 @@ namespace camera
             std::atomic<bool> classifyObj;
             std::thread classifierThread;
             std::atomic<bool> keepRunning;
+            // What the person model last ran on, to skip frames that have not changed since
+            uint64_t mLastClassifiedGeneration;
+            SourceRect mLastClassifiedRect;
+            uint8_t mLastClassifiedSignature[LUMA_SIGNATURE_CELLS];
+            bool hasLastClassified;
 
 #endif
             int cachedFrame;
             int processedFrame;
+            int skippedFrame;
+            // Updated outside mResourceMutex, on whichever thread delivered the metadata
+            std::atomic<int> droppedFrame;
+            std::atomic<int> missedFrame;
+            // Live counterparts of the counters above, never reset, see MetricsRegistry
+            Counter *mFramesCapturedMetric;
+            Counter *mFramesCachedMetric;
+            Counter *mFramesDroppedMetric;
+            Counter *mMetadataMissedMetric;
+#ifdef ENABLE_CLASSIFICATION
+            Counter *mPersonInferencesMetric;
+            Counter *mPersonSkippedMetric;
+            Counter *mDeliveryInferencesMetric;
+            Gauge *mDeliveryCandidatesMetric;
+#endif
             static float m_threshold;
         };
     }
@@ -9,6 +9,7 @@ namespace camera
         TVMRunner::TVMRunner(const std::string &path, const std::string &device): ModelProcessor(path, device)
         {
             isRunWasCalled =false; 
+            mInputName = "normalized_input_image_tensor";
         }
 
         int TVMRunner::initializeModelInterface()
@@ -18,22 +19,72 @@ namespace camera
             if (0 == Load())
             {
                 GetMetaInfo();
-                ret = 0;
+                ret = BindInput();
             }
             return ret;
         }
 
-        std::vector<DetectionOutput> TVMRunner::runModelInterface(char *inputFrame)
+        DetectionOutput TVMRunner::runModelInterface(uint8_t *inputFrame)
         {
             LOG(INFO) << "TVMRunner :runModelInterface:";
-            std::string input_id = "normalized_input_image_tensor";
-            NDArray in_arr = mGraphHandle.GetFunction("get_input")(input_id);
-            auto ssize = GetMemSize(in_arr);
-            in_arr.CopyFromBytes(inputFrame, ssize);
-            Run();
-            std::vector<DetectionOutput> output;
+            size_t ssize = 0;
+            uint8_t *input = getInputBuffer(&ssize);
+            if (nullptr == input)
+            {
+                LOG(ERROR) << "TVMRunner : input is not bound";
+                return DetectionOutput();
+            }
+            // Input that was preprocessed in place via getInputBuffer() needs no copy
+            if (inputFrame != input)
+            {
+                mInputArray.CopyFromBytes(inputFrame, ssize);
+            }
+            return runModelInterface();
+        }
+
+        DetectionOutput TVMRunner::runModelInterface()
+        {
+            DetectionOutput output;
+            output.isValid = (Run() == 0);
             return output;
         }
+
+        uint8_t *TVMRunner::getInputBuffer(size_t *size)
+        {
+            if (!mInputArray.defined())
+            {
+                if (size)
+                {
+                    *size = 0;
+                }
+                return nullptr;
+            }
+            if (size)
+            {
+                *size = GetMemSize(mInputArray);
+            }
+            return static_cast<uint8_t *>(mInputArray->data) + mInputArray->byte_offset;
+        }
+
+        /*!
+         * \brief Allocates the input NDArray once and hands it to the graph executor with
+         *        set_input_zero_copy, so the executor reads the preprocessed frame where it was written.
+         * \return 0 on success else error code.
+         */
+        int TVMRunner::BindInput(void)
+        {
+            auto it = mInfo.input_info.find(mInputName);
+            if (it == mInfo.input_info.end())
+            {
+                LOG(ERROR) << "TVMRunner : graph has no input named " << mInputName;
+                return 1;
+            }
+            DLDevice dev{GetTVMDevice(mDevice), 0};
+            mInputArray = NDArray::Empty(ShapeTuple(it->second.first), String2DLDataType(it->second.second), dev);
+            mGraphHandle.GetFunction("set_input_zero_copy")(mInputName, mInputArray);
+            LOG(INFO) << "TVMRunner : zero copy input bound, " << GetMemSize(mInputArray) << " bytes";
+            return 0;
+        }
         DLDeviceType TVMRunner::GetTVMDevice(std::string device)
         {
             if (!device.compare("cpu"))
@@ -30,10 +30,14 @@ namespace camera
         public:
             TVMRunner(const std::string& path, const std::string& device);
             int initializeModelInterface() override;
-            std::vector<float> runModelInterface(char *inputFrame) override;
+            DetectionOutput runModelInterface(uint8_t *inputFrame) override;
+            DetectionOutput runModelInterface() override;
+            uint8_t *getInputBuffer(size_t *size) override;
 
         private:
             int Load(void);
+            /*! \brief Binds a preallocated NDArray as the graph input (zero copy) */
+            int BindInput(void);
             /*! \brief Executes one inference cycle */
             int Run(void);
             TVMMetaInfo GetMetaInfo();
@@ -46,6 +50,9 @@ namespace camera
             tvm::runtime::Module mGraphHandle;
             /*! \brief Holds meta information queried from graph runtime */
             TVMMetaInfo mInfo;
+            /*! \brief Graph input name and the NDArray bound to it with set_input_zero_copy */
+            std::string mInputName;
+            tvm::runtime::NDArray mInputArray;
             int r_module_load_ms{0};
             /*! Graph runtime creatint time */
             int r_graph_load_ms{0};
@@ -1,6 +1,10 @@
 #include "TensorLiteRunner.hpp"
+#include "TfLiteBackend.hpp"
+#include "PipelineTracer.hpp"
+#include "PerfCounters.hpp"
 #include "tensorflow/lite/optional_debug_tools.h"
 #include <iostream>
+#include <sys/stat.h>
 namespace camera
 {
     namespace camera_ml
@@ -8,10 +12,17 @@ namespace camera
         /// @brief
         /// @param path
         /// @param device
-        TensorLiteRunner::TensorLiteRunner(const std::string &path, const std::string &device) : ModelProcessor(path, device)
+        TensorLiteRunner::TensorLiteRunner(const std::string &path, const std::string &device) : ModelProcessor(path, device), mDelegate(nullptr, nullptr)
         {
             mInputTensor = nullptr;
         }
+        TensorLiteRunner::~TensorLiteRunner()
+        {
+            if (mInvokeStats.count > 0)
+            {
+                PrintStats();
+            }
+        }
         int TensorLiteRunner::initializeModelInterface()
         {
             auto tstart = std::chrono::high_resolution_clock::now();
@@ -25,97 +36,78 @@ namespace camera
             return 0;
         }
 
+        uint8_t *TensorLiteRunner::getInputBuffer(size_t *size)
+        {
+            // Single runs use the first slot, drop back to batch 1 now: resizing later would reallocate
+            // the tensor and lose what the caller writes through the returned pointer
+            if (mInterpreter && mBatchSize != 1 && !resizeBatch(1))
+            {
+                LOG_ERROR("Failed to restore batch size 1.");
+                if (size)
+                {
+                    *size = 0;
+                }
+                return nullptr;
+            }
+            if (size)
+            {
+                *size = (mInputTensor != nullptr) ? mTensorFormatSettings.inputWidth * mTensorFormatSettings.inputHeight * mTensorFormatSettings.noOfChannels : 0;
+            }
+            return mInputTensor;
+        }
+
         DetectionOutput TensorLiteRunner::runModelInterface(uint8_t *inputFrame)
         {
-            // Simulated processing
-            DetectionOutput results;
-            tflite::Interpreter *interpreter = mInterpreter.get();
-            if (nullptr != interpreter)
+            if (mBatchSize != 1)
             {
-                if (mInputTensor == nullptr)
+                // A pointer from getInputBuffer() always sees batch 1, so this input is a caller's own buffer
+                if (inputFrame == mInputTensor)
                 {
-                    LOG_ERROR("Failed to access input tensor.");
-                    return results;
+                    LOG_ERROR("Input tensor was written while a batch was allocated.");
+                    return DetectionOutput();
+                }
+                // Resize first, reallocating the input after the copy would lose the frame
+                if (!resizeBatch(1))
+                {
+                    return DetectionOutput();
                 }
-                // printf("modelInput runModelInterface(%p)\n", inputFrame);
+            }
+            if (mInputTensor == nullptr)
+            {
+                LOG_ERROR("Failed to access input tensor.");
+                return DetectionOutput();
+            }
+            // Input that was preprocessed in place via getInputBuffer() needs no copy
+            if (inputFrame != mInputTensor)
+            {
                 size_t expectedSize = mTensorFormatSettings.inputWidth * mTensorFormatSettings.inputHeight * mTensorFormatSettings.noOfChannels;
-                //size_t expectedSize = 224 * 224 * 3;
-                std::memset(mInputTensor, 0, expectedSize);
                 std::memcpy(mInputTensor, inputFrame, expectedSize);
-                // Run inference
-                if (interpreter->Invoke() != kTfLiteOk)
+            }
+            return runModelInterface();
+        }
+
+        DetectionOutput TensorLiteRunner::runModelInterface()
+        {
+            DetectionOutput results;
+            tflite::Interpreter *interpreter = mInterpreter.get();
+            if (nullptr != interpreter)
+            {
+                // Resizing here would reallocate the tensor and discard the input already written
+                if (mBatchSize != 1)
                 {
-                    LOG_ERROR("Failed to invoke TensorFlow Lite interpreter");
+                    LOG_ERROR("Input tensor holds a batch of " << mBatchSize << ", fetch it with getInputBuffer() before a single run.");
                     return results;
                 }
-
-                int num_outputs = interpreter->outputs().size();
-                LOG_INFO("num_outputs=" << num_outputs);
-
-                if (4 == num_outputs)
+                if (mInputTensor == nullptr)
                 {
-                    float *bboxes = interpreter->typed_output_tensor<float>(0);         // [1,10,4]
-                    float *classes = interpreter->typed_output_tensor<float>(1);        // [1,10]
-                    float *scores = interpreter->typed_output_tensor<float>(2);         // [1,10]
-                    float *num_detections = interpreter->typed_output_tensor<float>(3); // [1]
-
-                    int actual_detections = static_cast<int>(*num_detections);
-                    LOG_INFO("Number of detections: " << actual_detections);
-                    results.noOfBoxes = actual_detections;
-
-                    for (int i = 0; i < actual_detections; ++i)
-                    {
-                        LOG_DEBUG("Detection " << i + 1 << ": ");
-                        LOG_DEBUG("  Class ID: " << classes[i]);
-                        LOG_DEBUG("  Score: " << scores[i]);
-                        LOG_DEBUG("  BBox: [" << bboxes[i * 4 + 0] << ", " << bboxes[i * 4 + 1] << ", "
-                                              << bboxes[i * 4 + 2] << ", " << bboxes[i * 4 + 3] << "]");
-                        BoxPrediction prediction;
-                        prediction.x_min = bboxes[i * 4 + 0];// * mTensorFormatSettings.inputWidth;
-                        prediction.y_min = bboxes[i * 4 + 1];// * mTensorFormatSettings.inputHeight;
-                        prediction.x_max = bboxes[i * 4 + 2];// * mTensorFormatSettings.inputWidth;
-                        prediction.y_max = bboxes[i * 4 + 3];//* mTensorFormatSettings.inputHeight;
-                        switch ((int)classes[i])
-                        {
-                        case 1:
-                            prediction.class_id = PERSON;
-                            break;
-                        case 2:
-                            prediction.class_id = DELIVERY;
-                        default:
-                            prediction.class_id = UNKNOWN;
-                            break;
-                        }
-                        prediction.confidence = scores[i];
-                        results.predictions.push_back(prediction);
-                    }
+                    LOG_ERROR("Failed to access input tensor.");
+                    return results;
                 }
-                if (1 == num_outputs)
+                if (!invoke())
                 {
-                    uint8_t *output = interpreter->typed_output_tensor<uint8_t>(0); // [1,2]
-                    // Retrieve quantization parameters
-                    auto quant_params = interpreter->tensor(interpreter->outputs()[0])->params;
-                    float scale = quant_params.scale;
-                    int zero_point = quant_params.zero_point;
-
-                    // Dequantize the output
-                    float real_output[2]; // Assuming output size is 2
-                    for (int i = 0; i < 2; ++i)
-                    {
-                        real_output[i] = (output[i] - zero_point) * scale;
-                    }
-                    float sum = real_output[0] + real_output[1];
-                    float probabilities[2];
-
-                    for (int i = 0; i < 2; ++i)
-                    {
-                        probabilities[i] = real_output[i] / sum;
-                        BoxPrediction prediction{0};
-                        prediction.class_id = DELIVERY;
-                        prediction.confidence = probabilities[i];
-                        results.predictions.push_back(prediction);
-                    }
+                    return results;
                 }
+                results = parseOutputs(0);
 #if 0
                 // Iterate over all output tensors
                 for (int i = 0; i < num_outputs; ++i)
@@ -145,6 +137,161 @@ namespace camera
             return results;
         }
 
+        std::vector<DetectionOutput> TensorLiteRunner::runModelInterfaceBatch(const std::vector<uint8_t *> &inputFrames)
+        {
+            std::vector<DetectionOutput> results;
+            if (inputFrames.empty() || nullptr == mInterpreter)
+            {
+                return results;
+            }
+            if (!resizeBatch(static_cast<int>(inputFrames.size())))
+            {
+                LOG_ERROR("Batch of " << inputFrames.size() << " not supported, running one by one");
+                return ModelProcessor::runModelInterfaceBatch(inputFrames);
+            }
+            size_t frameSize = mTensorFormatSettings.inputWidth * mTensorFormatSettings.inputHeight * mTensorFormatSettings.noOfChannels;
+            for (size_t i = 0; i < inputFrames.size(); ++i)
+            {
+                std::memcpy(mInputTensor + i * frameSize, inputFrames[i], frameSize);
+            }
+            if (!invoke())
+            {
+                return results;
+            }
+            results.reserve(inputFrames.size());
+            for (int i = 0; i < mBatchSize; ++i)
+            {
+                results.push_back(parseOutputs(i));
+            }
+            return results;
+        }
+
+        bool TensorLiteRunner::invoke()
+        {
+            auto tstart = std::chrono::steady_clock::now();
+            TfLiteStatus status;
+            {
+                PERF_SCOPE("invoke");
+                status = mInterpreter->Invoke();
+            }
+            if (status != kTfLiteOk)
+            {
+                LOG_ERROR("Failed to invoke TensorFlow Lite interpreter");
+                return false;
+            }
+            mInvokeStats.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - tstart).count());
+            // The runner does not know which frames are in the batch, only the duration is traced
+            PipelineTracer::instance().record(TRACE_INVOKE, mInvokeStats.lastUs);
+            LOG_DEBUG("Invoke (batch " << mBatchSize << ") took " << mInvokeStats.lastUs << " us (avg " << mInvokeStats.averageUs() << " us over " << mInvokeStats.count << " runs)");
+            return true;
+        }
+
+        /**
+         * Resizes the batch dimension of the input tensor. Tensors are reallocated, so a pointer handed
+         * out by getInputBuffer() is stale after a batch run; getInputBuffer() resizes back to 1 before
+         * returning the pointer, and single runs never resize over input that was written in place.
+         */
+        bool TensorLiteRunner::resizeBatch(int batchSize)
+        {
+            if (batchSize == mBatchSize)
+            {
+                return true;
+            }
+            int input = mInterpreter->inputs()[0];
+            const TfLiteIntArray *shape = mInterpreter->tensor(input)->dims;
+            std::vector<int> dims(shape->data, shape->data + shape->size);
+            dims[0] = batchSize;
+            if (mInterpreter->ResizeInputTensor(input, dims) != kTfLiteOk || mInterpreter->AllocateTensors() != kTfLiteOk)
+            {
+                // Restore the previous shape so that the interpreter stays usable
+                dims[0] = mBatchSize;
+                mInterpreter->ResizeInputTensor(input, dims);
+                mInterpreter->AllocateTensors();
+                mInputTensor = mInterpreter->typed_input_tensor<uint8_t>(0);
+                return false;
+            }
+            mBatchSize = batchSize;
+            mInputTensor = mInterpreter->typed_input_tensor<uint8_t>(0);
+            return true;
+        }
+
+        DetectionOutput TensorLiteRunner::parseOutputs(int batchIndex)
+        {
+            DetectionOutput results;
+            tflite::Interpreter *interpreter = mInterpreter.get();
+            int num_outputs = interpreter->outputs().size();
+            LOG_DEBUG("num_outputs=" << num_outputs);
+
+            if (4 == num_outputs)
+            {
+                int maxDetections = interpreter->output_tensor(2)->dims->data[1];
+                float *bboxes = interpreter->typed_output_tensor<float>(0) + batchIndex * maxDetections * 4; // [N,10,4]
+                float *classes = interpreter->typed_output_tensor<float>(1) + batchIndex * maxDetections;    // [N,10]
+                float *scores = interpreter->typed_output_tensor<float>(2) + batchIndex * maxDetections;     // [N,10]
+                float *num_detections = interpreter->typed_output_tensor<float>(3) + batchIndex;             // [N]
+
+                int actual_detections = static_cast<int>(*num_detections);
+                LOG_DEBUG("Number of detections: " << actual_detections);
+                results.noOfBoxes = actual_detections;
+                results.isValid = true;
+
+                for (int i = 0; i < actual_detections; ++i)
+                {
+                    LOG_DEBUG("Detection " << i + 1 << ": ");
+                    LOG_DEBUG("  Class ID: " << classes[i]);
+                    LOG_DEBUG("  Score: " << scores[i]);
+                    LOG_DEBUG("  BBox: [" << bboxes[i * 4 + 0] << ", " << bboxes[i * 4 + 1] << ", "
+                                          << bboxes[i * 4 + 2] << ", " << bboxes[i * 4 + 3] << "]");
+                    BoxPrediction prediction;
+                    prediction.x_min = bboxes[i * 4 + 0];// * mTensorFormatSettings.inputWidth;
+                    prediction.y_min = bboxes[i * 4 + 1];// * mTensorFormatSettings.inputHeight;
+                    prediction.x_max = bboxes[i * 4 + 2];// * mTensorFormatSettings.inputWidth;
+                    prediction.y_max = bboxes[i * 4 + 3];//* mTensorFormatSettings.inputHeight;
+                    switch ((int)classes[i])
+                    {
+                    case 1:
+                        prediction.class_id = PERSON;
+                        break;
+                    case 2:
+                        prediction.class_id = DELIVERY;
+                    default:
+                        prediction.class_id = UNKNOWN;
+                        break;
+                    }
+                    prediction.confidence = scores[i];
+                    results.predictions.push_back(prediction);
+                }
+            }
+            if (1 == num_outputs)
+            {
+                uint8_t *output = interpreter->typed_output_tensor<uint8_t>(0) + batchIndex * 2; // [N,2]
+                // Retrieve quantization parameters
+                auto quant_params = interpreter->tensor(interpreter->outputs()[0])->params;
+                float scale = quant_params.scale;
+                int zero_point = quant_params.zero_point;
+
+                // Dequantize the output
+                float real_output[2]; // Assuming output size is 2
+                for (int i = 0; i < 2; ++i)
+                {
+                    real_output[i] = (output[i] - zero_point) * scale;
+                }
+                float sum = real_output[0] + real_output[1];
+                float probabilities[2];
+
+                for (int i = 0; i < 2; ++i)
+                {
+                    probabilities[i] = real_output[i] / sum;
+                    BoxPrediction prediction{0};
+                    prediction.class_id = DELIVERY;
+                    prediction.confidence = probabilities[i];
+                    results.predictions.push_back(prediction);
+                }
+                results.isValid = true;
+            }
+            return results;
+        }
+
         int TensorLiteRunner::Load(void)
         {
             mModel = tflite::FlatBufferModel::BuildFromFile(mModelPath.c_str());
@@ -153,7 +300,8 @@ namespace camera
                 LOG_ERROR("Failed to load model");
                 return -1;
             }
-            tflite::ops::builtin::BuiltinOpResolver resolver;
+            // The default delegates would bring their own XNNPACK thread pool, the shared one is applied below.
+            tflite::ops::builtin::BuiltinOpResolverWithoutDefaultDelegates resolver;
             tflite::InterpreterBuilder builder(*mModel, resolver);
             builder(&mInterpreter);
             if (!mInterpreter)
@@ -162,6 +310,30 @@ namespace camera
                 return -1;
             }
 
+            TfLiteBackend &backend = TfLiteBackend::instance();
+            mInterpreter->SetExternalContext(kTfLiteCpuBackendContext, backend.cpuBackendContext());
+            mInterpreter->SetNumThreads(backend.config().numThreads);
+            if (backend.config().useXnnpack)
+            {
+                // Packed weights are reused from disk when a cache for this exact model file exists
+                const tflite::Allocation *allocation = mModel->allocation();
+                if (allocation != nullptr)
+                {
+                    mWeightCachePath = backend.weightCachePath(mModelPath, allocation->base(), allocation->bytes());
+                }
+                struct stat statbuf;
+                mWeightCacheWarm = !mWeightCachePath.empty() && stat(mWeightCachePath.c_str(), &statbuf) == 0 && statbuf.st_size > 0;
+                mDelegate = backend.createXnnpackDelegate(mInterpreter->primary_subgraph().context(), mWeightCachePath);
+            }
+            if (mDelegate)
+            {
+                mDelegated = (mInterpreter->ModifyGraphWithDelegate(mDelegate.get()) == kTfLiteOk);
+                if (!mDelegated)
+                {
+                    LOG_ERROR("Failed to apply the XNNPACK delegate, running on builtin kernels");
+                }
+            }
+
             if (mInterpreter->AllocateTensors() != kTfLiteOk)
             {
                 LOG_ERROR("Failed to allocate tensors");
@@ -301,8 +473,11 @@ namespace camera
         void TensorLiteRunner::PrintStats(void)
         {
             LOG_INFO("Performance Stats:" << mModelPath);
-            LOG_INFO("    Module Load              :" << r_module_load_ms << " ms");
-            LOG_INFO("Total Load Time     :" << r_module_load_ms << " ms");
+            LOG_INFO("    Module Load              :" << r_module_load_ms << " ms (" << (mWeightCacheWarm ? "warm" : "cold") << ")");
+            LOG_INFO("    Weight Cache             :" << (mWeightCachePath.empty() ? "disabled" : mWeightCachePath));
+            LOG_INFO("    XNNPACK                  :" << std::boolalpha << mDelegated << ", threads " << TfLiteBackend::instance().config().numThreads);
+            LOG_INFO("    Invoke (last/min/max/avg):" << mInvokeStats.lastUs << "/" << mInvokeStats.minUs << "/" << mInvokeStats.maxUs << "/"
+                                                      << mInvokeStats.averageUs() << " us over " << mInvokeStats.count << " runs");
         }
 
         /**
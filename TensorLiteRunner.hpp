@@ -19,20 +19,59 @@ namespace camera
             size_t size;
             TensorInfo() : index(-1), type(kTfLiteNoType), found(false) ,size(){}
         };
+        /**
+         * @struct InvokeStats
+         * @brief Latency of Interpreter::Invoke, in microseconds.
+         */
+        struct InvokeStats
+        {
+            uint64_t count;
+            int64_t lastUs;
+            int64_t minUs;
+            int64_t maxUs;
+            int64_t totalUs;
+            InvokeStats() : count(0), lastUs(0), minUs(0), maxUs(0), totalUs(0) {}
+            void add(int64_t us)
+            {
+                minUs = (count == 0) ? us : std::min(minUs, us);
+                maxUs = std::max(maxUs, us);
+                lastUs = us;
+                totalUs += us;
+                ++count;
+            }
+            int64_t averageUs() const
+            {
+                return count ? static_cast<int64_t>(totalUs / count) : 0;
+            }
+        };
         class TensorLiteRunner : public ModelProcessor
         {
         public:
             TensorLiteRunner(const std::string &path, const std::string &device);
+            ~TensorLiteRunner() override;
             int initializeModelInterface() override;
             DetectionOutput runModelInterface(uint8_t *inputFrame) override;
+            DetectionOutput runModelInterface() override;
+            uint8_t *getInputBuffer(size_t *size) override;
+            std::vector<DetectionOutput> runModelInterfaceBatch(const std::vector<uint8_t *> &inputFrames) override;
 
         private:
-            std::unique_ptr<tflite::Interpreter> mInterpreter;
+            // Declared first so that it outlives the interpreter it is applied to.
+            std::unique_ptr<TfLiteDelegate, void (*)(TfLiteDelegate *)> mDelegate;
             std::unique_ptr<tflite::FlatBufferModel> mModel;
+            std::unique_ptr<tflite::Interpreter> mInterpreter;
             uint8_t* mInputTensor;
             float* mOutputTensor;
             int r_module_load_ms{0};
+            int mBatchSize{1};
+            bool mDelegated{false};
+            bool mWeightCacheWarm{false};
+            std::string mWeightCachePath;
+            InvokeStats mInvokeStats;
             int Load(void);
+            bool invoke();
+            bool resizeBatch(int batchSize);
+            DetectionOutput parseOutputs(int batchIndex);
             size_t GetTensorSize(tflite::Interpreter *interpreter, int tensor_index);
             TensorInfo GetTensorInfoByName(tflite::Interpreter* interpreter, const std::string& tensor_name);
             bool compare_confidence(const BoxPrediction &a, const BoxPrediction &b);
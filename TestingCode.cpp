@@ -271,7 +271,7 @@ struct SurveillanceFrame
                         uint8_t *rawInput = mCameraFrameHandler->resizeNormalizeQuantize(raw, mDeliveryModelParams);
                         if (rawInput)
                         {
-                            LOG_INFO("Caching (" << static_cast<void *>(rawInput) << ") for delivery!!")
+                            LOG_INFO("Caching (" << static_cast<void *>(rawInput) << ") for delivery!!");
                             std::shared_ptr<uint8_t[]> dModelInput(rawInput); // Wrap the raw pointer in a smart pointer
                             m_rb->add(ModelData(std::move(dModelInput), bestPrediction->confidence));
                         }
@@ -0,0 +1,152 @@
+#include "TfLiteBackend.hpp"
+#include "Logger.hpp"
+#include <tensorflow/lite/delegates/xnnpack/xnnpack_delegate.h>
+#include <tensorflow/lite/kernels/cpu_backend_context.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <dirent.h>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        bool ExecutionConfig::loadConfig(const std::string &configFile)
+        {
+            std::ifstream file(configFile);
+            if (!file.is_open())
+            {
+                return false;
+            }
+            std::map<std::string, std::string> properties;
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream iss(line);
+                std::string key, value;
+                if (std::getline(iss, key, '=') && std::getline(iss, value))
+                {
+                    properties[key] = value;
+                }
+            }
+            try
+            {
+                if (properties.count("xnnpack"))
+                {
+                    useXnnpack = (std::stoi(properties["xnnpack"]) != 0);
+                }
+                if (properties.count("threads"))
+                {
+                    numThreads = std::stoi(properties["threads"]);
+                }
+                if (properties.count("cache_dir"))
+                {
+                    cacheDir = properties["cache_dir"];
+                }
+            }
+            catch (const std::exception &e)
+            {
+                LOG_ERROR("Invalid value in " << configFile << ": " << e.what());
+                return false;
+            }
+            return true;
+        }
+
+        TfLiteBackend &TfLiteBackend::instance()
+        {
+            static TfLiteBackend backend;
+            return backend;
+        }
+
+        TfLiteBackend::TfLiteBackend()
+            : mConfig(), mCpuBackendContext(new tflite::ExternalCpuBackendContext())
+        {
+            if (!mConfig.loadConfig(INFERENCE_CONF_PATH))
+            {
+                LOG_INFO("Using default inference settings, " << INFERENCE_CONF_PATH << " not loaded");
+            }
+            int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+            mConfig.numThreads = std::clamp(mConfig.numThreads, 1, cores);
+            mCpuBackendContext->set_internal_backend_context(std::make_unique<tflite::CpuBackendContext>());
+            LOG_INFO("Inference execution - XNNPACK: " << std::boolalpha << mConfig.useXnnpack << ", threads: " << mConfig.numThreads);
+        }
+
+        DelegatePtr TfLiteBackend::createXnnpackDelegate(TfLiteContext *context, const std::string &weightCachePath)
+        {
+            DelegatePtr delegate(nullptr, TfLiteXNNPackDelegateDelete);
+            if (!mConfig.useXnnpack)
+            {
+                return delegate;
+            }
+            TfLiteXNNPackDelegateOptions options = TfLiteXNNPackDelegateOptionsDefault();
+            options.num_threads = mConfig.numThreads;
+            // Our models take asymmetric uint8 input, which XNNPACK only handles when asked to.
+            options.flags |= TFLITE_XNNPACK_DELEGATE_FLAG_QU8;
+            if (!weightCachePath.empty())
+            {
+                options.experimental_weight_cache_file_path = weightCachePath.c_str();
+            }
+            // Takes the pthreadpool from the CPU backend context of the interpreter, i.e. the shared one.
+            delegate.reset(TfLiteXNNPackDelegateCreateWithThreadpool(&options, context));
+            if (!delegate)
+            {
+                LOG_ERROR("Failed to create the XNNPACK delegate, falling back to builtin kernels");
+            }
+            return delegate;
+        }
+
+        std::string TfLiteBackend::weightCachePath(const std::string &modelPath, const void *modelData, size_t modelSize)
+        {
+            if (mConfig.cacheDir.empty() || modelData == nullptr)
+            {
+                return std::string();
+            }
+            if (mkdir(mConfig.cacheDir.c_str(), 0755) != 0 && errno != EEXIST)
+            {
+                LOG_ERROR("Weight cache disabled, cannot create " << mConfig.cacheDir);
+                return std::string();
+            }
+            if (access(mConfig.cacheDir.c_str(), W_OK) != 0)
+            {
+                LOG_ERROR("Weight cache disabled, " << mConfig.cacheDir << " is not writable");
+                return std::string();
+            }
+
+            // FNV-1a over the model file, a new model version gets a new cache file
+            uint64_t hash = 14695981039346656037ULL;
+            const uint8_t *bytes = static_cast<const uint8_t *>(modelData);
+            for (size_t i = 0; i < modelSize; ++i)
+            {
+                hash = (hash ^ bytes[i]) * 1099511628211ULL;
+            }
+            size_t slash = modelPath.find_last_of('/');
+            std::string baseName = (slash == std::string::npos) ? modelPath : modelPath.substr(slash + 1);
+            std::ostringstream name;
+            name << baseName << "-" << std::hex << std::setw(16) << std::setfill('0') << hash << ".xnnpack_cache";
+            std::string fileName = name.str();
+
+            if (DIR *dir = opendir(mConfig.cacheDir.c_str()))
+            {
+                std::string prefix = baseName + "-";
+                while (struct dirent *entry = readdir(dir))
+                {
+                    std::string entryName(entry->d_name);
+                    if (entryName != fileName && entryName.compare(0, prefix.size(), prefix) == 0)
+                    {
+                        LOG_INFO("Removing stale weight cache " << entryName);
+                        std::remove((mConfig.cacheDir + "/" + entryName).c_str());
+                    }
+                }
+                closedir(dir);
+            }
+            return mConfig.cacheDir + "/" + fileName;
+        }
+    }
+}
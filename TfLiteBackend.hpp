@@ -0,0 +1,84 @@
+#ifndef TFLITE_BACKEND_HPP
+#define TFLITE_BACKEND_HPP
+
+#include <tensorflow/lite/c/common.h>
+#include <tensorflow/lite/external_cpu_backend_context.h>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        constexpr const char *INFERENCE_CONF_PATH = "/opt/usr_config/inference.conf";
+        constexpr const char *WEIGHT_CACHE_DIR = "/opt/usr_cache/xnnpack";
+
+        /**
+         * @struct ExecutionConfig
+         * @brief How TFLite models are executed, read from a key=value file.
+         *
+         * Keys: xnnpack (0/1), threads (worker threads of the shared pool),
+         * cache_dir (writable directory for packed weights, empty disables the cache).
+         */
+        struct ExecutionConfig
+        {
+            bool useXnnpack;
+            int numThreads;
+            std::string cacheDir;
+
+            // Two threads leave the other A53 cores to capture, thumbnail encoding and upload.
+            ExecutionConfig() : useXnnpack(true), numThreads(2), cacheDir(WEIGHT_CACHE_DIR) {}
+            bool loadConfig(const std::string &configFile);
+        };
+
+        using DelegatePtr = std::unique_ptr<TfLiteDelegate, void (*)(TfLiteDelegate *)>;
+
+        /**
+         * @brief Process wide execution resources shared by every TensorLiteRunner.
+         *
+         * Holds one external CPU backend context, which owns both the ruy pool of the builtin
+         * kernels and the pthreadpool XNNPACK runs on. Each model gets its own XNNPACK delegate
+         * (so it can have its own weight cache) but every delegate runs on that one pthreadpool.
+         * Interpreters sharing the pool must not be invoked concurrently.
+         */
+        class TfLiteBackend
+        {
+        public:
+            static TfLiteBackend &instance();
+
+            const ExecutionConfig &config() const
+            {
+                return mConfig;
+            }
+            tflite::ExternalCpuBackendContext *cpuBackendContext()
+            {
+                return mCpuBackendContext.get();
+            }
+            /**
+             * @brief Creates an XNNPACK delegate bound to the shared pool of @p context.
+             * @param context Context of an interpreter attached to cpuBackendContext().
+             * @param weightCachePath Packed weights file, loaded if present and written otherwise. May be empty.
+             * @return The delegate, or an empty pointer if XNNPACK is disabled or failed to create.
+             */
+            DelegatePtr createXnnpackDelegate(TfLiteContext *context, const std::string &weightCachePath);
+            /**
+             * @brief Returns the weight cache file of a model, named after the FNV-1a hash of its contents.
+             *
+             * Cache files left behind by older versions of the same model are removed.
+             * @return The path, or an empty string if no writable cache directory is available.
+             */
+            std::string weightCachePath(const std::string &modelPath, const void *modelData, size_t modelSize);
+
+        private:
+            TfLiteBackend();
+            TfLiteBackend(const TfLiteBackend &) = delete;
+            TfLiteBackend &operator=(const TfLiteBackend &) = delete;
+
+            ExecutionConfig mConfig;
+            std::unique_ptr<tflite::ExternalCpuBackendContext> mCpuBackendContext;
+        };
+    }
+}
+#endif // TFLITE_BACKEND_HPP
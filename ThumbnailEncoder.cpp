@@ -0,0 +1,58 @@
+#include "ThumbnailEncoder.hpp"
+#include "Logger.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        ThumbnailEncoder::ThumbnailEncoder()
+        {
+            mCompressor = tjInitCompress();
+            if (!mCompressor)
+            {
+                LOG_ERROR("Failed to create the JPEG compressor: " << tjGetErrorStr());
+            }
+        }
+
+        ThumbnailEncoder::~ThumbnailEncoder()
+        {
+            if (mCompressor)
+            {
+                tjDestroy(mCompressor);
+            }
+        }
+
+        bool ThumbnailEncoder::encode(const uint8_t *raw, int width, int height, const SourceRect &src, int newWidth, int newHeight, int quality, std::vector<uint8_t> *jpeg)
+        {
+            if (!raw || !jpeg || width <= 0 || height <= 0 || newWidth <= 0 || newHeight <= 0)
+            {
+                LOG_ERROR("Invalid input dimensions or raw data.");
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mEncoderMutex);
+            if (!mCompressor)
+            {
+                return false;
+            }
+            const size_t lumaSize = static_cast<size_t>(newWidth) * newHeight;
+            const size_t chromaSize = static_cast<size_t>((newWidth + 1) / 2) * ((newHeight + 1) / 2);
+            mPlanes.resize(lumaSize + 2 * chromaSize);
+            uint8_t *planes[3] = {mPlanes.data(), mPlanes.data() + lumaSize, mPlanes.data() + lumaSize + chromaSize};
+            nv12CropResizeToI420(raw, raw + static_cast<size_t>(width) * height, width, height, src, planes[0], planes[1], planes[2], newWidth, newHeight, true);
+
+            // Compress straight into the caller's buffer, sized for the worst case so turbojpeg never reallocates it
+            jpeg->resize(tjBufSize(newWidth, newHeight, TJSAMP_420));
+            unsigned char *jpegBuffer = jpeg->data();
+            unsigned long jpegSize = jpeg->size();
+            const unsigned char *srcPlanes[3] = {planes[0], planes[1], planes[2]};
+            if (tjCompressFromYUVPlanes(mCompressor, srcPlanes, newWidth, nullptr, newHeight, TJSAMP_420, &jpegBuffer, &jpegSize, quality, TJFLAG_NOREALLOC) != 0)
+            {
+                LOG_ERROR("JPEG compression failed: " << tjGetErrorStr2(mCompressor));
+                jpeg->clear();
+                return false;
+            }
+            jpeg->resize(jpegSize);
+            return true;
+        }
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef THUMBNAIL_ENCODER_HPP
+#define THUMBNAIL_ENCODER_HPP
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <turbojpeg.h>
+#include "FrameKernels.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        constexpr int THUMBNAIL_JPEG_QUALITY = 95;
+
+        /**
+         * @brief Encodes a region of an NV12 frame to JPEG without going through RGB.
+         *
+         * The region is resampled into planar YUV 4:2:0, which is what JPEG stores anyway, and
+         * handed to libjpeg-turbo's YUV plane API. The plane scratch buffer and the compressor are
+         * kept between calls, so steady-state encodes do not allocate beyond growing the output.
+         */
+        class ThumbnailEncoder
+        {
+        public:
+            ThumbnailEncoder();
+            ~ThumbnailEncoder();
+            ThumbnailEncoder(const ThumbnailEncoder &) = delete;
+            ThumbnailEncoder &operator=(const ThumbnailEncoder &) = delete;
+
+            /**
+             * @brief Encodes @p src of the NV12 frame, scaled to newWidth x newHeight, into @p jpeg.
+             * @param raw NV12 frame, Y plane followed by the interleaved UV plane.
+             * @return false if the arguments are invalid or compression failed.
+             */
+            bool encode(const uint8_t *raw, int width, int height, const SourceRect &src, int newWidth, int newHeight, int quality, std::vector<uint8_t> *jpeg);
+
+        private:
+            tjhandle mCompressor;
+            std::vector<uint8_t> mPlanes;
+            std::mutex mEncoderMutex;
+        };
+    }
+}
+#endif // THUMBNAIL_ENCODER_HPP
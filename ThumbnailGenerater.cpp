@@ -7,68 +7,390 @@ namespace camera
 {
     namespace camera_ml
     {
-        ThumbnailGenerater::ThumbnailGenerater(CameraFrameHandler *cameraFrameHandler, const std::string &configFile) : mCameraFrameHandler(cameraFrameHandler)
+        ThumbnailGenerater::ThumbnailGenerater(CameraFrameHandler *cameraFrameHandler, const std::string &configFile) : mCameraFrameHandler(cameraFrameHandler), mUploadSequence(0), mLastUploadTime(0)
         {
+            // Used when the config cannot be read
+            isEnabled = false;
+            mQuiteInterval = 120;
+            mSpoolPath = THUMBNAIL_SPOOL_PATH;
+            mSpoolBytes = SPOOL_DEFAULT_BYTES;
+            mWidth = 400;
+            mHeight = 300;
+            mQuality = THUMBNAIL_JPEG_QUALITY;
             // Load configuration from the specified file
             if (!loadConfig(configFile))
             {
                 std::cerr << "Failed to load config from: " << configFile << std::endl;
             }
-            keepRunning = true;
-            readyToUpload = false;
+            if (isEnabled && !mUploadUrl.empty())
+            {
+                mUploadEngine.reset(new UploadEngine(mUploadUrl, mAuth));
+                mSpool.reset(new ThumbnailSpool(mSpoolPath, mSpoolBytes));
+                if (mSpool->open() != 0)
+                {
+                    LOG_ERROR("Thumbnail spool unavailable, failed uploads will be lost");
+                    mSpool.reset();
+                }
+            }
+            else
+            {
+                LOG_INFO("Thumbnail upload disabled");
+            }
+            keepEncoding = true;
+            keepReplaying = true;
+            mReplayWanted = false;
+            mReplayPending = 0;
+            mSubmittedSequence = 0;
+            mDiscardedSequence = 0;
+            mEncodedSequence = 0;
+        }
+
+        ThumbnailGenerater::~ThumbnailGenerater()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mReplayMutex);
+                keepReplaying = false;
+            }
+            mReplayCV.notify_all();
+            if (mReplayThread.joinable())
+            {
+                mReplayThread.join();
+            }
+            // Stopped before the rest, its completion callbacks use this object. Uploads left in the engine
+            // complete as cancelled during stop() and are spooled; the callbacks still use the engine
+            if (mUploadEngine)
+            {
+                mUploadEngine->stop();
+            }
+            mUploadEngine.reset();
+            {
+                std::lock_guard<std::mutex> lock(mEncodeMutex);
+                keepEncoding = false;
+            }
+            mEncodeCV.notify_all();
+            if (mEncodeThread.joinable())
+            {
+                mEncodeThread.join();
+            }
+        }
+
+        bool ThumbnailGenerater::generateThumbnail(PayLoadMetaData &&payLoadMetaData)
+        {
+            if (!mUploadEngine || payLoadMetaData.jpegData.empty())
+            {
+                return false;
+            }
+            UploadJob job;
+            job.id = ++mUploadSequence;
+            job.body = std::move(payLoadMetaData.jpegData);
+            job.fileName = payLoadMetaData.fileName + ".jpg";
+            job.fields.emplace_back("clip", payLoadMetaData.fileName);
+            job.fields.emplace_back("motionTime", std::to_string(payLoadMetaData.motionTime));
+            job.fields.emplace_back("tsDelta", std::to_string(payLoadMetaData.tsDelta));
+            auto boxText = [](const BoundingBox &box)
+            {
+                return std::to_string(box.boundingBoxXOrd) + "," + std::to_string(box.boundingBoxYOrd) + "," +
+                       std::to_string(box.boundingBoxWidth) + "," + std::to_string(box.boundingBoxHeight);
+            };
+            job.fields.emplace_back("unionBox", boxText(payLoadMetaData.unionBox));
+            job.fields.emplace_back("croppedBox", boxText(payLoadMetaData.croppedBoundingBox));
+            std::string objectBoxes;
+            for (int i = 0; i < UPPER_LIMIT_BLOB_BB; i++)
+            {
+                if (payLoadMetaData.objectBoxes[i].boundingBoxWidth <= 0 || payLoadMetaData.objectBoxes[i].boundingBoxHeight <= 0)
+                {
+                    continue;
+                }
+                objectBoxes += (objectBoxes.empty() ? "" : ";") + boxText(payLoadMetaData.objectBoxes[i]);
+            }
+            job.fields.emplace_back("objectBoxes", objectBoxes);
+            int64_t framePTS = payLoadMetaData.framePTS;
+            job.onComplete = [this, framePTS](const UploadResult &result, UploadJob &failedJob)
+            {
+                if (result.ok())
+                {
+                    PipelineTracer::instance().record(TRACE_UPLOAD, result.latencyUs, framePTS);
+                }
+                onUploadComplete(result);
+                if (result.retryable())
+                {
+                    spoolUpload(failedJob);
+                }
+            };
+            LOG_INFO("Uploading thumbnail " << job.id << " of " << payLoadMetaData.fileName << ", " << job.body.size() << " bytes");
+            if (mUploadEngine->submit(std::move(job)))
+            {
+                return true;
+            }
+            if (!mSpool)
+            {
+                return false;
+            }
+            spoolUpload(job);
+            return true;
+        }
+
+        void ThumbnailGenerater::spoolUpload(const UploadJob &job)
+        {
+            if (!mSpool)
+            {
+                return;
+            }
+            if (mSpool->append(job))
+            {
+                LOG_INFO("Thumbnail " << job.id << " spooled, " << mSpool->size() << " waiting for replay");
+            }
+        }
+
+        void ThumbnailGenerater::requestReplay()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mReplayMutex);
+                mReplayWanted = true;
+            }
+            mReplayCV.notify_all();
+        }
+
+        /**
+         * Replay thread: resubmits spooled uploads oldest first, a batch at a time. It runs when an upload
+         * succeeds while the spool is not empty, and every SPOOL_RETRY_INTERVAL_S while it stays non-empty.
+         */
+        void ThumbnailGenerater::replaySpool()
+        {
+            std::vector<SpooledJob> batch;
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(mReplayMutex);
+                    mReplayCV.wait_for(lock, std::chrono::seconds(SPOOL_RETRY_INTERVAL_S), [this]
+                                       { return !keepReplaying || mReplayWanted; });
+                    if (!keepReplaying)
+                    {
+                        return;
+                    }
+                    mReplayWanted = false;
+                }
+                while (mSpool->read(SPOOL_REPLAY_BATCH, &batch) > 0 && replayBatch(batch))
+                {
+                }
+            }
+        }
+
+        /**
+         * Submits the batch and waits for all of it, then releases the acknowledged prefix from the spool
+         * with a single index write. Records after the first retryable failure stay for the next attempt.
+         * @return true if the whole batch was released.
+         */
+        bool ThumbnailGenerater::replayBatch(std::vector<SpooledJob> &batch)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mReplayMutex);
+                mReplayPending = batch.size();
+                mReplayDone.assign(batch.size(), false);
+            }
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                UploadJob job = std::move(batch[i].job);
+                job.id = ++mUploadSequence;
+                job.onComplete = [this, i](const UploadResult &result, UploadJob &)
+                {
+                    onUploadComplete(result);
+                    {
+                        std::lock_guard<std::mutex> lock(mReplayMutex);
+                        mReplayDone[i] = !result.retryable();
+                        --mReplayPending;
+                    }
+                    mReplayCV.notify_all();
+                };
+                if (!mUploadEngine->submit(std::move(job)))
+                {
+                    std::lock_guard<std::mutex> lock(mReplayMutex);
+                    --mReplayPending;
+                }
+            }
+            size_t released = 0;
+            {
+                std::unique_lock<std::mutex> lock(mReplayMutex);
+                mReplayCV.wait(lock, [this]
+                               { return !keepReplaying || mReplayPending == 0; });
+                if (!keepReplaying)
+                {
+                    return false;
+                }
+                while (released < batch.size() && mReplayDone[released])
+                {
+                    ++released;
+                }
+            }
+            if (released > 0)
+            {
+                mSpool->release(batch[released - 1].sequence);
+            }
+            SpoolStats stats = mSpool->stats();
+            LOG_INFO("Replayed " << released << "/" << batch.size() << " spooled thumbnails, " << mSpool->size() << " left; spool appended/released/dropped: "
+                                 << stats.appended << "/" << stats.released << "/" << stats.dropped << ", flash " << stats.flashBytes << " bytes for "
+                                 << stats.payloadBytes << " payload bytes, " << stats.indexWrites << " index writes");
+            return released == batch.size();
         }
 
-        void ThumbnailGenerater::generateThumbnail(PayLoadMetaData payLoadMetaData)
+        // Runs on the upload engine thread
+        void ThumbnailGenerater::onUploadComplete(const UploadResult &result)
         {
+            if (result.ok())
             {
-                std::lock_guard<std::mutex> lock(mUploadMutex);
-                readyToUpload = true;
+                auto now = std::chrono::system_clock::now();
+                mLastUploadTime = std::chrono::duration_cast<std::chrono::seconds>(now.time_since_epoch()).count();
+                // The endpoint is reachable again, drain what was spooled meanwhile
+                if (mSpool && mSpool->size() > 0)
+                {
+                    requestReplay();
+                }
             }
-            mUploadCV.notify_one();
+            UploadStats stats = mUploadEngine->stats();
+            LOG_INFO("Thumbnail " << result.id << (result.ok() ? " uploaded" : " upload failed") << " in " << result.latencyUs / 1000 << " ms (HTTP " << result.httpCode
+                                  << "), uploads ok/failed/rejected: " << stats.succeeded << "/" << stats.failed << "/" << stats.rejected
+                                  << ", avg " << (stats.succeeded ? stats.latencyTotalUs / stats.succeeded / 1000 : 0) << " ms, max " << stats.latencyMaxUs / 1000 << " ms");
         }
-        void ThumbnailGenerater::createPayLoad(uint8_t *raw, int inputWidth, int inputHeight, int newWidth, int newHeight, MotionEventMetadata metaData, std::string &clipName)
+        void ThumbnailGenerater::createPayLoad(const uint8_t *raw, int inputWidth, int inputHeight, int newWidth, int newHeight, const MotionEventMetadata &metaData, const std::string &clipName, PayLoadMetaData *payload)
         {
-            PayLoadMetaData payload = PayLoadMetaData();
-            ScalingParams params = mCameraFrameHandler->convertAndStore(raw, inputWidth, inputHeight, newWidth, newHeight, clipName, &metaData.unionBox);
-            payload.motionTime = metaData.motionEventTime;
-            
-            payload.unionBox.boundingBoxXOrd = static_cast<int>(metaData.unionBox.boundingBoxXOrd/params.scaleFactor);
-            payload.unionBox.boundingBoxYOrd = static_cast<int>(metaData.unionBox.boundingBoxYOrd/params.scaleFactor);
-            payload.unionBox.boundingBoxWidth = static_cast<int>(metaData.unionBox.boundingBoxWidth/params.scaleFactor);
-            payload.unionBox.boundingBoxHeight = static_cast<int>(metaData.unionBox.boundingBoxHeight/params.scaleFactor);
-            BoundingBox relativeBBox = getRelativeBoundingBox(payload.unionBox,params);
-            payload.unionBox.boundingBoxXOrd = relativeBBox.boundingBoxXOrd;
-            payload.unionBox.boundingBoxYOrd = relativeBBox.boundingBoxYOrd;
-            payload.unionBox.boundingBoxWidth = relativeBBox.boundingBoxWidth;
-            payload.unionBox.boundingBoxHeight = relativeBBox.boundingBoxHeight;
+            // Keep the JPEG buffer, its capacity is reused by the next encode
+            std::vector<uint8_t> jpegData = std::move(payload->jpegData);
+            payload->reset();
+            payload->jpegData = std::move(jpegData);
+            ScalingParams params = mCameraFrameHandler->encodeThumbnail(raw, inputWidth, inputHeight, newWidth, newHeight, mQuality, &payload->jpegData, &metaData.unionBox);
+            payload->motionTime = metaData.motionEventTime;
+            payload->framePTS = metaData.motionFramePTS;
+            payload->tsDelta = metaData.tsDelta;
+
+            payload->unionBox.boundingBoxXOrd = static_cast<int>(metaData.unionBox.boundingBoxXOrd/params.scaleFactor);
+            payload->unionBox.boundingBoxYOrd = static_cast<int>(metaData.unionBox.boundingBoxYOrd/params.scaleFactor);
+            payload->unionBox.boundingBoxWidth = static_cast<int>(metaData.unionBox.boundingBoxWidth/params.scaleFactor);
+            payload->unionBox.boundingBoxHeight = static_cast<int>(metaData.unionBox.boundingBoxHeight/params.scaleFactor);
+            BoundingBox relativeBBox = getRelativeBoundingBox(payload->unionBox,params);
+            payload->unionBox.boundingBoxXOrd = relativeBBox.boundingBoxXOrd;
+            payload->unionBox.boundingBoxYOrd = relativeBBox.boundingBoxYOrd;
+            payload->unionBox.boundingBoxWidth = relativeBBox.boundingBoxWidth;
+            payload->unionBox.boundingBoxHeight = relativeBBox.boundingBoxHeight;
 
             for (int i = 0; i < UPPER_LIMIT_BLOB_BB; i++)
             {
-                payload.objectBoxes[i].boundingBoxXOrd = static_cast<int>(metaData.objectBoxs[i].boundingBoxXOrd/params.scaleFactor);
-                payload.objectBoxes[i].boundingBoxYOrd = static_cast<int>(metaData.objectBoxs[i].boundingBoxYOrd/params.scaleFactor);
-                payload.objectBoxes[i].boundingBoxWidth = static_cast<int>(metaData.objectBoxs[i].boundingBoxWidth/params.scaleFactor);
-                payload.objectBoxes[i].boundingBoxHeight = static_cast<int>(metaData.objectBoxs[i].boundingBoxHeight/params.scaleFactor);
-                relativeBBox = relatigetRelativeBoundingBox(payload.objectBoxes[i],params);
-                payload.objectBoxes[i].boundingBoxXOrd = relativeBBox.boundingBoxXOrd;
-                payload.objectBoxes[i].boundingBoxYOrd = relativeBBox.boundingBoxYOrd;
-                payload.objectBoxes[i].boundingBoxWidth = relativeBBox.boundingBoxWidth;
-                payload.objectBoxes[i].boundingBoxHeight = relativeBBox.boundingBoxHeight;
+                payload->objectBoxes[i].boundingBoxXOrd = static_cast<int>(metaData.objectBoxs[i].boundingBoxXOrd/params.scaleFactor);
+                payload->objectBoxes[i].boundingBoxYOrd = static_cast<int>(metaData.objectBoxs[i].boundingBoxYOrd/params.scaleFactor);
+                payload->objectBoxes[i].boundingBoxWidth = static_cast<int>(metaData.objectBoxs[i].boundingBoxWidth/params.scaleFactor);
+                payload->objectBoxes[i].boundingBoxHeight = static_cast<int>(metaData.objectBoxs[i].boundingBoxHeight/params.scaleFactor);
+                relativeBBox = getRelativeBoundingBox(payload->objectBoxes[i],params);
+                payload->objectBoxes[i].boundingBoxXOrd = relativeBBox.boundingBoxXOrd;
+                payload->objectBoxes[i].boundingBoxYOrd = relativeBBox.boundingBoxYOrd;
+                payload->objectBoxes[i].boundingBoxWidth = relativeBBox.boundingBoxWidth;
+                payload->objectBoxes[i].boundingBoxHeight = relativeBBox.boundingBoxHeight;
             }
-            payload.croppedBoundingBox.boundingBoxXOrd = static_cast<int>((params.point2f.x - (params.size.width/2)));
-            payload.croppedBoundingBox.boundingBoxYOrd = static_cast<int>((params.point2f.y - (params.size.height/2)));
-            payload.croppedBoundingBox.boundingBoxWidth = params.size.width;
-            payload.croppedBoundingBox.boundingBoxHeight = params.size.height;
-            payload.fileName = clipName;
+            payload->croppedBoundingBox.boundingBoxXOrd = static_cast<int>((params.point2f.x - (params.size.width/2)));
+            payload->croppedBoundingBox.boundingBoxYOrd = static_cast<int>((params.point2f.y - (params.size.height/2)));
+            payload->croppedBoundingBox.boundingBoxWidth = params.size.width;
+            payload->croppedBoundingBox.boundingBoxHeight = params.size.height;
+            payload->fileName = clipName;
         }
-        void ThumbnailGenerater::createPayLoad(MotionEventMetadata metaData, uint8_t *raw, std::string &clipName)
+        void ThumbnailGenerater::submitCandidate(const FrameRef &frame, const MotionEventMetadata &metaData, const std::string &clipName)
         {
+            if (!frame)
+            {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mEncodeMutex);
+                mPendingFrame = frame;
+                mPendingMetaData = metaData;
+                mPendingClipName = clipName;
+                ++mSubmittedSequence;
+            }
+            mEncodeCV.notify_all();
+        }
 
-            payload.tsDelta = metaData.tsDelta;
+        bool ThumbnailGenerater::takePayload(PayLoadMetaData *payload)
+        {
+            std::unique_lock<std::mutex> lock(mEncodeMutex);
+            mEncodeCV.wait_for(lock, std::chrono::milliseconds(THUMBNAIL_ENCODE_WAIT_MS), [this]
+                               { return mEncodedSequence == mSubmittedSequence || mSubmittedSequence <= mDiscardedSequence; });
+            if (mEncodedSequence <= mDiscardedSequence || mEncodedPayload.jpegData.empty())
+            {
+                return false;
+            }
+            if (mEncodedSequence != mSubmittedSequence)
+            {
+                LOG_INFO("Latest thumbnail candidate still encoding, using the previous one");
+            }
+            std::swap(*payload, mEncodedPayload);
+            payload->isPayLoadReady = true;
+            // Nothing encoded so far is handed over twice
+            mDiscardedSequence = mSubmittedSequence;
+            mPendingFrame.reset();
+            return true;
+        }
+
+        void ThumbnailGenerater::discardCandidates()
+        {
+            std::lock_guard<std::mutex> lock(mEncodeMutex);
+            mPendingFrame.reset();
+            mDiscardedSequence = mSubmittedSequence;
+        }
+
+        /**
+         * Encoder thread: encodes the latest candidate outside of any lock shared with the metadata
+         * path, then publishes it unless a newer candidate has already been published or the clip ended.
+         */
+        void ThumbnailGenerater::encodeCandidates()
+        {
+            while (true)
+            {
+                FrameRef frame;
+                MotionEventMetadata metaData;
+                std::string clipName;
+                uint64_t sequence = 0;
+                {
+                    std::unique_lock<std::mutex> lock(mEncodeMutex);
+                    mEncodeCV.wait(lock, [this]
+                                   { return !keepEncoding || mPendingFrame; });
+                    if (!keepEncoding)
+                    {
+                        return;
+                    }
+                    frame = std::move(mPendingFrame);
+                    mPendingFrame.reset();
+                    metaData = mPendingMetaData;
+                    clipName = mPendingClipName;
+                    sequence = mSubmittedSequence;
+                }
+                int64_t startNs = PipelineTracer::nowNs();
+                createPayLoad(frame->data, frame->width, frame->height, mWidth, mHeight, metaData, clipName, &mWorkPayload);
+                int64_t encodeUs = (PipelineTracer::nowNs() - startNs) / 1000;
+                PipelineTracer::instance().record(TRACE_THUMBNAIL_ENCODE, encodeUs, frame->pts);
+                frame.reset(); // The slot goes back to the pool before the lock is taken
+                LOG_DEBUG("Thumbnail candidate encoded in " << encodeUs << " us, " << mWorkPayload.jpegData.size() << " bytes");
+                {
+                    std::lock_guard<std::mutex> lock(mEncodeMutex);
+                    if (sequence > mDiscardedSequence && sequence > mEncodedSequence && !mWorkPayload.jpegData.empty())
+                    {
+                        std::swap(mEncodedPayload, mWorkPayload);
+                        mEncodedSequence = sequence;
+                    }
+                }
+                mEncodeCV.notify_all();
+            }
         }
+
         void ThumbnailGenerater::start()
         {
-            upLoadThread = std::thread(&ThumbnailGenerater::upload, this);
-            upLoadThread.detach();
+            if (mUploadEngine)
+            {
+                mUploadEngine->start();
+            }
+            if (mSpool)
+            {
+                // Uploads recovered from the spool are replayed right away
+                mReplayWanted = mSpool->size() > 0;
+                mReplayThread = std::thread(&ThumbnailGenerater::replaySpool, this);
+            }
+            mEncodeThread = std::thread(&ThumbnailGenerater::encodeCandidates, this);
         }
         uint64_t ThumbnailGenerater::getLastUploadTime()
         {
@@ -117,7 +439,14 @@ namespace camera
             mQuality = std::stoi(properties["quality"]);
             mUploadUrl = properties["url"];
             mAuth = properties["auth"];
-            mQuiteInterval = 120;
+            if (properties.count("spool"))
+            {
+                mSpoolPath = properties["spool"];
+            }
+            if (properties.count("spool_kb"))
+            {
+                mSpoolBytes = static_cast<size_t>(std::stoul(properties["spool_kb"])) * 1024;
+            }
             // Output parsed values
             LOG_INFO("Enabled: " << std::boolalpha << isEnabled);
             LOG_INFO("Height: " << mHeight);
@@ -125,21 +454,10 @@ namespace camera
             LOG_INFO("Quality: " << mQuality);
             LOG_INFO("URL: " << maskString(mUploadUrl));
             LOG_INFO("Auth: " << maskString(mAuth));
+            LOG_INFO("Spool: " << mSpoolPath << ", " << mSpoolBytes / 1024 << " KB");
             return true;
         }
 
-        void ThumbnailGenerater::upload()
-        {
-            while (keepRunning)
-            {
-                {
-                    std::unique_lock<std::mutex> lock(mUploadMutex);
-                    mUploadCV.wait(lock, [this]
-                                   { return readyToUpload.load(); });
-                    readyToUpload = false;
-                }
-            }
-        }
         BoundingBox ThumbnailGenerater::getRelativeBoundingBox(BoundingBox boundRect,ScalingParams params)
         {
             BoundingBox newBBox; // to store the new bounding box co-ordinate
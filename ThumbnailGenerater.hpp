@@ -2,6 +2,10 @@
 #define __THUMBNAILGENERATER_H__
 #include "CameraFrameHandler.hpp"
 #include "MotionEventMetadata.hpp"
+#include "FramePool.hpp"
+#include "UploadEngine.hpp"
+#include "ThumbnailSpool.hpp"
+#include "PipelineTracer.hpp"
 #include <cstdint>
 #include <iostream>
 #include <chrono>
@@ -9,20 +13,28 @@
 #include <mutex>
 #include <thread>
 #include <atomic>
+#include <memory>
+#include <vector>
 constexpr int CONFIG_STRING_MAX = 256;
+// How long OnClipGenEnd waits for the encode of the latest candidate before taking the previous one
+constexpr int THUMBNAIL_ENCODE_WAIT_MS = 50;
+// Default spool location, on flash so spooled uploads survive a reboot
+constexpr const char *THUMBNAIL_SPOOL_PATH = "/opt/usr_config/tn_spool";
 namespace camera
 {
     namespace camera_ml
     {
         struct PayLoadMetaData
         {
-            std::string fileName = "";
+            std::string fileName = ""; // Clip name, the uploaded thumbnail is named after it
+            std::vector<uint8_t> jpegData; // Encoded thumbnail, kept in memory until upload
             uint64_t motionEventTime;
             uint64_t tsDelta;
 #ifdef ENABLE_DING
             uint64_t dingtstamp;
 #endif
             uint64_t motionTime;
+            int64_t framePTS = -1; // PTS of the frame the thumbnail was cut from
             char motionLog[CONFIG_STRING_MAX];
             char doiMotionLog[CONFIG_STRING_MAX];
             BoundingBox objectBoxes[UPPER_LIMIT_BLOB_BB];
@@ -44,6 +56,7 @@ namespace camera
             void reset()
             {
                 fileName.clear();
+                jpegData.clear();
                 motionEventTime = 0;
 #ifdef _HAS_DING_
                 dingtstamp = 0;
@@ -62,7 +75,7 @@ namespace camera
                 memset(doiMotionLog, 0, CONFIG_STRING_MAX);
                 for (int i = 0; i < UPPER_LIMIT_BLOB_BB; ++i)
                 {
-                    objectBoxs[i] = BoundingBox();
+                    objectBoxes[i] = BoundingBox();
                 }
                 unionBox = BoundingBox();
                 croppedBoundingBox = BoundingBox();
@@ -74,24 +87,75 @@ namespace camera
         {
         public:
             ThumbnailGenerater(CameraFrameHandler *cameraFrameHandler, const std::string &configFile);
-            void generateThumbnail(PayLoadMetaData payLoadMetaData);
-            void createPayLoad(uint8_t *raw,int inputWidth,int inputHeight,int newWidth,int newHeight,MotionEventMetadata metaData,std::string &clipName);
+            ~ThumbnailGenerater();
+            /**
+             * @brief Queues the payload for upload; the JPEG is moved into the upload job.
+             *
+             * An upload that cannot be queued, or fails in a retryable way, goes to the spool and is
+             * replayed once the endpoint accepts uploads again.
+             * @return false if uploads are disabled or the payload could be neither queued nor spooled.
+             */
+            bool generateThumbnail(PayLoadMetaData &&payLoadMetaData);
+            void createPayLoad(const uint8_t *raw, int inputWidth, int inputHeight, int newWidth, int newHeight, const MotionEventMetadata &metaData, const std::string &clipName, PayLoadMetaData *payload);
+            /**
+             * @brief Queues the new best thumbnail candidate for encoding on the encoder thread.
+             *
+             * A candidate that is still waiting is replaced, so only the latest one is encoded. The
+             * frame slot is held until its encode is done.
+             */
+            void submitCandidate(const FrameRef &frame, const MotionEventMetadata &metaData, const std::string &clipName);
+            /**
+             * @brief Hands over the encoded payload of the latest candidate.
+             *
+             * Waits up to THUMBNAIL_ENCODE_WAIT_MS if that encode is still running, then falls back to the
+             * previous finished candidate.
+             * @return false if no candidate was encoded since the last discardCandidates().
+             */
+            bool takePayload(PayLoadMetaData *payload);
+            // Drops the pending candidate and the encoded payload, at the start of a clip
+            void discardCandidates();
             void start();
             uint64_t getLastUploadTime();
             uint32_t getQuiteTime();
 
         private:
             bool loadConfig(const std::string &configFile);
-            void upload();
+            void onUploadComplete(const UploadResult &result);
+            void spoolUpload(const UploadJob &job);
+            void requestReplay();
+            void replaySpool();
+            bool replayBatch(std::vector<SpooledJob> &batch);
+            void encodeCandidates();
             BoundingBox getRelativeBoundingBox(BoundingBox box,ScalingParams params);
             CameraFrameHandler *mCameraFrameHandler;
-            std::thread upLoadThread;
-            std::atomic<bool> keepRunning;
-            std::mutex mUploadMutex;
-            std::atomic<bool> readyToUpload;
-            std::condition_variable mUploadCV;
+            // Thumbnail encoder thread and its candidates, all guarded by mEncodeMutex
+            std::thread mEncodeThread;
+            std::mutex mEncodeMutex;
+            std::condition_variable mEncodeCV;
+            bool keepEncoding;
+            FrameRef mPendingFrame;
+            MotionEventMetadata mPendingMetaData;
+            std::string mPendingClipName;
+            uint64_t mSubmittedSequence; // Sequence of the latest submitted candidate
+            uint64_t mDiscardedSequence; // Candidates up to this one belong to a previous clip
+            uint64_t mEncodedSequence;   // Sequence of the candidate in mEncodedPayload
+            PayLoadMetaData mEncodedPayload;
+            PayLoadMetaData mWorkPayload; // Encoder thread only, swapped with mEncodedPayload
+            std::unique_ptr<UploadEngine> mUploadEngine; // Null when uploads are disabled
+            std::atomic<uint64_t> mUploadSequence;
+            // Spool replay thread; the state below is guarded by mReplayMutex
+            std::unique_ptr<ThumbnailSpool> mSpool; // Null when uploads are disabled or the spool cannot be opened
+            std::thread mReplayThread;
+            std::mutex mReplayMutex;
+            std::condition_variable mReplayCV;
+            bool keepReplaying;
+            bool mReplayWanted;
+            size_t mReplayPending;          // Uploads of the current batch not completed yet
+            std::vector<bool> mReplayDone;  // Per batch entry: acknowledged, or rejected for good
+            std::string mSpoolPath;
+            size_t mSpoolBytes;
             uint32_t mQuiteInterval;
-            uint32_t mLastUploadTime;
+            std::atomic<uint64_t> mLastUploadTime; // Seconds since epoch of the last acknowledged upload
             std::string mUploadUrl;
             std::string mAuth;
             bool isEnabled;
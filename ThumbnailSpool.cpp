@@ -0,0 +1,474 @@
+#include "ThumbnailSpool.hpp"
+#include "Logger.hpp"
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        namespace
+        {
+            constexpr size_t HEADER_BYTES = sizeof(SpoolRecordHeader);
+
+            uint32_t crc32Update(uint32_t crc, const void *data, size_t length)
+            {
+                static const struct Table
+                {
+                    uint32_t entries[256];
+                    Table()
+                    {
+                        for (uint32_t i = 0; i < 256; ++i)
+                        {
+                            uint32_t c = i;
+                            for (int k = 0; k < 8; ++k)
+                            {
+                                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                            }
+                            entries[i] = c;
+                        }
+                    }
+                } table;
+                const uint8_t *bytes = static_cast<const uint8_t *>(data);
+                crc = ~crc;
+                for (size_t i = 0; i < length; ++i)
+                {
+                    crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+                }
+                return ~crc;
+            }
+
+            uint32_t recordCrc(const SpoolRecordHeader &header, const uint8_t *body)
+            {
+                uint32_t crc = crc32Update(0, &header.length, sizeof(header.length));
+                crc = crc32Update(crc, &header.sequence, sizeof(header.sequence));
+                return crc32Update(crc, body, header.length);
+            }
+
+            uint32_t indexCrc(const SpoolIndex &index)
+            {
+                return crc32Update(0, &index, offsetof(SpoolIndex, crc));
+            }
+
+            template <typename T>
+            void put(std::vector<uint8_t> *out, T value)
+            {
+                const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+                out->insert(out->end(), bytes, bytes + sizeof(T));
+            }
+
+            void putString(std::vector<uint8_t> *out, const std::string &text)
+            {
+                put<uint16_t>(out, static_cast<uint16_t>(text.size()));
+                out->insert(out->end(), text.begin(), text.end());
+            }
+
+            template <typename T>
+            bool get(const std::vector<uint8_t> &in, size_t *pos, T *value)
+            {
+                if (in.size() - *pos < sizeof(T))
+                {
+                    return false;
+                }
+                std::memcpy(value, in.data() + *pos, sizeof(T));
+                *pos += sizeof(T);
+                return true;
+            }
+
+            bool getString(const std::vector<uint8_t> &in, size_t *pos, std::string *text)
+            {
+                uint16_t length = 0;
+                if (!get(in, pos, &length) || in.size() - *pos < length)
+                {
+                    return false;
+                }
+                text->assign(reinterpret_cast<const char *>(in.data() + *pos), length);
+                *pos += length;
+                return true;
+            }
+
+            bool writeAll(int fd, const void *data, size_t length, uint64_t offset)
+            {
+                const uint8_t *bytes = static_cast<const uint8_t *>(data);
+                while (length > 0)
+                {
+                    ssize_t written = pwrite(fd, bytes, length, static_cast<off_t>(offset));
+                    if (written < 0)
+                    {
+                        if (errno == EINTR)
+                        {
+                            continue;
+                        }
+                        return false;
+                    }
+                    bytes += written;
+                    length -= static_cast<size_t>(written);
+                    offset += static_cast<uint64_t>(written);
+                }
+                return true;
+            }
+
+            bool readAll(int fd, void *data, size_t length, uint64_t offset)
+            {
+                uint8_t *bytes = static_cast<uint8_t *>(data);
+                while (length > 0)
+                {
+                    ssize_t count = pread(fd, bytes, length, static_cast<off_t>(offset));
+                    if (count < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (count <= 0)
+                    {
+                        return false;
+                    }
+                    bytes += count;
+                    length -= static_cast<size_t>(count);
+                    offset += static_cast<uint64_t>(count);
+                }
+                return true;
+            }
+        }
+
+        ThumbnailSpool::ThumbnailSpool(const std::string &path, size_t segmentBytes)
+            : mPath(path), mSegmentBytes(segmentBytes), mSegmentFd(-1), mIndexFd(-1), mWriteOffset(0), mNextSequence(1)
+        {
+        }
+
+        ThumbnailSpool::~ThumbnailSpool()
+        {
+            if (mSegmentFd >= 0)
+            {
+                ::close(mSegmentFd);
+            }
+            if (mIndexFd >= 0)
+            {
+                ::close(mIndexFd);
+            }
+        }
+
+        int ThumbnailSpool::open()
+        {
+            std::lock_guard<std::mutex> lock(mSpoolMutex);
+            mSegmentFd = ::open(mPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if (mSegmentFd < 0)
+            {
+                LOG_ERROR("open(" << mPath << ") failed: " << strerror(errno));
+                return -1;
+            }
+            std::string indexPath = mPath + ".idx";
+            mIndexFd = ::open(indexPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if (mIndexFd < 0)
+            {
+                LOG_ERROR("open(" << indexPath << ") failed: " << strerror(errno));
+                return -1;
+            }
+            struct stat st;
+            if (fstat(mSegmentFd, &st) != 0)
+            {
+                LOG_ERROR("fstat(" << mPath << ") failed: " << strerror(errno));
+                return -1;
+            }
+            // Allocate every block up front so appends never extend the file or its metadata
+            if (static_cast<size_t>(st.st_size) != mSegmentBytes)
+            {
+                if (ftruncate(mSegmentFd, static_cast<off_t>(mSegmentBytes)) != 0)
+                {
+                    LOG_ERROR("ftruncate(" << mPath << ") failed: " << strerror(errno));
+                    return -1;
+                }
+            }
+            int error = posix_fallocate(mSegmentFd, 0, static_cast<off_t>(mSegmentBytes));
+            if (error != 0)
+            {
+                LOG_ERROR("posix_fallocate(" << mPath << ") failed: " << strerror(error));
+                return -1;
+            }
+            return recover();
+        }
+
+        int ThumbnailSpool::recover()
+        {
+            SpoolIndex index;
+            if (!readAll(mIndexFd, &index, sizeof(index), 0) || index.magic != SPOOL_INDEX_MAGIC || index.version != SPOOL_VERSION ||
+                index.segmentBytes != mSegmentBytes || index.readOffset >= mSegmentBytes || index.crc != indexCrc(index))
+            {
+                // Sequences of a new spool start from the clock, so records left by an earlier one never match
+                LOG_INFO("No usable spool index, starting an empty spool in " << mPath);
+                mEntries.clear();
+                mWriteOffset = 0;
+                mNextSequence = static_cast<uint64_t>(time(nullptr)) << 20;
+                return writeIndex() ? 0 : -1;
+            }
+
+            uint64_t offset = index.readOffset;
+            uint64_t sequence = index.readSequence;
+            bool wrapped = false;
+            std::vector<uint8_t> body;
+            while (true)
+            {
+                if (mSegmentBytes - offset < HEADER_BYTES)
+                {
+                    if (wrapped)
+                    {
+                        break;
+                    }
+                    wrapped = true;
+                    offset = 0;
+                    continue;
+                }
+                SpoolRecordHeader header;
+                if (!readAll(mSegmentFd, &header, HEADER_BYTES, offset))
+                {
+                    break;
+                }
+                if (header.magic == SPOOL_WRAP_MAGIC && header.sequence == sequence && !wrapped)
+                {
+                    wrapped = true;
+                    offset = 0;
+                    continue;
+                }
+                uint64_t end = offset + HEADER_BYTES + header.length;
+                if (header.magic != SPOOL_RECORD_MAGIC || header.sequence != sequence || end > mSegmentBytes || (wrapped && end >= index.readOffset))
+                {
+                    break;
+                }
+                body.resize(header.length);
+                if (!readAll(mSegmentFd, body.data(), body.size(), offset + HEADER_BYTES) || header.crc != recordCrc(header, body.data()))
+                {
+                    LOG_INFO("Spool record " << sequence << " is torn, recovery stops there");
+                    break;
+                }
+                mEntries.push_back({sequence, offset, header.length});
+                offset = end;
+                ++sequence;
+            }
+            mWriteOffset = offset;
+            mNextSequence = sequence;
+            mStats.recovered = mEntries.size();
+            LOG_INFO("Recovered " << mEntries.size() << " spooled uploads from " << mPath);
+            return 0;
+        }
+
+        bool ThumbnailSpool::writeIndex()
+        {
+            SpoolIndex index;
+            std::memset(&index, 0, sizeof(index));
+            index.magic = SPOOL_INDEX_MAGIC;
+            index.version = SPOOL_VERSION;
+            index.segmentBytes = mSegmentBytes;
+            index.readOffset = mEntries.empty() ? mWriteOffset : mEntries.front().offset;
+            index.readSequence = mEntries.empty() ? mNextSequence : mEntries.front().sequence;
+            index.crc = indexCrc(index);
+            if (!writeAll(mIndexFd, &index, sizeof(index), 0) || fdatasync(mIndexFd) != 0)
+            {
+                LOG_ERROR("Writing the spool index failed: " << strerror(errno));
+                return false;
+            }
+            mStats.flashBytes += sizeof(index);
+            mStats.indexWrites++;
+            return true;
+        }
+
+        // The live region runs from the oldest entry to mWriteOffset, possibly wrapping; a record never straddles the end
+        bool ThumbnailSpool::findSpace(size_t recordBytes, uint64_t *offset)
+        {
+            if (mEntries.empty())
+            {
+                *offset = (mWriteOffset + recordBytes <= mSegmentBytes) ? mWriteOffset : 0;
+                return true;
+            }
+            uint64_t readOffset = mEntries.front().offset;
+            if (mWriteOffset >= readOffset)
+            {
+                if (mWriteOffset + recordBytes <= mSegmentBytes)
+                {
+                    *offset = mWriteOffset;
+                    return true;
+                }
+                *offset = 0;
+                return recordBytes < readOffset;
+            }
+            *offset = mWriteOffset;
+            return mWriteOffset + recordBytes < readOffset;
+        }
+
+        bool ThumbnailSpool::append(const UploadJob &job)
+        {
+            std::lock_guard<std::mutex> lock(mSpoolMutex);
+            if (mSegmentFd < 0)
+            {
+                return false;
+            }
+            mScratch.resize(HEADER_BYTES);
+            put<uint16_t>(&mScratch, static_cast<uint16_t>(job.fields.size()));
+            for (const auto &field : job.fields)
+            {
+                putString(&mScratch, field.first);
+                putString(&mScratch, field.second);
+            }
+            putString(&mScratch, job.fileName);
+            putString(&mScratch, job.contentType);
+            put<uint32_t>(&mScratch, static_cast<uint32_t>(job.body.size()));
+            mScratch.insert(mScratch.end(), job.body.begin(), job.body.end());
+            if (mScratch.size() >= mSegmentBytes)
+            {
+                LOG_ERROR("Upload " << job.id << " of " << mScratch.size() << " bytes does not fit the spool");
+                return false;
+            }
+
+            uint64_t offset = 0;
+            bool dropped = false;
+            while (!findSpace(mScratch.size(), &offset))
+            {
+                mEntries.pop_front();
+                mStats.dropped++;
+                dropped = true;
+            }
+            // The cursor must move past the oldest records before they are overwritten
+            if (dropped && !writeIndex())
+            {
+                return false;
+            }
+
+            SpoolRecordHeader header;
+            header.magic = SPOOL_RECORD_MAGIC;
+            header.length = static_cast<uint32_t>(mScratch.size() - HEADER_BYTES);
+            header.sequence = mNextSequence;
+            header.crc = recordCrc(header, mScratch.data() + HEADER_BYTES);
+            header.reserved = 0;
+            std::memcpy(mScratch.data(), &header, HEADER_BYTES);
+
+            if (offset == 0 && mWriteOffset != 0 && mSegmentBytes - mWriteOffset >= HEADER_BYTES)
+            {
+                SpoolRecordHeader wrap;
+                std::memset(&wrap, 0, sizeof(wrap));
+                wrap.magic = SPOOL_WRAP_MAGIC;
+                wrap.sequence = mNextSequence;
+                if (!writeAll(mSegmentFd, &wrap, HEADER_BYTES, mWriteOffset))
+                {
+                    LOG_ERROR("Writing the spool wrap marker failed: " << strerror(errno));
+                    return false;
+                }
+                mStats.flashBytes += HEADER_BYTES;
+            }
+            if (!writeAll(mSegmentFd, mScratch.data(), mScratch.size(), offset) || fdatasync(mSegmentFd) != 0)
+            {
+                LOG_ERROR("Writing upload " << job.id << " to the spool failed: " << strerror(errno));
+                return false;
+            }
+            mEntries.push_back({mNextSequence, offset, header.length});
+            mWriteOffset = offset + mScratch.size();
+            ++mNextSequence;
+            mStats.appended++;
+            mStats.payloadBytes += header.length;
+            mStats.flashBytes += mScratch.size();
+            return true;
+        }
+
+        bool ThumbnailSpool::loadRecord(const Entry &entry, std::vector<uint8_t> *body)
+        {
+            SpoolRecordHeader header;
+            if (!readAll(mSegmentFd, &header, HEADER_BYTES, entry.offset) || header.magic != SPOOL_RECORD_MAGIC ||
+                header.sequence != entry.sequence || header.length != entry.length)
+            {
+                return false;
+            }
+            body->resize(header.length);
+            return readAll(mSegmentFd, body->data(), body->size(), entry.offset + HEADER_BYTES) && header.crc == recordCrc(header, body->data());
+        }
+
+        bool ThumbnailSpool::decodeRecord(const std::vector<uint8_t> &body, UploadJob *job)
+        {
+            size_t pos = 0;
+            uint16_t fieldCount = 0;
+            if (!get(body, &pos, &fieldCount))
+            {
+                return false;
+            }
+            job->fields.resize(fieldCount);
+            for (auto &field : job->fields)
+            {
+                if (!getString(body, &pos, &field.first) || !getString(body, &pos, &field.second))
+                {
+                    return false;
+                }
+            }
+            uint32_t bodyBytes = 0;
+            if (!getString(body, &pos, &job->fileName) || !getString(body, &pos, &job->contentType) ||
+                !get(body, &pos, &bodyBytes) || body.size() - pos != bodyBytes)
+            {
+                return false;
+            }
+            job->body.assign(body.begin() + pos, body.end());
+            return true;
+        }
+
+        size_t ThumbnailSpool::read(size_t maxRecords, std::vector<SpooledJob> *jobs)
+        {
+            std::lock_guard<std::mutex> lock(mSpoolMutex);
+            jobs->clear();
+            std::vector<uint8_t> body;
+            bool dropped = false;
+            size_t i = 0;
+            while (i < mEntries.size() && jobs->size() < maxRecords)
+            {
+                SpooledJob spooled;
+                spooled.sequence = mEntries[i].sequence;
+                if (loadRecord(mEntries[i], &body) && decodeRecord(body, &spooled.job))
+                {
+                    jobs->push_back(std::move(spooled));
+                    ++i;
+                    continue;
+                }
+                LOG_ERROR("Spooled upload " << mEntries[i].sequence << " is corrupt");
+                // A corrupt record at the head is dropped now, one further in ends the batch and reaches the head later
+                if (i != 0)
+                {
+                    break;
+                }
+                mEntries.pop_front();
+                mStats.dropped++;
+                dropped = true;
+            }
+            if (dropped)
+            {
+                writeIndex();
+            }
+            return jobs->size();
+        }
+
+        void ThumbnailSpool::release(uint64_t sequence)
+        {
+            std::lock_guard<std::mutex> lock(mSpoolMutex);
+            bool released = false;
+            while (!mEntries.empty() && mEntries.front().sequence <= sequence)
+            {
+                mEntries.pop_front();
+                mStats.released++;
+                released = true;
+            }
+            if (released)
+            {
+                writeIndex();
+            }
+        }
+
+        size_t ThumbnailSpool::size()
+        {
+            std::lock_guard<std::mutex> lock(mSpoolMutex);
+            return mEntries.size();
+        }
+
+        SpoolStats ThumbnailSpool::stats()
+        {
+            std::lock_guard<std::mutex> lock(mSpoolMutex);
+            return mStats;
+        }
+    }
+}
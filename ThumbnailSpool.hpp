@@ -0,0 +1,139 @@
+#ifndef THUMBNAIL_SPOOL_HPP
+#define THUMBNAIL_SPOOL_HPP
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "UploadEngine.hpp"
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        constexpr uint32_t SPOOL_RECORD_MAGIC = 0x52534E54; // "TNSR"
+        constexpr uint32_t SPOOL_WRAP_MAGIC = 0x57534E54;   // "TNSW", the next record starts at offset 0
+        constexpr uint32_t SPOOL_INDEX_MAGIC = 0x49534E54;  // "TNSI"
+        constexpr uint32_t SPOOL_VERSION = 1;
+        constexpr size_t SPOOL_DEFAULT_BYTES = 4 * 1024 * 1024;
+        // Spooled uploads resubmitted at once; the index is written once per batch
+        constexpr size_t SPOOL_REPLAY_BATCH = 4;
+        // How often replay is retried while the endpoint stays unreachable
+        constexpr int SPOOL_RETRY_INTERVAL_S = 30;
+
+        /**
+         * @struct SpoolRecordHeader
+         * @brief Precedes every record in the segment; crc covers length, sequence and the record body.
+         */
+        struct SpoolRecordHeader
+        {
+            uint32_t magic;
+            uint32_t length; // Bytes of record body after the header
+            uint64_t sequence;
+            uint32_t crc;
+            uint32_t reserved;
+        };
+
+        /**
+         * @struct SpoolIndex
+         * @brief Content of the index file: where the oldest unacknowledged record starts.
+         */
+        struct SpoolIndex
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t segmentBytes;
+            uint64_t readOffset;
+            uint64_t readSequence;
+            uint32_t crc; // Over the fields above
+            uint32_t reserved;
+        };
+
+        /**
+         * @struct SpoolStats
+         * @brief Spool counters. flashBytes / payloadBytes is the write amplification of the spool.
+         */
+        struct SpoolStats
+        {
+            uint64_t appended;
+            uint64_t released;  // Acknowledged after replay
+            uint64_t dropped;   // Overwritten while full, or found corrupt
+            uint64_t recovered; // Found in the segment at startup
+            uint64_t payloadBytes; // Record bodies appended
+            uint64_t flashBytes;   // Everything written: bodies, headers, wrap markers and index updates
+            uint64_t indexWrites;
+            SpoolStats() : appended(0), released(0), dropped(0), recovered(0), payloadBytes(0), flashBytes(0), indexWrites(0) {}
+        };
+
+        struct SpooledJob
+        {
+            uint64_t sequence;
+            UploadJob job;
+        };
+
+        /**
+         * @brief Bounded on-flash spool for uploads the endpoint did not take.
+         *
+         * Records are appended to a single preallocated segment used as a ring, so flash only sees
+         * sequential writes and the file never grows. A small index file holds the read cursor and is
+         * rewritten once per replayed batch, or before the oldest records are overwritten when the spool
+         * is full. At startup the segment is scanned from the cursor and records are accepted while
+         * their magic, sequence and crc check out, which drops a record torn by a crash.
+         */
+        class ThumbnailSpool
+        {
+        public:
+            ThumbnailSpool(const std::string &path, size_t segmentBytes = SPOOL_DEFAULT_BYTES);
+            ~ThumbnailSpool();
+            ThumbnailSpool(const ThumbnailSpool &) = delete;
+            ThumbnailSpool &operator=(const ThumbnailSpool &) = delete;
+
+            /**
+             * @brief Creates or opens the segment and index, then recovers the spooled records.
+             * @return 0 on success, -1 if the files cannot be used.
+             */
+            int open();
+            /**
+             * @brief Appends the job's fields, file name and body; the oldest records make room if needed.
+             * @return false if the spool is not open, the job is larger than the segment or the write failed.
+             */
+            bool append(const UploadJob &job);
+            /**
+             * @brief Reads up to @p maxRecords of the oldest records, in order, without removing them.
+             * @return Number of records read.
+             */
+            size_t read(size_t maxRecords, std::vector<SpooledJob> *jobs);
+            // Removes the records up to and including @p sequence
+            void release(uint64_t sequence);
+            size_t size();
+            SpoolStats stats();
+
+        private:
+            struct Entry
+            {
+                uint64_t sequence;
+                uint64_t offset;
+                uint32_t length;
+            };
+
+            int recover();
+            bool writeIndex();
+            bool findSpace(size_t recordBytes, uint64_t *offset);
+            bool loadRecord(const Entry &entry, std::vector<uint8_t> *body);
+            static bool decodeRecord(const std::vector<uint8_t> &body, UploadJob *job);
+
+            std::string mPath;
+            size_t mSegmentBytes;
+            int mSegmentFd;
+            int mIndexFd;
+            std::mutex mSpoolMutex; // Guards everything below
+            std::deque<Entry> mEntries;
+            uint64_t mWriteOffset;
+            uint64_t mNextSequence;
+            std::vector<uint8_t> mScratch;
+            SpoolStats mStats;
+        };
+    }
+}
+#endif // THUMBNAIL_SPOOL_HPP
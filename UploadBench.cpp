@@ -0,0 +1,112 @@
+#include "UploadEngine.hpp"
+#include "PipelineTracer.hpp"
+#include "Logger.hpp"
+
+#include <log4cplus/configurator.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Drives UploadEngine against uploadServer (or any endpoint) and reports the upload rate and the
+// event to acknowledgement latency, measured from the moment the thumbnail would have been handed
+// over to the response of the server, queueing included.
+// Usage: uploadBench [url, default http://127.0.0.1:8089/upload] [uploads, default 500]
+//                    [events per second, 0 = as fast as the queue takes them] [thumbnail bytes, default 30000]
+
+using namespace ::camera;
+using namespace ::camera::camera_ml;
+
+int main(int argc, char *argv[])
+{
+  log4cplus::initialize();
+  log4cplus::BasicConfigurator::doConfigure();
+  Logger::refreshLevel();
+  std::string url = (argc > 1) ? argv[1] : "http://127.0.0.1:8089/upload";
+  long count = (argc > 2) ? std::atol(argv[2]) : 500;
+  int rate = (argc > 3) ? std::atoi(argv[3]) : 0;
+  size_t bodySize = (argc > 4) ? static_cast<size_t>(std::atol(argv[4])) : 30000;
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  long succeeded = 0;
+  long failed = 0;
+  {
+    UploadEngine engine(url, "");
+    if (engine.start() != 0)
+    {
+      curl_global_cleanup();
+      return 1;
+    }
+    std::vector<uint8_t> body(bodySize);
+    for (size_t i = 0; i < body.size(); ++i)
+    {
+      body[i] = static_cast<uint8_t>(i * 31);
+    }
+    LatencyHistogram latency;
+    std::mutex mutex;
+    std::condition_variable done;
+    long outstanding = 0;
+    // A completion callback runs before its slot takes the next queued job, so only the queue is
+    // counted on; more would get uploads rejected
+    const long maxOutstanding = static_cast<long>(UPLOAD_QUEUE_SLOTS);
+
+    auto begin = std::chrono::steady_clock::now();
+    auto next = begin;
+    for (long i = 0; i < count; ++i)
+    {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&]
+                  { return outstanding < maxOutstanding; });
+        outstanding++;
+      }
+      auto eventTime = std::chrono::steady_clock::now();
+      UploadJob job;
+      job.id = static_cast<uint64_t>(i + 1);
+      job.body = body;
+      job.fileName = "bench_" + std::to_string(i) + ".jpg";
+      job.fields.emplace_back("clip", "bench_" + std::to_string(i));
+      job.onComplete = [&, eventTime](const UploadResult &result, UploadJob &)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result.ok())
+        {
+          succeeded++;
+          latency.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - eventTime).count());
+        }
+        else
+        {
+          failed++;
+        }
+        outstanding--;
+        done.notify_all();
+      };
+      if (!engine.submit(std::move(job)))
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed++;
+        outstanding--;
+      }
+      if (rate > 0)
+      {
+        next += std::chrono::microseconds(1000000 / rate);
+        std::this_thread::sleep_until(next);
+      }
+    }
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      done.wait(lock, [&]
+                { return outstanding == 0; });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << succeeded << " uploaded, " << failed << " failed in " << seconds << " s, " << (seconds > 0 ? succeeded / seconds : 0) << " uploads/s" << std::endl;
+    std::cout << "Event to ack latency p50/p90/p99/max: " << latency.quantile(0.5) << "/" << latency.quantile(0.9) << "/" << latency.quantile(0.99) << "/"
+              << latency.max() << " us" << std::endl;
+  }
+  curl_global_cleanup();
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,328 @@
+#include "UploadEngine.hpp"
+#include "Logger.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        UploadEngine::UploadEngine(const std::string &url, const std::string &auth, size_t maxInFlight)
+            : mUrl(url), mHeaders(nullptr), mMulti(nullptr), mTransfers(std::max<size_t>(maxInFlight, 1)), keepRunning(false)
+        {
+            if (!auth.empty())
+            {
+                mHeaders = curl_slist_append(mHeaders, ("Authorization: " + auth).c_str());
+            }
+            // No 100-continue round trip before each body
+            mHeaders = curl_slist_append(mHeaders, "Expect:");
+            MetricsRegistry &registry = MetricsRegistry::instance();
+            mQueueDepthMetric = registry.gauge("surveillance_upload_queue_depth", "Thumbnail uploads queued or in flight");
+            mSucceededMetric = registry.counter("surveillance_uploads_total", "Thumbnail uploads by outcome", "result=\"ok\"");
+            mFailedMetric = registry.counter("surveillance_uploads_total", "Thumbnail uploads by outcome", "result=\"failed\"");
+            mRejectedMetric = registry.counter("surveillance_uploads_total", "Thumbnail uploads by outcome", "result=\"rejected\"");
+            mCancelledMetric = registry.counter("surveillance_uploads_total", "Thumbnail uploads by outcome", "result=\"cancelled\"");
+            mLatencyMetric = registry.summary("surveillance_upload_latency_us", "Time from submit to the server response of successful uploads, in microseconds");
+
+            mMulti = curl_multi_init();
+            if (!mMulti)
+            {
+                LOG_ERROR("Failed to create the curl multi handle");
+                return;
+            }
+            curl_multi_setopt(mMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+            curl_multi_setopt(mMulti, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(mTransfers.size()));
+            curl_multi_setopt(mMulti, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(mTransfers.size()));
+
+            // The options that do not change between uploads are set once per pooled handle
+            for (Transfer &transfer : mTransfers)
+            {
+                transfer.easy = curl_easy_init();
+                if (!transfer.easy)
+                {
+                    LOG_ERROR("Failed to create a curl easy handle");
+                    continue;
+                }
+                curl_easy_setopt(transfer.easy, CURLOPT_URL, mUrl.c_str());
+                curl_easy_setopt(transfer.easy, CURLOPT_HTTPHEADER, mHeaders);
+                curl_easy_setopt(transfer.easy, CURLOPT_WRITEFUNCTION, discardResponse);
+                curl_easy_setopt(transfer.easy, CURLOPT_PRIVATE, &transfer);
+                curl_easy_setopt(transfer.easy, CURLOPT_NOSIGNAL, 1L);
+                curl_easy_setopt(transfer.easy, CURLOPT_TCP_KEEPALIVE, 1L);
+                curl_easy_setopt(transfer.easy, CURLOPT_CONNECTTIMEOUT_MS, UPLOAD_CONNECT_TIMEOUT_MS);
+                curl_easy_setopt(transfer.easy, CURLOPT_TIMEOUT_MS, UPLOAD_TIMEOUT_MS);
+                curl_easy_setopt(transfer.easy, CURLOPT_HTTP_VERSION, static_cast<long>(CURL_HTTP_VERSION_2TLS));
+                // Prefer waiting for a multiplexed stream on the open connection over opening another one
+                curl_easy_setopt(transfer.easy, CURLOPT_PIPEWAIT, 1L);
+            }
+        }
+
+        UploadEngine::~UploadEngine()
+        {
+            stop();
+            for (Transfer &transfer : mTransfers)
+            {
+                if (transfer.easy)
+                {
+                    curl_easy_cleanup(transfer.easy);
+                }
+            }
+            if (mMulti)
+            {
+                curl_multi_cleanup(mMulti);
+            }
+            curl_slist_free_all(mHeaders);
+        }
+
+        int UploadEngine::start()
+        {
+            if (mEngineThread.joinable())
+            {
+                return 0;
+            }
+            if (!mMulti)
+            {
+                LOG_ERROR("Upload engine not started, curl is not initialised");
+                return -1;
+            }
+            keepRunning = true;
+            mEngineThread = std::thread(&UploadEngine::run, this);
+            return 0;
+        }
+
+        void UploadEngine::stop()
+        {
+            if (!mEngineThread.joinable())
+            {
+                return;
+            }
+            keepRunning = false;
+            curl_multi_wakeup(mMulti);
+            mEngineThread.join();
+        }
+
+        bool UploadEngine::submit(UploadJob &&job)
+        {
+            bool rejected = false;
+            size_t queued = 0;
+            {
+                std::lock_guard<std::mutex> lock(mQueueMutex);
+                if (!keepRunning || mJobs.size() >= UPLOAD_QUEUE_SLOTS)
+                {
+                    mStats.rejected++;
+                    queued = mJobs.size();
+                    rejected = true;
+                }
+                else
+                {
+                    job.submitTime = std::chrono::steady_clock::now();
+                    mJobs.push_back(std::move(job));
+                    mStats.submitted++;
+                }
+            }
+            if (rejected)
+            {
+                // Logged outside mQueueMutex, the curl worker and the completions take it too
+                mRejectedMetric->inc();
+                LOG_ERROR("Upload " << job.id << " rejected, " << queued << " queued");
+                return false;
+            }
+            mQueueDepthMetric->add(1);
+            curl_multi_wakeup(mMulti);
+            return true;
+        }
+
+        UploadStats UploadEngine::stats()
+        {
+            std::lock_guard<std::mutex> lock(mQueueMutex);
+            return mStats;
+        }
+
+        size_t UploadEngine::readBody(char *buffer, size_t size, size_t nitems, void *arg)
+        {
+            Transfer *transfer = static_cast<Transfer *>(arg);
+            const std::vector<uint8_t> &body = transfer->job.body;
+            size_t count = std::min(size * nitems, body.size() - transfer->readOffset);
+            std::memcpy(buffer, body.data() + transfer->readOffset, count);
+            transfer->readOffset += count;
+            return count;
+        }
+
+        // Lets curl rewind the body, e.g. when a reused connection turned out to be closed
+        int UploadEngine::seekBody(void *arg, curl_off_t offset, int origin)
+        {
+            Transfer *transfer = static_cast<Transfer *>(arg);
+            if (origin != SEEK_SET || offset < 0 || static_cast<size_t>(offset) > transfer->job.body.size())
+            {
+                return CURL_SEEKFUNC_CANTSEEK;
+            }
+            transfer->readOffset = static_cast<size_t>(offset);
+            return CURL_SEEKFUNC_OK;
+        }
+
+        size_t UploadEngine::discardResponse(char *ptr, size_t size, size_t nmemb, void *userdata)
+        {
+            (void)ptr;
+            (void)userdata;
+            return size * nmemb;
+        }
+
+        bool UploadEngine::startTransfer(Transfer &transfer, UploadJob &&job)
+        {
+            transfer.job = std::move(job);
+            transfer.readOffset = 0;
+            transfer.mime = curl_mime_init(transfer.easy);
+            for (const auto &field : transfer.job.fields)
+            {
+                curl_mimepart *part = curl_mime_addpart(transfer.mime);
+                curl_mime_name(part, field.first.c_str());
+                curl_mime_data(part, field.second.c_str(), CURL_ZERO_TERMINATED);
+            }
+            curl_mimepart *filePart = curl_mime_addpart(transfer.mime);
+            curl_mime_name(filePart, "file");
+            curl_mime_filename(filePart, transfer.job.fileName.c_str());
+            curl_mime_type(filePart, transfer.job.contentType.c_str());
+            curl_mime_data_cb(filePart, static_cast<curl_off_t>(transfer.job.body.size()), readBody, seekBody, nullptr, &transfer);
+            curl_easy_setopt(transfer.easy, CURLOPT_MIMEPOST, transfer.mime);
+
+            CURLMcode code = curl_multi_add_handle(mMulti, transfer.easy);
+            if (code != CURLM_OK)
+            {
+                LOG_ERROR("Failed to start upload " << transfer.job.id << ": " << curl_multi_strerror(code));
+                finishTransfer(transfer, CURLE_FAILED_INIT);
+                return false;
+            }
+            transfer.busy = true;
+            return true;
+        }
+
+        void UploadEngine::finishTransfer(Transfer &transfer, CURLcode result)
+        {
+            long httpCode = 0;
+            curl_easy_getinfo(transfer.easy, CURLINFO_RESPONSE_CODE, &httpCode);
+            completeJob(transfer.job, result, httpCode);
+            curl_easy_setopt(transfer.easy, CURLOPT_MIMEPOST, nullptr);
+            curl_mime_free(transfer.mime);
+            transfer.mime = nullptr;
+            transfer.job = UploadJob();
+            transfer.busy = false;
+        }
+
+        // Accounts for a job that left the engine and runs its callback
+        void UploadEngine::completeJob(UploadJob &job, CURLcode result, long httpCode)
+        {
+            UploadResult uploadResult;
+            uploadResult.id = job.id;
+            uploadResult.curlCode = result;
+            uploadResult.httpCode = httpCode;
+            uploadResult.latencyUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - job.submitTime).count();
+            {
+                std::lock_guard<std::mutex> lock(mQueueMutex);
+                if (uploadResult.ok())
+                {
+                    mStats.succeeded++;
+                    mStats.latencyTotalUs += uploadResult.latencyUs;
+                    mStats.latencyMaxUs = std::max(mStats.latencyMaxUs, uploadResult.latencyUs);
+                }
+                else
+                {
+                    mStats.failed++;
+                }
+            }
+            mQueueDepthMetric->add(-1);
+            if (uploadResult.ok())
+            {
+                mSucceededMetric->inc();
+                mLatencyMetric->record(uploadResult.latencyUs);
+                LOG_DEBUG("Upload " << uploadResult.id << " done in " << uploadResult.latencyUs << " us");
+            }
+            else if (result == UPLOAD_CANCELLED)
+            {
+                mCancelledMetric->inc();
+                LOG_INFO("Upload " << uploadResult.id << " cancelled by shutdown");
+            }
+            else
+            {
+                mFailedMetric->inc();
+                LOG_ERROR("Upload " << uploadResult.id << " failed: " << curl_easy_strerror(result) << ", HTTP " << uploadResult.httpCode);
+            }
+            if (job.onComplete)
+            {
+                auto onComplete = std::move(job.onComplete);
+                onComplete(uploadResult, job);
+            }
+        }
+
+        /**
+         * Engine thread: hands queued jobs to free transfers, drives curl and completes finished
+         * transfers. Sleeps in curl_multi_poll until there is socket activity or submit() wakes it.
+         */
+        void UploadEngine::run()
+        {
+            while (keepRunning)
+            {
+                for (Transfer &transfer : mTransfers)
+                {
+                    if (transfer.busy || !transfer.easy)
+                    {
+                        continue;
+                    }
+                    UploadJob job;
+                    {
+                        std::lock_guard<std::mutex> lock(mQueueMutex);
+                        if (mJobs.empty())
+                        {
+                            break;
+                        }
+                        job = std::move(mJobs.front());
+                        mJobs.pop_front();
+                    }
+                    startTransfer(transfer, std::move(job));
+                }
+
+                int running = 0;
+                curl_multi_perform(mMulti, &running);
+                bool finished = false;
+                int pending = 0;
+                while (CURLMsg *message = curl_multi_info_read(mMulti, &pending))
+                {
+                    if (message->msg != CURLMSG_DONE)
+                    {
+                        continue;
+                    }
+                    Transfer *transfer = nullptr;
+                    curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &transfer);
+                    CURLcode result = message->data.result;
+                    curl_multi_remove_handle(mMulti, message->easy_handle);
+                    finishTransfer(*transfer, result);
+                    finished = true;
+                }
+                // A finished transfer frees a slot for the next queued job right away
+                if (!finished)
+                {
+                    curl_multi_poll(mMulti, nullptr, 0, 1000, nullptr);
+                }
+            }
+            // Unfinished uploads still complete, as cancelled, so that their owner can keep them
+            for (Transfer &transfer : mTransfers)
+            {
+                if (transfer.busy)
+                {
+                    curl_multi_remove_handle(mMulti, transfer.easy);
+                    finishTransfer(transfer, UPLOAD_CANCELLED);
+                }
+            }
+            // submit() no longer queues once keepRunning is false, so nothing arrives after this
+            std::deque<UploadJob> leftover;
+            {
+                std::lock_guard<std::mutex> lock(mQueueMutex);
+                leftover.swap(mJobs);
+            }
+            for (UploadJob &job : leftover)
+            {
+                completeJob(job, UPLOAD_CANCELLED, 0);
+            }
+        }
+    }
+}
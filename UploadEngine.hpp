@@ -0,0 +1,146 @@
+#ifndef UPLOAD_ENGINE_HPP
+#define UPLOAD_ENGINE_HPP
+
+#include "MetricsRegistry.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <curl/curl.h>
+
+namespace camera
+{
+    namespace camera_ml
+    {
+        // Transfers running at once, each on its own pooled easy handle and kept-alive connection.
+        constexpr size_t UPLOAD_MAX_IN_FLIGHT = 2;
+        // Uploads waiting for a transfer slot; further submits are rejected.
+        constexpr size_t UPLOAD_QUEUE_SLOTS = 8;
+        constexpr long UPLOAD_CONNECT_TIMEOUT_MS = 5000;
+        constexpr long UPLOAD_TIMEOUT_MS = 15000;
+        // Result of the uploads still queued or in flight when the engine stops; retryable()
+        constexpr CURLcode UPLOAD_CANCELLED = CURLE_ABORTED_BY_CALLBACK;
+
+        /**
+         * @struct UploadResult
+         * @brief Outcome of one upload, passed to its completion callback on the engine thread.
+         */
+        struct UploadResult
+        {
+            uint64_t id;
+            CURLcode curlCode;
+            long httpCode;
+            int64_t latencyUs; // From submit() to the server's response
+            bool ok() const
+            {
+                return curlCode == CURLE_OK && httpCode >= 200 && httpCode < 300;
+            }
+            // Failed in a way a later attempt may not: no response, timeout, throttling or a server error
+            bool retryable() const
+            {
+                return curlCode != CURLE_OK || httpCode == 408 || httpCode == 429 || httpCode >= 500;
+            }
+        };
+
+        /**
+         * @struct UploadJob
+         * @brief One multipart POST: text fields plus a file part streamed from @ref body.
+         *
+         * onComplete gets the job back, so a failed upload can be kept for a retry.
+         */
+        struct UploadJob
+        {
+            uint64_t id = 0;
+            std::vector<uint8_t> body;
+            std::string fileName;
+            std::string contentType = "image/jpeg";
+            std::vector<std::pair<std::string, std::string>> fields;
+            std::function<void(const UploadResult &, UploadJob &)> onComplete;
+            std::chrono::steady_clock::time_point submitTime;
+        };
+
+        /**
+         * @struct UploadStats
+         * @brief Counters of the engine; latency is submit to response of successful uploads, in microseconds.
+         */
+        struct UploadStats
+        {
+            uint64_t submitted;
+            uint64_t succeeded;
+            uint64_t failed;
+            uint64_t rejected;
+            int64_t latencyTotalUs;
+            int64_t latencyMaxUs;
+            UploadStats() : submitted(0), succeeded(0), failed(0), rejected(0), latencyTotalUs(0), latencyMaxUs(0) {}
+        };
+
+        /**
+         * @brief Uploads thumbnails with libcurl's multi interface on one thread.
+         *
+         * Easy handles are pooled and the multi handle keeps their connections alive, so back to back
+         * events reuse an open connection (and TLS session) instead of reconnecting. At most
+         * UPLOAD_MAX_IN_FLIGHT transfers run at once; on an HTTP/2 server they are multiplexed over a
+         * single connection. Bodies are streamed from memory through curl_mime_data_cb, nothing is
+         * written to /tmp.
+         */
+        class UploadEngine
+        {
+        public:
+            UploadEngine(const std::string &url, const std::string &auth, size_t maxInFlight = UPLOAD_MAX_IN_FLIGHT);
+            ~UploadEngine();
+            UploadEngine(const UploadEngine &) = delete;
+            UploadEngine &operator=(const UploadEngine &) = delete;
+
+            int start();
+            // Cancels whatever is still queued or in flight; their callbacks run on the engine thread with UPLOAD_CANCELLED before it exits
+            void stop();
+            /**
+             * @brief Queues an upload.
+             * @return false if the queue is full or the engine is not running; the job is left untouched.
+             */
+            bool submit(UploadJob &&job);
+            UploadStats stats();
+
+        private:
+            struct Transfer
+            {
+                CURL *easy = nullptr;
+                curl_mime *mime = nullptr;
+                UploadJob job;
+                size_t readOffset = 0;
+                bool busy = false;
+            };
+
+            static size_t readBody(char *buffer, size_t size, size_t nitems, void *arg);
+            static int seekBody(void *arg, curl_off_t offset, int origin);
+            static size_t discardResponse(char *ptr, size_t size, size_t nmemb, void *userdata);
+            void run();
+            bool startTransfer(Transfer &transfer, UploadJob &&job);
+            void finishTransfer(Transfer &transfer, CURLcode result);
+            void completeJob(UploadJob &job, CURLcode result, long httpCode);
+
+            std::string mUrl;
+            curl_slist *mHeaders;
+            CURLM *mMulti;
+            std::vector<Transfer> mTransfers;
+            std::thread mEngineThread;
+            std::atomic<bool> keepRunning;
+            std::mutex mQueueMutex; // Guards mJobs and mStats
+            std::deque<UploadJob> mJobs;
+            UploadStats mStats;
+            Gauge *mQueueDepthMetric; // Queued plus in flight
+            Counter *mSucceededMetric;
+            Counter *mFailedMetric;
+            Counter *mRejectedMetric;
+            Counter *mCancelledMetric;
+            LatencyHistogram *mLatencyMetric;
+        };
+    }
+}
+#endif // UPLOAD_ENGINE_HPP
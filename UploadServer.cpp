@@ -0,0 +1,187 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+
+// Stand-in for the thumbnail upload server: accepts the multipart POSTs of UploadEngine over
+// HTTP/1.1 keep-alive connections on 127.0.0.1, discards the body and acknowledges each request.
+// Usage: uploadServer [port, default 8089] [response delay ms, default 0] [fail every Nth request with 503, 0 = never]
+
+volatile std::sig_atomic_t stop;
+
+void signalHandler(int signum)
+{
+  stop = 1;
+}
+
+static std::atomic<long> requests(0);
+static std::atomic<long> bodyBytes(0);
+
+// Reads from the socket into buffer, false once the peer closed the connection or on shutdown
+static bool readMore(int fd, std::string &buffer)
+{
+  char chunk[16384];
+  while (!stop)
+  {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+    {
+      continue;
+    }
+    ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+    if (n <= 0)
+    {
+      return false;
+    }
+    buffer.append(chunk, static_cast<size_t>(n));
+    return true;
+  }
+  return false;
+}
+
+// Consumes a chunked body from the front of buffer, false if the connection went away first
+static bool skipChunkedBody(int fd, std::string &buffer, long *bytes)
+{
+  while (true)
+  {
+    size_t lineEnd;
+    while ((lineEnd = buffer.find("\r\n")) == std::string::npos)
+    {
+      if (!readMore(fd, buffer))
+      {
+        return false;
+      }
+    }
+    long size = std::strtol(buffer.c_str(), nullptr, 16);
+    buffer.erase(0, lineEnd + 2);
+    // Chunk data and its CRLF; the last chunk is followed by the final CRLF, trailers are not expected
+    size_t needed = static_cast<size_t>(size) + 2;
+    while (buffer.size() < needed)
+    {
+      if (!readMore(fd, buffer))
+      {
+        return false;
+      }
+    }
+    buffer.erase(0, needed);
+    *bytes += size;
+    if (size == 0)
+    {
+      return true;
+    }
+  }
+}
+
+static void serveConnection(int fd, int delayMs, int failEvery)
+{
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  std::string buffer;
+  while (!stop)
+  {
+    size_t headerEnd;
+    while ((headerEnd = buffer.find("\r\n\r\n")) == std::string::npos)
+    {
+      if (!readMore(fd, buffer))
+      {
+        close(fd);
+        return;
+      }
+    }
+    std::string headers = buffer.substr(0, headerEnd);
+    buffer.erase(0, headerEnd + 4);
+    for (char &c : headers)
+    {
+      c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    }
+    long bytes = 0;
+    size_t lengthPos = headers.find("\r\ncontent-length:");
+    if (headers.find("transfer-encoding: chunked") != std::string::npos)
+    {
+      if (!skipChunkedBody(fd, buffer, &bytes))
+      {
+        break;
+      }
+    }
+    else if (lengthPos != std::string::npos)
+    {
+      bytes = std::atol(headers.c_str() + lengthPos + std::strlen("\r\ncontent-length:"));
+      while (buffer.size() < static_cast<size_t>(bytes))
+      {
+        if (!readMore(fd, buffer))
+        {
+          close(fd);
+          return;
+        }
+      }
+      buffer.erase(0, static_cast<size_t>(bytes));
+    }
+    long count = ++requests;
+    bodyBytes += bytes;
+    if (delayMs > 0)
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+    }
+    bool fail = failEvery > 0 && count % failEvery == 0;
+    const char *response = fail ? "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n" : "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+    if (send(fd, response, std::strlen(response), MSG_NOSIGNAL) < 0)
+    {
+      break;
+    }
+  }
+  close(fd);
+}
+
+int main(int argc, char *argv[])
+{
+  std::signal(SIGINT, signalHandler);
+  int port = (argc > 1) ? std::atoi(argv[1]) : 8089;
+  int delayMs = (argc > 2) ? std::atoi(argv[2]) : 0;
+  int failEvery = (argc > 3) ? std::atoi(argv[3]) : 0;
+
+  int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  int one = 1;
+  setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr;
+  std::memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(static_cast<uint16_t>(port));
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (listenFd < 0 || bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 || listen(listenFd, 16) != 0)
+  {
+    std::cerr << "Failed to listen on 127.0.0.1:" << port << ": " << std::strerror(errno) << std::endl;
+    return 1;
+  }
+  std::cout << "Accepting uploads on http://127.0.0.1:" << port << "/upload, delay " << delayMs << " ms" << std::endl;
+
+  auto begin = std::chrono::steady_clock::now();
+  while (!stop)
+  {
+    struct pollfd pfd = {listenFd, POLLIN, 0};
+    if (poll(&pfd, 1, 200) <= 0)
+    {
+      continue;
+    }
+    int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd >= 0)
+    {
+      std::thread(serveConnection, fd, delayMs, failEvery).detach();
+    }
+  }
+  close(listenFd);
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  std::cout << requests << " requests, " << bodyBytes << " body bytes in " << seconds << " s" << std::endl;
+  return 0;
+}
@@ -1,9 +1,12 @@
 
 #include "SurveillanceSystem.hpp"
 #include "RTMessageBroker.hpp"
+#include "MetricsRegistry.hpp"
+#include "FlightRecorder.hpp"
 #include "Logger.hpp"
 
 #include <log4cplus/configurator.h>
+#include <curl/curl.h>
 #include <csignal>
 
 volatile std::sig_atomic_t stop;
@@ -12,14 +15,29 @@ void signalHandler(int signum)
 {
   stop = 1;
 }
+
+// The dump itself runs on the main thread, a signal handler may not do file IO or log
+void dumpSignalHandler(int signum)
+{
+  FlightRecorder::requestDump();
+}
 using namespace ::camera;
 using namespace ::camera::camera_ml;
 
 int main(int argc, char *argv[])
 {
   std::signal(SIGINT, signalHandler); // Handle Ctrl+C signal
+  std::signal(SIGUSR1, dumpSignalHandler); // kill -USR1 writes the flight recorder to FLIGHT_RECORDER_DUMP_PATH
+  // Before any thread exists, curl_global_init is not thread safe
+  curl_global_init(CURL_GLOBAL_DEFAULT);
   log4cplus::initialize();
   log4cplus::PropertyConfigurator::doConfigure("/opt/log4cplus.properties");
+  Logger::refreshLevel();
+  // Logs are written in large binary blocks by a background thread; decode them with logDecoder
+  if (!Logger::startAsync("/opt/surveillance.blog"))
+  {
+    LOG_ERROR("Asynchronous logging unavailable, logging through log4cplus");
+  }
   std::string eventConfPath = "/opt/usr_config/tn_upload.conf";
 #ifdef ENABLE_CLASSIFICATION
   std::string personModelPath = "/etc/mediapipe/models/xcv-person-detection-224x224-440k.tflite";
@@ -33,6 +51,10 @@ int main(int argc, char *argv[])
 #endif
   RTMessageBroker messageBroker(survSystem);
   messageBroker.rtMsgInit();
+  messageBroker.start();
+  // Scrape with e.g. `socat - UNIX-CONNECT:/tmp/surveillance_metrics.sock`
+  MetricsServer metricsServer;
+  metricsServer.start(METRICS_SOCKET_PATH);
   survSystem->startSurveillance();
   messageBroker.notify("start");
   LOG_INFO("Main thread is free to perform other tasks. Press Ctrl+C to stop.");
@@ -40,16 +62,25 @@ int main(int argc, char *argv[])
   while (!stop)
   {
     std::this_thread::sleep_for(std::chrono::seconds(1)); // Sleep to reduce CPU usage
+    // Requested by SIGUSR1 or on the bus
+    if (FlightRecorder::takeDumpRequest())
+    {
+      FlightRecorder::instance().dump();
+    }
   }
 
   LOG_INFO("Shutting down the surveillance system...");
   // Perform any cleanup here
   messageBroker.notify("stop");
+  metricsServer.stop();
+  messageBroker.stop();
   if (survSystem)
   {
 
     delete survSystem;
     survSystem = nullptr;
   }
+  curl_global_cleanup();
+  Logger::stopAsync();
   return 0;
 }